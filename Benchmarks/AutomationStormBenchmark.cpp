@@ -0,0 +1,189 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDProcessor.h"
+#include <thread>
+
+/**
+ * Hammers the Drive and HpLp parameters from several writer threads while a simulated audio thread calls processBlock
+ * in real time, e.g. one block per block duration. Reports the block processing time, the number of missed deadlines
+ * and how often the chain ran with parameters that were older than the values set before the block started.
+ *
+ * A block counts as stale if the parameters the chain uses or morphs to after processing match neither the parameter
+ * values read right before nor those read right after the block. The staleness is the number of consecutive stale
+ * blocks.
+ *
+ * Usage: OJD-AutomationStormBenchmark [--writers=<n>] [--rate=<changes per second and writer>] [--seconds=<s>]
+ *                                     [--block-size=<n>] [--output=<file>] [--baseline=<file>] [--tolerance=<value>]
+ */
+
+struct StormResult
+{
+    std::vector<double> blockTimesMicroseconds;
+    int numDeadlineMisses = 0;
+    int numStaleBlocks = 0;
+    int maxStalenessInBlocks = 0;
+    juce::int64 numParameterChanges = 0;
+};
+
+static ChainParameters readExpectedParameters (OJDAudioProcessor& processor)
+{
+    auto raw = [&] (const juce::String& id) { return processor.parameters.getRawParameterValue (id)->load(); };
+
+    return OJDParameters::toChainParameters (raw (OJDParameters::Sliders::Drive::id),
+                                             raw (OJDParameters::Sliders::Tone::id),
+                                             raw (OJDParameters::Sliders::Volume::id),
+                                             raw (OJDParameters::Switches::HpLp::id));
+}
+
+static StormResult runStorm (OJDAudioProcessor& processor, int numWriters, double changesPerSecond, double seconds, int blockSize, double sampleRate)
+{
+    StormResult result;
+
+    auto* drive = findParameter (processor, OJDParameters::Sliders::Drive::id);
+    auto* hpLp  = findParameter (processor, OJDParameters::Switches::HpLp::id);
+    jassert (drive != nullptr && hpLp != nullptr);
+
+    std::atomic<bool> stop { false };
+    std::atomic<juce::int64> numChanges { 0 };
+    std::vector<std::thread> writers;
+
+    for (int w = 0; w < numWriters; ++w)
+    {
+        writers.emplace_back ([&, w]
+        {
+            juce::Random random (w);
+            const auto interval = std::chrono::duration<double> (1.0 / changesPerSecond);
+            auto next = std::chrono::steady_clock::now();
+
+            // Each writer alternates between the drive knob and the mode switch, like a fast automation lane would
+            for (int i = 0; ! stop.load(); ++i)
+            {
+                if (i % 2 == 0)
+                    drive->setValueNotifyingHost (random.nextFloat());
+                else
+                    hpLp->setValueNotifyingHost (random.nextBool() ? 1.0f : 0.0f);
+
+                ++numChanges;
+
+                next += std::chrono::duration_cast<std::chrono::steady_clock::duration> (interval);
+                while (std::chrono::steady_clock::now() < next && ! stop.load())
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    juce::AudioBuffer<float> buffer (2, blockSize);
+    juce::MidiBuffer midi;
+
+    const auto blockDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration> (std::chrono::duration<double> (blockSize / sampleRate));
+    const auto numBlocks = static_cast<int> (seconds * sampleRate / blockSize);
+
+    result.blockTimesMicroseconds.reserve (static_cast<size_t> (numBlocks));
+
+    int staleness = 0;
+    auto deadline = std::chrono::steady_clock::now();
+
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        // Waiting for the next callback like a real audio thread would
+        while (std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+
+        deadline += blockDuration;
+
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            for (int i = 0; i < blockSize; ++i)
+                buffer.setSample (ch, i, 0.5f * std::sin (static_cast<float> (i) * 0.05f));
+
+        const auto expectedBefore = readExpectedParameters (processor);
+
+        const auto start = std::chrono::steady_clock::now();
+        // The AudioBuffer overload is hidden by the AudioBlock overload of OJDAudioProcessor
+        static_cast<juce::AudioProcessor&> (processor).processBlock (buffer, midi);
+        const auto end = std::chrono::steady_clock::now();
+
+        const auto expectedAfter = readExpectedParameters (processor);
+        const auto& used = processor.getTargetChainParameters();
+
+        result.blockTimesMicroseconds.push_back (std::chrono::duration<double, std::micro> (end - start).count());
+
+        if (end > deadline)
+            ++result.numDeadlineMisses;
+
+        if (used != expectedBefore && used != expectedAfter)
+        {
+            ++result.numStaleBlocks;
+            result.maxStalenessInBlocks = juce::jmax (result.maxStalenessInBlocks, ++staleness);
+        }
+        else
+        {
+            staleness = 0;
+        }
+    }
+
+    stop.store (true);
+
+    for (auto& writer : writers)
+        writer.join();
+
+    result.numParameterChanges = numChanges.load();
+    return result;
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto option = [&] (const juce::String& name, double defaultValue)
+    {
+        return args.containsOption (name) ? args.getValueForOption (name).getDoubleValue() : defaultValue;
+    };
+
+    const auto numWriters       = static_cast<int> (option ("--writers", 4));
+    const auto changesPerSecond = option ("--rate", 10000.0);
+    const auto seconds          = option ("--seconds", 5.0);
+    const auto blockSize        = static_cast<int> (option ("--block-size", 128));
+    const auto sampleRate       = 48000.0;
+
+    OJDAudioProcessor processor;
+    processor.setPlayConfigDetails (2, 2, sampleRate, blockSize);
+    processor.prepareToPlay (sampleRate, blockSize);
+
+    BenchmarkReport report ("AutomationStormBenchmark");
+
+    // Without any writers first, as reference for the block times under contention
+    auto idle = runStorm (processor, 0, changesPerSecond, juce::jmin (seconds, 1.0), blockSize, sampleRate);
+    report.addResult ("block-time/idle", "us", idle.blockTimesMicroseconds);
+
+    auto storm = runStorm (processor, numWriters, changesPerSecond, seconds, blockSize, sampleRate);
+    const auto caseName = juce::String (numWriters) + "-writers";
+
+    report.addResult ("block-time/"           + caseName, "us",        storm.blockTimesMicroseconds);
+    report.addValue  ("deadline-misses/"      + caseName, "blocks",    storm.numDeadlineMisses);
+    report.addValue  ("stale-blocks/"         + caseName, "blocks",    storm.numStaleBlocks);
+    report.addValue  ("max-staleness/"        + caseName, "blocks",    storm.maxStalenessInBlocks);
+    report.addValue  ("parameter-changes/"    + caseName, "changes/s", static_cast<double> (storm.numParameterChanges) / seconds);
+
+    return report.finish (args);
+}
@@ -0,0 +1,136 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDBatch.h"
+
+/**
+ * Compares the throughput of the OJDBatch with the same number of mono OJDCore instances, each stream processing a sine
+ * at a different frequency and its own Drive setting. The time is measured per block of 10 ms of audio at 48 kHz for
+ * all streams together. The batch is measured with the kernels of every instruction set the CPU supports, pass
+ * --instruction-set=<name> to only measure one of them.
+ *
+ * Usage: OJD-BatchBenchmark [--iterations=<n>] [--instruction-set=<name>] [--output=<file>] [--baseline=<file>]
+ *                           [--tolerance=<value>]
+ */
+
+static constexpr double sampleRate = 48000.0;
+static constexpr int blockSize = 480;
+
+static OJDCore::Parameters getStreamParameters (size_t stream)
+{
+    OJDCore::Parameters parameters;
+    parameters.drive  = static_cast<float> (stream % 11);
+    parameters.hpMode = stream % 2 == 1;
+
+    return parameters;
+}
+
+static void fillWithSines (std::vector<std::vector<float>>& streams, int iteration)
+{
+    for (size_t s = 0; s < streams.size(); ++s)
+        for (size_t i = 0; i < streams[s].size(); ++i)
+            streams[s][i] = 0.5f * std::sin ((0.01f + 0.003f * static_cast<float> (s)) * static_cast<float> (static_cast<size_t> (iteration * blockSize) + i));
+}
+
+template <typename ProcessFn>
+static std::vector<double> measureStreams (int numIterations, size_t numStreams, ProcessFn&& process)
+{
+    std::vector<std::vector<float>> streams (numStreams, std::vector<float> (static_cast<size_t> (blockSize)));
+    std::vector<float*> pointers;
+
+    for (auto& s : streams)
+        pointers.push_back (s.data());
+
+    return measureMilliseconds (numIterations, [&] (int iteration)
+    {
+        fillWithSines (streams, iteration);
+        process (pointers.data());
+    });
+}
+
+static std::vector<double> measureCores (int numIterations, size_t numStreams)
+{
+    std::vector<std::unique_ptr<OJDCore>> cores;
+
+    for (size_t s = 0; s < numStreams; ++s)
+    {
+        cores.push_back (std::make_unique<OJDCore>());
+        cores.back()->setParameters (getStreamParameters (s), 0.0);
+        cores.back()->prepare (sampleRate, blockSize, 1);
+    }
+
+    return measureStreams (numIterations, numStreams, [&] (float* const* streams)
+    {
+        for (size_t s = 0; s < numStreams; ++s)
+            cores[s]->process (streams + s, 1, blockSize);
+    });
+}
+
+static std::vector<double> measureBatch (int numIterations, size_t numStreams)
+{
+    OJDBatch batch (static_cast<int> (numStreams));
+
+    for (size_t s = 0; s < numStreams; ++s)
+        batch.setParameters (static_cast<int> (s), getStreamParameters (s), 0.0);
+
+    batch.prepare (sampleRate);
+
+    return measureStreams (numIterations, numStreams, [&] (float* const* streams)
+    {
+        batch.process (streams, blockSize);
+    });
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 500;
+
+    BenchmarkReport report ("BatchBenchmark");
+
+    std::vector<const DSPKernels*> kernels;
+
+    for (int i = 0; i < DSPKernels::numInstructionSets; ++i)
+        if (auto* k = DSPKernels::get (static_cast<DSPKernels::InstructionSet> (i)))
+            if (! args.containsOption ("--instruction-set") || args.getValueForOption ("--instruction-set") == k->name)
+                kernels.push_back (k);
+
+    for (auto numStreams : { 4, 8, 16 })
+    {
+        const auto caseName = "/streams-" + juce::String (numStreams);
+
+        report.addResult ("cores" + caseName, "ms", measureCores (numIterations, static_cast<size_t> (numStreams)));
+
+        // The kernels are picked when preparing, so forcing them before each case is enough
+        for (auto* k : kernels)
+        {
+            DSPKernels::forceInstructionSet (k->instructionSet);
+            report.addResult ("batch-" + juce::String (k->name) + caseName, "ms", measureBatch (numIterations, static_cast<size_t> (numStreams)));
+        }
+
+        DSPKernels::resetInstructionSet();
+    }
+
+    return report.finish (args);
+}
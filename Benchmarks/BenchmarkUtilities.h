@@ -0,0 +1,190 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+
+/**
+ * Collects the results of a benchmark run and writes them as JSON. The written file can be passed back in as
+ * baseline to a later run of the same benchmark, which will then report all cases whose median got slower than the
+ * baseline median by more than the given tolerance.
+ *
+ * Format:
+ * {
+ *   "suite":   "<benchmark name>",
+ *   "version": "<plugin version>",
+ *   "results": [ { "name": "...", "unit": "ms", "iterations": 10, "min": 0, "median": 0, "mean": 0, "p95": 0, "max": 0 } ]
+ * }
+ */
+class BenchmarkReport
+{
+public:
+    explicit BenchmarkReport (const juce::String& suiteName) : suite (suiteName) {}
+
+    /** Adds the statistics of all samples measured for one benchmark case */
+    void addResult (const juce::String& name, const juce::String& unit, std::vector<double> samples)
+    {
+        jassert (! samples.empty());
+        std::sort (samples.begin(), samples.end());
+
+        auto percentile = [&] (double p)
+        {
+            auto index = static_cast<size_t> (std::ceil (p * static_cast<double> (samples.size()))) - 1;
+            return samples[juce::jlimit<size_t> (0, samples.size() - 1, index)];
+        };
+
+        auto* result = new juce::DynamicObject;
+        result->setProperty ("name",       name);
+        result->setProperty ("unit",       unit);
+        result->setProperty ("iterations", static_cast<int> (samples.size()));
+        result->setProperty ("min",        samples.front());
+        result->setProperty ("median",     percentile (0.5));
+        result->setProperty ("mean",       std::accumulate (samples.begin(), samples.end(), 0.0) / static_cast<double> (samples.size()));
+        result->setProperty ("p95",        percentile (0.95));
+        result->setProperty ("max",        samples.back());
+
+        results.append (juce::var (result));
+    }
+
+    /** Adds a single value that is not the result of repeated measurements, e.g. a count */
+    void addValue (const juce::String& name, const juce::String& unit, double value)
+    {
+        addResult (name, unit, { value });
+    }
+
+    juce::String toJSON() const
+    {
+        auto* root = new juce::DynamicObject;
+        root->setProperty ("suite",   suite);
+        root->setProperty ("version", JucePlugin_VersionString);
+        root->setProperty ("results", results);
+
+        return juce::JSON::toString (juce::var (root));
+    }
+
+    /**
+     * Compares the median of each result with the median of the result with the same name in the baseline and prints
+     * the relative change. Returns the number of cases that got slower by more than the tolerance, e.g. 0.1 for 10%.
+     */
+    int compareWithBaseline (const juce::var& baseline, double tolerance) const
+    {
+        int numRegressions = 0;
+
+        auto* baselineResults = baseline["results"].getArray();
+
+        if (baselineResults == nullptr)
+            return 0;
+
+        for (auto& result : results)
+        {
+            auto name = result["name"].toString();
+
+            for (auto& baselineResult : *baselineResults)
+            {
+                if (baselineResult["name"].toString() != name)
+                    continue;
+
+                const auto baselineMedian = static_cast<double> (baselineResult["median"]);
+                const auto median         = static_cast<double> (result["median"]);
+                const auto relativeChange = baselineMedian > 0.0 ? median / baselineMedian - 1.0 : 0.0;
+                const auto isRegression   = relativeChange > tolerance;
+
+                std::cerr << (isRegression ? "REGRESSION " : "           ") << name << ": "
+                          << juce::String (relativeChange * 100.0, 1) << "%" << std::endl;
+
+                if (isRegression)
+                    ++numRegressions;
+            }
+        }
+
+        return numRegressions;
+    }
+
+    /**
+     * Handles the command line options all benchmarks share and returns the exit code of the benchmark:
+     * --output=<file>     writes the JSON report to the file instead of stdout
+     * --baseline=<file>   compares the results against a previously written report
+     * --tolerance=<value> the relative slowdown that counts as regression, defaults to 0.1
+     */
+    int finish (const juce::ArgumentList& args) const
+    {
+        const auto json = toJSON();
+
+        if (args.containsOption ("--output"))
+            juce::File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--output")).replaceWithText (json);
+        else
+            std::cout << json << std::endl;
+
+        if (! args.containsOption ("--baseline"))
+            return 0;
+
+        auto baselineFile = juce::File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--baseline"));
+        auto baseline = juce::JSON::parse (baselineFile);
+
+        if (! baseline.isObject())
+        {
+            std::cerr << "Could not read baseline " << baselineFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        const auto tolerance = args.containsOption ("--tolerance") ? args.getValueForOption ("--tolerance").getDoubleValue() : 0.1;
+        return compareWithBaseline (baseline, tolerance) > 0 ? 1 : 0;
+    }
+
+private:
+    juce::String suite;
+    juce::Array<juce::var> results;
+};
+
+/** Calls the function the given number of times and returns the duration of each call in milliseconds */
+template <typename Fn>
+std::vector<double> measureMilliseconds (int numIterations, Fn&& fn)
+{
+    std::vector<double> durations;
+    durations.reserve (static_cast<size_t> (numIterations));
+
+    for (int i = 0; i < numIterations; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn (i);
+        const auto end = std::chrono::steady_clock::now();
+
+        durations.push_back (std::chrono::duration<double, std::milli> (end - start).count());
+    }
+
+    return durations;
+}
+
+/** Returns the parameter with the given id or a nullptr if the processor has no such parameter */
+inline juce::AudioProcessorParameterWithID* findParameter (juce::AudioProcessor& processor, const juce::String& id)
+{
+    for (auto* p : processor.getParameters())
+        if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*> (p))
+            if (withID->paramID == id)
+                return withID;
+
+    return nullptr;
+}
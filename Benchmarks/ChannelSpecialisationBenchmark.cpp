@@ -0,0 +1,125 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDCore.h"
+
+/**
+ * Compares the OJDCore processing mono and stereo blocks with the stages compiled for exactly that number of channels
+ * against the same stages compiled for any number of channels, in both HP / LP modes and for planar and interleaved
+ * buffers. The time is measured per block of 10 ms of audio at 48 kHz. Both variants have to produce identical output,
+ * the benchmark fails otherwise.
+ *
+ * Usage: OJD-ChannelSpecialisationBenchmark [--iterations=<n>] [--output=<file>] [--baseline=<file>] [--tolerance=<value>]
+ */
+
+static constexpr double sampleRate = 48000.0;
+static constexpr int blockSize = 480;
+
+/** A sine per channel at different frequencies, so that stereo blocks are never processed as dual mono */
+static void fillWithSines (juce::AudioBuffer<float>& buffer, int iteration)
+{
+    for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        for (int i = 0; i < buffer.getNumSamples(); ++i)
+            buffer.setSample (ch, i, 0.5f * std::sin ((0.01f + 0.003f * static_cast<float> (ch)) * static_cast<float> (iteration * blockSize + i)));
+}
+
+struct Measurement
+{
+    std::vector<double> durations;
+    juce::AudioBuffer<float> lastOutput;
+};
+
+static Measurement measureCore (int numIterations, int numChannels, bool hpMode, bool interleaved, bool specialised)
+{
+    OJDCore core;
+
+    OJDCore::Parameters parameters;
+    parameters.drive  = 8.0f;
+    parameters.hpMode = hpMode;
+
+    core.setChannelSpecialisationsEnabled (specialised);
+    core.setParameters (parameters, 0.0);
+    core.prepare (sampleRate, blockSize, numChannels);
+
+    Measurement measurement;
+    measurement.lastOutput.setSize (numChannels, blockSize);
+
+    std::vector<float> interleavedBuffer (static_cast<size_t> (numChannels * blockSize));
+
+    measurement.durations = measureMilliseconds (numIterations, [&] (int iteration)
+    {
+        fillWithSines (measurement.lastOutput, iteration);
+
+        if (! interleaved)
+        {
+            core.process (measurement.lastOutput.getArrayOfWritePointers(), numChannels, blockSize);
+            return;
+        }
+
+        juce::AudioDataConverters::interleaveSamples (measurement.lastOutput.getArrayOfReadPointers(), interleavedBuffer.data(), blockSize, numChannels);
+        core.processInterleaved (interleavedBuffer.data(), SampleFormat::float32, interleavedBuffer.data(), SampleFormat::float32, numChannels, blockSize);
+        juce::AudioDataConverters::deinterleaveSamples (interleavedBuffer.data(), measurement.lastOutput.getArrayOfWritePointers(), blockSize, numChannels);
+    });
+
+    return measurement;
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 500;
+
+    BenchmarkReport report ("ChannelSpecialisationBenchmark");
+    int numMismatches = 0;
+
+    for (auto numChannels : { 1, 2 })
+    {
+        for (auto hpMode : { false, true })
+        {
+            for (auto interleaved : { false, true })
+            {
+                const auto caseName = juce::String (numChannels == 1 ? "/mono" : "/stereo") + (hpMode ? "/hp" : "/lp") + (interleaved ? "/interleaved" : "/planar");
+
+                const auto dynamic     = measureCore (numIterations, numChannels, hpMode, interleaved, false);
+                const auto specialised = measureCore (numIterations, numChannels, hpMode, interleaved, true);
+
+                report.addResult ("dynamic"     + caseName, "ms", dynamic.durations);
+                report.addResult ("specialised" + caseName, "ms", specialised.durations);
+
+                for (int ch = 0; ch < numChannels; ++ch)
+                {
+                    if (std::memcmp (dynamic.lastOutput.getReadPointer (ch), specialised.lastOutput.getReadPointer (ch), sizeof (float) * blockSize) != 0)
+                    {
+                        std::cerr << "Output mismatch" << caseName << std::endl;
+                        ++numMismatches;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    const auto result = report.finish (args);
+    return numMismatches > 0 ? 1 : result;
+}
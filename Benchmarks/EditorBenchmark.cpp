@@ -0,0 +1,146 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDAudioProcessorEditor.h"
+
+/**
+ * Measures how long it takes to open the editor and to paint it. The editor is never put on the desktop, all painting
+ * happens into offscreen images, so this works on headless machines too.
+ *
+ * Usage: OJD-EditorBenchmark [--iterations=<n>] [--output=<file>] [--baseline=<file>] [--tolerance=<value>]
+ */
+
+/** Returns an editor size that satisfies the editor constraints for a content height scaled by the given factor */
+static juce::Rectangle<int> editorBoundsForScale (float scale)
+{
+    const auto contentHeight = juce::roundToInt (OJDEditorConstants::contentMinHeight * scale);
+    const auto contentWidth  = juce::roundToInt (contentHeight * OJDEditorConstants::contentAspectRatio);
+
+    return { juce::jmax (OJDEditorConstants::contentMinWidth, contentWidth),
+             contentHeight + OJDEditorConstants::presetManagerComponentHeight };
+}
+
+static juce::String sizeName (juce::Rectangle<int> bounds)
+{
+    return juce::String (bounds.getWidth()) + "x" + juce::String (bounds.getHeight());
+}
+
+static std::unique_ptr<juce::AudioProcessorEditor> createEditor (OJDAudioProcessor& processor)
+{
+    return std::unique_ptr<juce::AudioProcessorEditor> (processor.createEditor());
+}
+
+static void paintToImage (juce::Component& editor, float displayScale)
+{
+    // A snapshot renders the whole component hierarchy into a software image, just like a repaint would do
+    auto image = editor.createComponentSnapshot (editor.getLocalBounds(), true, displayScale);
+    juce::ignoreUnused (image);
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 20;
+
+    const std::array<float, 3> editorScales  { 1.0f, 1.5f, 2.0f };
+    const std::array<float, 2> displayScales { 1.0f, 2.0f };
+
+    OJDAudioProcessor processor;
+    processor.setPlayConfigDetails (2, 2, 48000.0, 512);
+    processor.prepareToPlay (48000.0, 512);
+
+    BenchmarkReport report ("EditorBenchmark");
+
+    // Construction only, the editor has not been given a size or painted yet
+    report.addResult ("construction", "ms", measureMilliseconds (numIterations, [&] (int)
+    {
+        auto editor = createEditor (processor);
+    }));
+
+    for (auto editorScale : editorScales)
+    {
+        const auto bounds = editorBoundsForScale (editorScale);
+
+        // Laying out a freshly constructed editor for the given size, which ends up in constrainedResized
+        std::vector<std::unique_ptr<juce::AudioProcessorEditor>> editors;
+        for (int i = 0; i < numIterations; ++i)
+            editors.push_back (createEditor (processor));
+
+        report.addResult ("layout/" + sizeName (bounds), "ms", measureMilliseconds (numIterations, [&] (int i)
+        {
+            editors[static_cast<size_t> (i)]->setSize (bounds.getWidth(), bounds.getHeight());
+        }));
+
+        for (auto displayScale : displayScales)
+        {
+            const auto caseName = sizeName (bounds) + "@" + juce::String (displayScale, 1) + "x";
+
+            // The first paint of an editor, which includes rasterising all vector graphics
+            report.addResult ("first-paint/" + caseName, "ms", measureMilliseconds (numIterations, [&] (int)
+            {
+                auto editor = createEditor (processor);
+                editor->setSize (bounds.getWidth(), bounds.getHeight());
+                paintToImage (*editor, displayScale);
+            }));
+
+            // Repainting an editor that has already been painted once
+            auto editor = createEditor (processor);
+            editor->setSize (bounds.getWidth(), bounds.getHeight());
+            paintToImage (*editor, displayScale);
+
+            report.addResult ("repaint/" + caseName, "ms", measureMilliseconds (numIterations, [&] (int)
+            {
+                paintToImage (*editor, displayScale);
+            }));
+
+            // Automating the drive knob, each value change is followed by a repaint like it would happen on screen
+            auto* drive = findParameter (processor, OJDParameters::Sliders::Drive::id);
+            jassert (drive != nullptr);
+
+            report.addResult ("knob-automation/" + caseName, "ms", measureMilliseconds (numIterations, [&] (int i)
+            {
+                drive->setValueNotifyingHost (static_cast<float> (i % 100) / 100.0f);
+                paintToImage (*editor, displayScale);
+            }));
+        }
+    }
+
+    // Dragging the editor from its minimum size to twice the size and back, each step is laid out and painted
+    {
+        constexpr int numDragSteps = 50;
+
+        auto editor = createEditor (processor);
+
+        report.addResult ("resize-drag", "ms", measureMilliseconds (2 * numDragSteps, [&] (int i)
+        {
+            const auto position = i < numDragSteps ? i : 2 * numDragSteps - i - 1;
+            const auto bounds = editorBoundsForScale (1.0f + static_cast<float> (position) / numDragSteps);
+
+            editor->setSize (bounds.getWidth(), bounds.getHeight());
+            paintToImage (*editor, 1.0f);
+        }));
+    }
+
+    return report.finish (args);
+}
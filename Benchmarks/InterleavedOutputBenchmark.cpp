@@ -0,0 +1,205 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDCore.h"
+
+/**
+ * Compares two ways of running the cascade after the waveshaper into an interleaved output buffer, for float32, int16
+ * and packed 24 bit output, with a constant and a ramped volume:
+ * - fused: BiquadCascade::processToInterleaved, which scales, clips and converts inside the scalar filter loop
+ * - separate: The SIMD cascade kernel through processWithGain, followed by a conversion pass that vectorises scaling
+ *   and clipping and only stores scalar. This is how the output stage worked before the cascades were fused.
+ *
+ * Both have to write the same output, the benchmark fails otherwise. The baseline kernels match the generic loop
+ * exactly. Kernels that use FMA instructions round differently, which the recursive sections carry on, so their output
+ * may differ by up to -60 dB. The time is measured per 10 ms of stereo audio at 48 kHz, processed in tiles like the
+ * OJDCore does.
+ *
+ * Usage: OJD-InterleavedOutputBenchmark [--iterations=<n>] [--output=<file>] [--baseline=<file>] [--tolerance=<value>]
+ */
+
+static constexpr size_t numChannels = 2;
+static constexpr size_t numSamplesPerIteration = 480;
+static constexpr size_t tileSize = OJDCore::tileSize;
+
+using PostCascade = BiquadCascade<ChainCoefficients::numPostCascadeSections>;
+
+/** The conversion pass of the separate variant */
+template <typename Samples>
+static void writeNormalisedChannel (const float* samples, size_t numSamples, char* data, size_t firstIndex, size_t stride)
+{
+    size_t i = 0;
+
+#if JUCE_USE_SIMD
+    using Vec = juce::dsp::SIMDRegister<float>;
+
+    if (Vec::isSIMDAligned (samples))
+    {
+        const auto vScale = Vec::expand (Samples::scale);
+        const auto vMin   = Vec::expand (-Samples::scale);
+
+        alignas (Vec::SIMDRegisterSize) float scaled[Vec::SIMDNumElements];
+
+        for (; i + Vec::SIMDNumElements <= numSamples; i += Vec::SIMDNumElements)
+        {
+            auto v = Vec::fromRawArray (samples + i) * vScale;
+
+            if (Samples::needsClipping)
+                v = Vec::max (vMin, Vec::min (vScale, v));
+
+            v.copyToRawArray (scaled);
+
+            for (size_t lane = 0; lane < Vec::SIMDNumElements; ++lane)
+                Samples::write (data, firstIndex + (i + lane) * stride, scaled[lane]);
+        }
+    }
+#endif
+
+    for (; i < numSamples; ++i)
+        writeNormalisedSample<Samples> (data, firstIndex + i * stride, samples[i]);
+}
+
+/** Returns the largest difference between two interleaved buffers in the -1 to 1 range */
+template <typename Samples>
+static float getMaxDifference (const std::vector<char>& a, const std::vector<char>& b)
+{
+    auto difference = 0.0f;
+
+    for (size_t i = 0; i < a.size() / Samples::numBytes; ++i)
+        difference = juce::jmax (difference, std::abs (Samples::read (a.data(), i) - Samples::read (b.data(), i)));
+
+    return difference;
+}
+
+struct Measurement
+{
+    std::vector<double> durations;
+    std::vector<char> lastOutput;
+};
+
+template <typename Samples>
+static Measurement measure (int numIterations, bool ramped, bool fused)
+{
+    ChainCoefficients coefficients;
+    coefficients.prepare (48000.0);
+
+    ChainParameters parameters;
+    coefficients.update (parameters);
+
+    DSPArena arena;
+    PostCascade cascade;
+    const juce::dsp::ProcessSpec spec { 48000.0, static_cast<juce::uint32> (tileSize), static_cast<juce::uint32> (numChannels) };
+
+    arena.beginMeasuring();
+    cascade.prepare (spec, arena);
+    arena.allocateMeasuredSize();
+    cascade.prepare (spec, arena);
+    cascade.setSections (coefficients.post);
+
+    // The planar tile is cache line aligned, like the working buffer the OJDCore borrows from the ScratchPool
+    juce::HeapBlock<float> tileMemory;
+    tileMemory.allocate (numChannels * tileSize + 16, true);
+    auto* tileStart = tileMemory.get() + (16 - (reinterpret_cast<uintptr_t> (tileMemory.get()) / sizeof (float)) % 16) % 16;
+
+    std::array<float*, numChannels> tile;
+    for (size_t ch = 0; ch < numChannels; ++ch)
+        tile[ch] = tileStart + ch * tileSize;
+
+    Measurement measurement;
+    measurement.lastOutput.resize (numChannels * numSamplesPerIteration * Samples::numBytes);
+    auto* out = measurement.lastOutput.data();
+
+    // Generated up front so that only the cascade and the conversion are measured
+    juce::AudioBuffer<float> input (static_cast<int> (numChannels), static_cast<int> (numSamplesPerIteration));
+
+    for (int ch = 0; ch < input.getNumChannels(); ++ch)
+        for (int i = 0; i < input.getNumSamples(); ++i)
+            input.setSample (ch, i, 0.9f * std::sin (0.01f * static_cast<float> ((ch + 1) * i)));
+
+    measurement.durations = measureMilliseconds (numIterations, [&] (int)
+    {
+        for (size_t start = 0; start < numSamplesPerIteration; start += tileSize)
+        {
+            const auto length = juce::jmin (tileSize, numSamplesPerIteration - start);
+            const juce::dsp::AudioBlock<float> block (tile.data(), numChannels, length);
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+                std::copy_n (input.getReadPointer (static_cast<int> (ch), static_cast<int> (start)), length, tile[ch]);
+
+            const auto ramp = ramped ? OutputVolume::Ramp { 0.5f, 0.001f, 0.5f + 0.001f * static_cast<float> (length), length }
+                                     : OutputVolume::Ramp { 1.0f, 0.0f, 1.0f, 0 };
+
+            if (fused)
+            {
+                cascade.processToInterleaved (Samples(), block, out, start, ramp);
+                continue;
+            }
+
+            cascade.processWithGain (block, ramp);
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+                writeNormalisedChannel<Samples> (tile[ch], length, out, start * numChannels + ch, numChannels);
+        }
+    });
+
+    return measurement;
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 5000;
+
+    BenchmarkReport report ("InterleavedOutputBenchmark");
+    int numMismatches = 0;
+
+    for (auto format : { SampleFormat::float32, SampleFormat::int16, SampleFormat::int24 })
+    {
+        withInterleavedSamples (format, [&] (auto samples)
+        {
+            using Samples = decltype (samples);
+
+            for (auto ramped : { false, true })
+            {
+                const auto caseName = juce::String ("/") + (format == SampleFormat::float32 ? "float32" : (format == SampleFormat::int16 ? "int16" : "int24"))
+                                    + (ramped ? "/ramped" : "/constant");
+
+                const auto fused    = measure<Samples> (numIterations, ramped, true);
+                const auto separate = measure<Samples> (numIterations, ramped, false);
+
+                report.addResult ("fused"    + caseName, "ms", fused.durations);
+                report.addResult ("separate" + caseName, "ms", separate.durations);
+
+                if (getMaxDifference<Samples> (fused.lastOutput, separate.lastOutput) > 1.0e-3f)
+                {
+                    std::cerr << "Output mismatch" << caseName << std::endl;
+                    ++numMismatches;
+                }
+            }
+        });
+    }
+
+    const auto result = report.finish (args);
+    return numMismatches > 0 ? 1 : result;
+}
@@ -0,0 +1,98 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "OJDCore.h"
+
+/**
+ * Compares the linear path of the waveshaper, the FIR filter with the impulse response of the oversampling path, with
+ * the oversampled path itself for every oversampling order, for mono and stereo. The input stays in the linear region,
+ * so both paths produce the same output within the truncation threshold. The blocks are as long as the tiles the
+ * OJDCore processes and the time is measured per 10 ms of audio at 48 kHz.
+ *
+ * Also reports for every order and channel count whether the waveshaper picks the linear path on its own, which should
+ * be the case exactly where the linear path is clearly faster.
+ *
+ * Usage: OJD-LinearPathBenchmark [--iterations=<n>] [--output=<file>] [--baseline=<file>] [--tolerance=<value>]
+ */
+
+static constexpr double sampleRate = 48000.0;
+static constexpr size_t numSamplesPerIteration = 480;
+static constexpr size_t blockSize = OJDCore::tileSize;
+
+static std::vector<double> measureWaveshaper (int numIterations, size_t order, size_t numChannels, Waveshaper::LinearPathMode mode)
+{
+    Waveshaper waveshaper;
+    waveshaper.setOversamplingOrder (order);
+    waveshaper.setLinearPathMode (mode);
+
+    DSPArena arena;
+    const juce::dsp::ProcessSpec spec { sampleRate, static_cast<juce::uint32> (blockSize), static_cast<juce::uint32> (numChannels) };
+    arena.beginMeasuring();
+    waveshaper.prepare (spec, arena);
+    arena.allocateMeasuredSize();
+    waveshaper.prepare (spec, arena);
+
+    juce::AudioBuffer<float> buffer (static_cast<int> (numChannels), static_cast<int> (numSamplesPerIteration));
+
+    return measureMilliseconds (numIterations, [&] (int iteration)
+    {
+        // Well below the safe peak of every order
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                buffer.setSample (ch, i, 0.05f * std::sin (0.05f * static_cast<float> (static_cast<size_t> (iteration) * numSamplesPerIteration + static_cast<size_t> (i))));
+
+        juce::dsp::AudioBlock<float> block (buffer);
+
+        for (size_t start = 0; start < numSamplesPerIteration; start += blockSize)
+            waveshaper.process (juce::dsp::ProcessContextReplacing<float> (block.getSubBlock (start, juce::jmin (blockSize, numSamplesPerIteration - start))));
+    });
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 2000;
+
+    BenchmarkReport report ("LinearPathBenchmark");
+
+    for (size_t order = 0; order <= Waveshaper::maxOversamplingOrder; ++order)
+    {
+        for (size_t numChannels : { 1, 2 })
+        {
+            const auto caseName = "/order-" + juce::String (order) + (numChannels == 1 ? "/mono" : "/stereo");
+
+            report.addResult ("linear"      + caseName, "ms", measureWaveshaper (numIterations, order, numChannels, Waveshaper::LinearPathMode::always));
+            report.addResult ("oversampled" + caseName, "ms", measureWaveshaper (numIterations, order, numChannels, Waveshaper::LinearPathMode::never));
+        }
+
+        Waveshaper waveshaper;
+        waveshaper.setOversamplingOrder (order);
+
+        for (size_t numChannels : { 1, 2 })
+            report.addValue ("automatic-uses-linear/order-" + juce::String (order) + (numChannels == 1 ? "/mono" : "/stereo"), "bool",
+                             waveshaper.isLinearPathEnabled (numChannels) ? 1.0 : 0.0);
+    }
+
+    return report.finish (args);
+}
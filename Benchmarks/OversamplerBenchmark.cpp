@@ -0,0 +1,201 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "BenchmarkUtilities.h"
+#include "LaneOversampler.h"
+
+/**
+ * Compares the 16x oversampling path of the waveshaper with juce::dsp::Oversampling, the Oversampler that matches it and
+ * the LaneOversampler with its cheaper later stages and SIMD lanes. Each case runs a stereo block up, shapes it and runs
+ * it back down. The time is measured per block of 10 ms of audio at 48 kHz, so that all block sizes are comparable.
+ *
+ * juce::dsp::Oversampling is measured twice: with its maximum quality design, which the Oversampler reproduces, and
+ * with stages set up through addOversamplingStage to the same transition widths and stopband attenuations as those of
+ * the LaneOversampler. The second one is the fair comparison for the LaneOversampler, as both filter equally well.
+ *
+ * The LaneOversampler is measured with the kernels of every instruction set the CPU supports. Pass
+ * --instruction-set=<name> to only measure one of them, e.g. baseline, avx2 or avx512. It is also measured with 16
+ * channels in groups of 4 and 16 lanes, which shows how much each instruction set gains from wider lanes.
+ *
+ * Usage: OJD-OversamplerBenchmark [--iterations=<n>] [--instruction-set=<name>] [--output=<file>] [--baseline=<file>]
+ *                                 [--tolerance=<value>]
+ */
+
+static constexpr double sampleRate = 48000.0;
+static constexpr size_t numChannels = 2;
+static constexpr size_t numWideChannels = 16;
+static constexpr size_t order = 4;
+static constexpr size_t numSamplesPerIteration = 480;
+
+static void fillWithSine (juce::AudioBuffer<float>& buffer, size_t iteration)
+{
+    for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        for (int i = 0; i < buffer.getNumSamples(); ++i)
+            buffer.setSample (ch, i, 0.8f * std::sin (0.05f * static_cast<float> (iteration * numSamplesPerIteration + static_cast<size_t> (i))));
+}
+
+/** Runs numSamplesPerIteration samples through processBlock (block) in blocks of the given size */
+template <typename ProcessBlockFn>
+static std::vector<double> measure (int numIterations, int blockSize, ProcessBlockFn&& processBlock, size_t numBlockChannels = numChannels)
+{
+    juce::AudioBuffer<float> buffer (static_cast<int> (numBlockChannels), static_cast<int> (numSamplesPerIteration));
+
+    return measureMilliseconds (numIterations, [&] (int iteration)
+    {
+        fillWithSine (buffer, static_cast<size_t> (iteration));
+        juce::dsp::AudioBlock<float> block (buffer);
+
+        for (size_t start = 0; start < numSamplesPerIteration; start += static_cast<size_t> (blockSize))
+            processBlock (block.getSubBlock (start, juce::jmin (static_cast<size_t> (blockSize), numSamplesPerIteration - start)));
+    });
+}
+
+template <typename OversamplerType>
+static std::vector<double> prepareAndMeasure (OversamplerType& oversampler, int numIterations, int blockSize, size_t numBlockChannels, float& latency)
+{
+    DSPArena arena;
+
+    const juce::dsp::ProcessSpec spec { sampleRate, static_cast<juce::uint32> (blockSize), static_cast<juce::uint32> (numBlockChannels) };
+    arena.beginMeasuring();
+    oversampler.prepare (spec, arena);
+    arena.allocateMeasuredSize();
+    oversampler.prepare (spec, arena);
+
+    latency = oversampler.getLatencyInSamples();
+
+    return measure (numIterations, blockSize, [&] (const juce::dsp::AudioBlock<float>& block)
+    {
+        oversampler.process (block, [] (float* samples, size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                samples[i] = juce::jlimit (-1.0f, 1.0f, samples[i]);
+        });
+    }, numBlockChannels);
+}
+
+template <typename OversamplerType>
+static std::vector<double> measureArenaOversampler (int numIterations, int blockSize, float& latency)
+{
+    OversamplerType oversampler (order);
+    return prepareAndMeasure (oversampler, numIterations, blockSize, numChannels, latency);
+}
+
+static std::vector<double> measureJuceOversampling (int numIterations, int blockSize, bool matchLaneOversampler, float& latency)
+{
+    using Oversampling = juce::dsp::Oversampling<float>;
+
+    std::unique_ptr<Oversampling> oversampling;
+
+    if (matchLaneOversampler)
+    {
+        oversampling = std::make_unique<Oversampling> (numChannels);
+
+        for (size_t n = 0; n < order; ++n)
+        {
+            const auto design = LaneOversampler::getStageDesign (n);
+            oversampling->addOversamplingStage (Oversampling::filterHalfBandPolyphaseIIR,
+                                               design.transitionWidthUp,   design.stopbandUp,
+                                               design.transitionWidthDown, design.stopbandDown);
+        }
+    }
+    else
+    {
+        oversampling = std::make_unique<Oversampling> (numChannels, order, Oversampling::filterHalfBandPolyphaseIIR, true);
+    }
+
+    oversampling->initProcessing (static_cast<size_t> (blockSize));
+
+    latency = oversampling->getLatencyInSamples();
+
+    return measure (numIterations, blockSize, [&] (const juce::dsp::AudioBlock<float>& block)
+    {
+        auto oversampled = oversampling->processSamplesUp (block);
+
+        for (size_t ch = 0; ch < oversampled.getNumChannels(); ++ch)
+        {
+            auto* samples = oversampled.getChannelPointer (ch);
+
+            for (size_t i = 0; i < oversampled.getNumSamples(); ++i)
+                samples[i] = juce::jlimit (-1.0f, 1.0f, samples[i]);
+        }
+
+        auto output = block;
+        oversampling->processSamplesDown (output);
+    });
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    const auto numIterations = args.containsOption ("--iterations") ? args.getValueForOption ("--iterations").getIntValue() : 2000;
+
+    BenchmarkReport report ("OversamplerBenchmark");
+
+    float juceLatency = 0.0f, juceMatchedLatency = 0.0f, oversamplerLatency = 0.0f, laneOversamplerLatency = 0.0f;
+
+    std::vector<const DSPKernels*> kernels;
+
+    for (int i = 0; i < DSPKernels::numInstructionSets; ++i)
+        if (auto* k = DSPKernels::get (static_cast<DSPKernels::InstructionSet> (i)))
+            if (! args.containsOption ("--instruction-set") || args.getValueForOption ("--instruction-set") == k->name)
+                kernels.push_back (k);
+
+    for (auto blockSize : { 32, 128, 480 })
+    {
+        const auto caseName = "/block-size-" + juce::String (blockSize);
+
+        report.addResult ("juce-oversampling"         + caseName, "ms", measureJuceOversampling (numIterations, blockSize, false, juceLatency));
+        report.addResult ("juce-oversampling-matched" + caseName, "ms", measureJuceOversampling (numIterations, blockSize, true, juceMatchedLatency));
+        report.addResult ("oversampler"               + caseName, "ms", measureArenaOversampler<Oversampler> (numIterations, blockSize, oversamplerLatency));
+
+        // The kernels are picked when preparing, so forcing them before each case is enough
+        for (auto* k : kernels)
+        {
+            DSPKernels::forceInstructionSet (k->instructionSet);
+            report.addResult ("lane-oversampler-" + juce::String (k->name) + caseName, "ms", measureArenaOversampler<LaneOversampler> (numIterations, blockSize, laneOversamplerLatency));
+        }
+
+        DSPKernels::resetInstructionSet();
+    }
+
+    for (auto* k : kernels)
+    {
+        DSPKernels::forceInstructionSet (k->instructionSet);
+
+        for (size_t numLanes : { 4, 16 })
+        {
+            LaneOversampler oversampler (order, numLanes);
+            report.addResult ("lane-oversampler-" + juce::String (k->name) + "/16-channels/lanes-" + juce::String (numLanes), "ms",
+                              prepareAndMeasure (oversampler, numIterations, 64, numWideChannels, laneOversamplerLatency));
+        }
+    }
+
+    DSPKernels::resetInstructionSet();
+
+    report.addValue ("latency/juce-oversampling",         "samples", juceLatency);
+    report.addValue ("latency/juce-oversampling-matched", "samples", juceMatchedLatency);
+    report.addValue ("latency/oversampler",               "samples", oversamplerLatency);
+    report.addValue ("latency/lane-oversampler",          "samples", laneOversamplerLatency);
+
+    return report.finish (args);
+}
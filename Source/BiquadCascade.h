@@ -0,0 +1,297 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "DSPArena.h"
+#include "SampleFormat.h"
+#include "DSPKernels.h"
+#include "ChannelCount.h"
+
+/** Conversions from the coefficient arrays returned by juce::dsp::IIR::ArrayCoefficients to normalised sections */
+struct BiquadSection
+{
+    /** Normalised coefficients in the b0, b1, b2, a1, a2 order */
+    using Coefficients = std::array<float, 5>;
+
+    /** Takes second order coefficients in the b0, b1, b2, a0, a1, a2 order. The gain is folded into the numerator */
+    static Coefficients normalise (const std::array<float, 6>& c, float gain = 1.0f)
+    {
+        const auto a0Inv = 1.0f / c[3];
+        return { c[0] * a0Inv * gain, c[1] * a0Inv * gain, c[2] * a0Inv * gain, c[4] * a0Inv, c[5] * a0Inv };
+    }
+
+    /** Takes first order coefficients in the b0, b1, a0, a1 order */
+    static Coefficients normalise (const std::array<float, 4>& c, float gain = 1.0f)
+    {
+        return normalise (std::array<float, 6> { c[0], c[1], 0.0f, c[2], c[3], 0.0f }, gain);
+    }
+
+    /** Combines two first order sections in the b0, b1, a0, a1 order into one second order section */
+    static Coefficients combine (const std::array<float, 4>& first, const std::array<float, 4>& second)
+    {
+        // Multiplying the numerator and denominator polynomials of both sections
+        return normalise (std::array<float, 6> { first[0] * second[0],
+                                                 first[0] * second[1] + first[1] * second[0],
+                                                 first[1] * second[1],
+                                                 first[2] * second[2],
+                                                 first[2] * second[3] + first[3] * second[2],
+                                                 first[3] * second[3] });
+    }
+};
+
+/**
+ * A cascade of first and second order sections in transposed direct form II, running all sections in a single pass
+ * over the block. Each input sample goes through all sections while their states stay in registers, so a cascade of
+ * N sections costs one pass instead of N. Coefficients and the states of all channels are stored next to each other
+ * in a DSPArena.
+ *
+ * Constant gains are folded into the numerator of a section and two first order sections can be combined into one
+ * second order section, which keeps the cascade form and with it the numerical behaviour of the single sections.
+ *
+ * Planar blocks are processed by the biquad cascade kernel of the instruction set picked in prepare. The interleaved
+ * variants convert formats inside the filter loop and use the generic loop in processChannel.
+ */
+template <size_t numSections>
+class BiquadCascade
+{
+public:
+    /** Requests memory for the coefficients and the state of the given number of channels */
+    void prepare (const juce::dsp::ProcessSpec& spec, DSPArena& arena)
+    {
+        static_assert (numSections <= DSPKernels::maxSections, "Too many sections for the cascade kernel");
+
+        kernels = &DSPKernels::getActive();
+        numChannels = spec.numChannels;
+
+        // b0, b1, b2, a1, a2 of each section followed by two state variables per section and channel. All sections
+        // pass through until coefficients are set
+        memory = arena.allocate<float> (numCoefficients + numStates * numChannels);
+
+        if (memory != nullptr)
+            for (size_t s = 0; s < numSections; ++s)
+                memory[5 * s] = 1.0f;
+    }
+
+    /** Sets a section from normalised coefficients in the b0, b1, b2, a1, a2 order. Ignored while the arena is measuring */
+    void setSection (size_t section, const BiquadSection::Coefficients& c)
+    {
+        jassert (section < numSections);
+
+        if (memory != nullptr)
+            std::copy (c.begin(), c.end(), memory + 5 * section);
+    }
+
+    /** Takes second order coefficients in the b0, b1, b2, a0, a1, a2 order returned by ArrayCoefficients */
+    void setSection (size_t section, const std::array<float, 6>& c, float gain = 1.0f)
+    {
+        setSection (section, BiquadSection::normalise (c, gain));
+    }
+
+    /** Takes first order coefficients in the b0, b1, a0, a1 order returned by ArrayCoefficients */
+    void setSection (size_t section, const std::array<float, 4>& c, float gain = 1.0f)
+    {
+        setSection (section, BiquadSection::normalise (c, gain));
+    }
+
+    /** Combines two first order sections in the b0, b1, a0, a1 order into one second order section */
+    void setSection (size_t section, const std::array<float, 4>& first, const std::array<float, 4>& second)
+    {
+        setSection (section, BiquadSection::combine (first, second));
+    }
+
+    /** Sets all sections at once */
+    void setSections (const std::array<BiquadSection::Coefficients, numSections>& sections)
+    {
+        for (size_t s = 0; s < numSections; ++s)
+            setSection (s, sections[s]);
+    }
+
+    void reset()
+    {
+        if (memory != nullptr)
+            std::fill (memory + numCoefficients, memory + numCoefficients + numStates * numChannels, 0.0f);
+    }
+
+    /** Copies the filter state of one channel to another one */
+    void copyChannelState (size_t source, size_t destination)
+    {
+        if (memory != nullptr)
+            std::copy (getState (source), getState (source) + numStates, getState (destination));
+    }
+
+    /** Returns the largest absolute difference between the filter states of two channels */
+    float getChannelStateDifference (size_t a, size_t b) const
+    {
+        if (memory == nullptr)
+            return 0.0f;
+
+        float difference = 0.0f;
+
+        for (size_t i = 0; i < numStates; ++i)
+            difference = juce::jmax (difference, std::abs (getState (a)[i] - getState (b)[i]));
+
+        return difference;
+    }
+
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename ProcessContext>
+    void process (const ProcessContext& context)
+    {
+        auto& inputBlock  = context.getInputBlock();
+        auto& outputBlock = context.getOutputBlock();
+
+        const auto numSamples = outputBlock.getNumSamples();
+        const auto nc = ChannelCount::of<numBlockChannels> (outputBlock);
+        jassert (nc <= numChannels);
+
+        if (context.isBypassed)
+        {
+            if (context.usesSeparateInputAndOutputBlocks())
+                outputBlock.copyFrom (inputBlock);
+
+            return;
+        }
+
+        for (size_t ch = 0; ch < nc; ++ch)
+        {
+            auto* in  = inputBlock.getChannelPointer (ch);
+            auto* out = outputBlock.getChannelPointer (ch);
+
+            kernels->biquadCascade (memory, numSections, getState (ch), in, out, numSamples, 1.0f, 0.0f, 0, 1.0f);
+        }
+    }
+
+    /**
+     * Reads interleaved samples of the given type, filters them and writes the result to the planar output block.
+     * The format conversion and de-interleaving happen inside the filter loop, so no extra pass over the data is needed.
+     */
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename Samples>
+    void processFromInterleaved (Samples, const char* interleaved, size_t interleavedOffset, const juce::dsp::AudioBlock<float>& outputBlock)
+    {
+        const auto numSamples  = outputBlock.getNumSamples();
+        const auto nc          = ChannelCount::of<numBlockChannels> (outputBlock);
+
+        for (size_t ch = 0; ch < nc; ++ch)
+        {
+            auto* out = outputBlock.getChannelPointer (ch);
+            const auto first = interleavedOffset * nc + ch;
+
+            processChannel (ch, numSamples,
+                            [=] (size_t i) { return Samples::read (interleaved, first + i * nc); },
+                            [out] (size_t i, float value) { out[i] = value; });
+        }
+    }
+
+    /**
+     * Filters the block in place and multiplies the result with a linear gain ramp. The ramp has to provide start, step,
+     * numRampSamples and target like OutputVolume::Ramp does.
+     */
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename Ramp>
+    void processWithGain (const juce::dsp::AudioBlock<float>& block, const Ramp& ramp)
+    {
+        const auto nc = ChannelCount::of<numBlockChannels> (block);
+
+        for (size_t ch = 0; ch < nc; ++ch)
+        {
+            auto* data = block.getChannelPointer (ch);
+
+            kernels->biquadCascade (memory, numSections, getState (ch), data, data, block.getNumSamples(),
+                                    ramp.start, ramp.step, ramp.numRampSamples, ramp.target);
+        }
+    }
+
+    /**
+     * Filters the planar block, multiplies the result with gain (i) and writes it as interleaved samples of the given
+     * type, starting at the frame interleavedOffset. Scaling, clipping and conversion happen inside the filter loop.
+     *
+     * The recursive sections keep this loop scalar anyway, so folding the output into it beats running the SIMD cascade
+     * kernel followed by a vectorised conversion pass, see InterleavedOutputBenchmark.
+     */
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename Samples, typename Gain>
+    void processToInterleaved (Samples, const juce::dsp::AudioBlock<float>& block, char* interleaved, size_t interleavedOffset, Gain&& gain)
+    {
+        const auto nc = ChannelCount::of<numBlockChannels> (block);
+
+        for (size_t ch = 0; ch < nc; ++ch)
+        {
+            auto* in = block.getChannelPointer (ch);
+            const auto first = interleavedOffset * nc + ch;
+
+            processChannel (ch, block.getNumSamples(),
+                            [in] (size_t i) { return in[i]; },
+                            [=, &gain] (size_t i, float value) { writeNormalisedSample<Samples> (interleaved, first + i * nc, value * gain (i)); });
+        }
+    }
+
+private:
+    static constexpr size_t numCoefficients = 5 * numSections;
+    static constexpr size_t numStates       = 2 * numSections;
+
+    float* memory = nullptr;
+    size_t numChannels = 0;
+    const DSPKernels* kernels = &DSPKernels::getActive();
+
+    float*       getState (size_t ch)       { return memory + numCoefficients + numStates * ch; }
+    const float* getState (size_t ch) const { return memory + numCoefficients + numStates * ch; }
+
+    /**
+     * The filter loop of one channel. Samples are fetched by calling readInput (i) and stored by writeOutput (i, value).
+     * Coefficients and states are copied to local arrays of a size known at compile time, so that the compiler can
+     * unroll the section loop and keep everything in registers.
+     */
+    template <typename ReadInput, typename WriteOutput>
+    void processChannel (size_t ch, size_t numSamples, ReadInput&& readInput, WriteOutput&& writeOutput)
+    {
+        float c[numCoefficients];
+        float s[numStates];
+
+        auto* state = getState (ch);
+
+        std::copy (memory, memory + numCoefficients, c);
+        std::copy (state, state + numStates, s);
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            auto value = readInput (i);
+
+            for (size_t k = 0; k < numSections; ++k)
+            {
+                const auto* ck = c + 5 * k;
+                auto* sk = s + 2 * k;
+
+                const auto output = ck[0] * value + sk[0];
+
+                sk[0] = ck[1] * value - ck[3] * output + sk[1];
+                sk[1] = ck[2] * value - ck[4] * output;
+
+                value = output;
+            }
+
+            writeOutput (i, value);
+        }
+
+        for (auto& v : s)
+            juce::dsp::util::snapToZero (v);
+
+        std::copy (s, s + numStates, state);
+    }
+};
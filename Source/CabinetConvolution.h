@@ -0,0 +1,97 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+
+/**
+ * An optional cabinet impulse response convolution at the end of the chain, so that no separate cabinet plugin with
+ * its own buffering is needed.
+ *
+ * The convolution is non-uniformly partitioned and has no latency: The head of the impulse response is convolved
+ * with partitions of the block size, the tail with larger partitions of headSize samples, which are computed while the
+ * head is played back. Loading, trimming, normalising and resampling the impulse response to the current sample rate
+ * happen on a background thread shared by all instances, the new response replaces the old one without interrupting
+ * the audio thread.
+ */
+class CabinetConvolution
+{
+public:
+    /** The number of impulse response samples convolved with block sized partitions */
+    static constexpr int headSize = 512;
+
+    CabinetConvolution() = default;
+
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        convolution.prepare (spec);
+        wasActive = false;
+    }
+
+    void reset() { convolution.reset(); }
+
+    /**
+     * Starts loading the impulse response from an audio file, e.g. a WAV file, in the background. Mono and stereo
+     * files are supported. Must not be called from the audio thread.
+     */
+    void loadImpulseResponse (const juce::File& file)
+    {
+        convolution.loadImpulseResponse (file,
+                                         juce::dsp::Convolution::Stereo::yes,
+                                         juce::dsp::Convolution::Trim::yes,
+                                         0,
+                                         juce::dsp::Convolution::Normalise::yes);
+        active.store (true);
+    }
+
+    /** Disables the stage, it passes the signal through until the next impulse response is loaded */
+    void clearImpulseResponse() { active.store (false); }
+
+    bool isActive() const { return active.load(); }
+
+    void process (const juce::dsp::AudioBlock<float>& block)
+    {
+        const auto isActiveNow = active.load();
+
+        // The tail of the previous response would ring out when switching the stage on again
+        if (isActiveNow && ! wasActive)
+            convolution.reset();
+
+        wasActive = isActiveNow;
+
+        if (isActiveNow)
+            convolution.process (juce::dsp::ProcessContextReplacing<float> (block));
+    }
+
+    /** The convolution has no latency, this is only here for consistency with the other stages */
+    int getLatencyInSamples() const { return convolution.getLatency(); }
+
+private:
+    // Loads the responses of all instances one after another, declared first so that it outlives the convolution
+    juce::SharedResourcePointer<juce::dsp::ConvolutionMessageQueue> messageQueue;
+    juce::dsp::Convolution convolution { juce::dsp::Convolution::NonUniform { headSize }, *messageQueue };
+
+    std::atomic<bool> active { false };
+    bool wasActive = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CabinetConvolution)
+};
@@ -0,0 +1,175 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "BiquadCascade.h"
+#include "ParameterMorph.h"
+#include "ToneStack.h"
+
+/**
+ * Computes the normalised coefficients of the filter cascades before and after the waveshaper from a set of chain
+ * parameters. Between parameter changes, all stages around the waveshaper are linear and time invariant, so they are
+ * fused into one cascade on each side, with constant gains folded into the coefficients. The output volume is applied
+ * by the cascade after the waveshaper as well.
+ *
+ * Computing the coefficients doesn't allocate, so update can be called on the audio thread. The same instance can be
+ * used for several streams with different parameters.
+ */
+class ChainCoefficients
+{
+public:
+    enum PreCascadeSections
+    {
+        hpf30,                 // includes the constant pre waveshaper gain
+        biquadPreDriveBoost,   // dependent on Drive setting
+        biquadPreDriveNotch,   // dependent on Drive setting
+        numPreCascadeSections
+    };
+
+    enum PostCascadeSections
+    {
+        biquadPostDriveBoost1, // dependent on HP/LP
+        biquadPostDriveBoost2, // dependent on Drive setting
+        biquadPostDriveBoost3, // dependent on HP/LP
+        lpf6_3kAndTone,        // the 6.3 kHz lowpass combined with the first order tone stack
+        numPostCascadeSections
+    };
+
+    static constexpr float preWaveshaperGain = 11.0f;
+
+    std::array<BiquadSection::Coefficients, numPreCascadeSections>  pre {};
+    std::array<BiquadSection::Coefficients, numPostCascadeSections> post {};
+
+    /** The coefficients of the fixed filters, which only depend on the sample rate */
+    struct FixedCoefficients
+    {
+        BiquadSection::Coefficients hpf30;
+        std::array<float, 4> lpf6_3k;
+        ToneStack::ModeCoefficients toneStack;
+
+        static FixedCoefficients compute (double sampleRate)
+        {
+            return { BiquadSection::normalise (BiquadCoeffs::makeFirstOrderHighPass (sampleRate, 30.0f), preWaveshaperGain),
+                     BiquadCoeffs::makeFirstOrderLowPass (sampleRate, 6.3e3f),
+                     ToneStack::ModeCoefficients::compute (sampleRate) };
+        }
+    };
+
+    /**
+     * Returns the fixed coefficients for the sample rate. Those of common sample rates are computed once for all
+     * instances and looked up, so switching between them costs nothing. Other rates are computed on the fly.
+     */
+    static FixedCoefficients getFixedCoefficients (double sampleRate)
+    {
+        static constexpr std::array<double, 10> commonSampleRates { { 22050.0,  32000.0,  44100.0,  48000.0,  88200.0,
+                                                                       96000.0, 176400.0, 192000.0, 352800.0, 384000.0 } };
+
+        static const auto bank = []
+        {
+            std::array<FixedCoefficients, commonSampleRates.size()> coefficients;
+
+            for (size_t i = 0; i < commonSampleRates.size(); ++i)
+                coefficients[i] = FixedCoefficients::compute (commonSampleRates[i]);
+
+            return coefficients;
+        }();
+
+        for (size_t i = 0; i < commonSampleRates.size(); ++i)
+            if (commonSampleRates[i] == sampleRate)
+                return bank[i];
+
+        return FixedCoefficients::compute (sampleRate);
+    }
+
+    /** Sets the coefficients that only depend on the sample rate */
+    void prepare (double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+
+        const auto fixed = getFixedCoefficients (sampleRate);
+
+        toneStack.prepare (sampleRate, fixed.toneStack);
+
+        pre[hpf30] = fixed.hpf30;
+        lpf6_3kCoefficients = fixed.lpf6_3k;
+    }
+
+    /** Computes all coefficients that depend on the chain parameters */
+    void update (const ChainParameters& chainParameters)
+    {
+        const auto sr = sampleRate;
+        jassert (sr > 0.0);
+
+        // Values that depend on the HP/LP mode are interpolated, so that a mode change can be morphed too
+        auto hpLp = [&] (float hpValue, float lpValue) { return lpValue + chainParameters.hpAmount * (hpValue - lpValue); };
+
+        const auto driveNormalised = chainParameters.drive;
+        const auto driveSquared = driveNormalised * driveNormalised;
+
+        const auto biquadPreDriveBoostFreq = -1400.0f * driveSquared + 500.0f * driveNormalised + 1600.0f;
+        const auto biquadPreDriveBoostQ = -0.1f * driveNormalised + 0.15f;
+        const auto biquadPreDriveBoostGain = 32 * driveNormalised + 4;
+
+        const auto biquadPreDriveNotchFreq = 8e3f;
+        const auto biquadPreDriveNotchQ = 0.8f;
+        const auto biquadPreDriveNotchGain = -5.0f * driveSquared;
+
+        const auto biquadPostDriveBoost1Freq = hpLp (2052.0f, 2781.0f);
+        const auto biquadPostDriveBoost1Q = 0.5f;
+        const auto biquadPostDriveBoost1Gain = hpLp (4.6f, 4.38f);
+
+        const auto biquadPostDriveBoost2Freq = 74.0f;
+        const auto biquadPostDriveBoost2Q = 0.2f;
+        const auto biquadPostDriveBoost2Gain = 7.38f * driveNormalised + 8.12f;
+
+        const auto biquadPostDriveBoost3Freq = 2935.0f;
+        const auto biquadPostDriveBoost3Q = 0.1f;
+        const auto biquadPostDriveBoost3Gain = hpLp (10.0f, 16.9f);
+
+        // Array coefficients don't allocate, so they can be computed right here on the audio thread
+#define SET_BIQUAD_COEFFICIENTS(sections, stage) sections[stage] = BiquadSection::normalise (BiquadCoeffs::makePeakFilter (sr, stage##Freq, stage##Q, juce::Decibels::decibelsToGain (stage##Gain)))
+
+        SET_BIQUAD_COEFFICIENTS (pre,  biquadPreDriveBoost);
+        SET_BIQUAD_COEFFICIENTS (pre,  biquadPreDriveNotch);
+        SET_BIQUAD_COEFFICIENTS (post, biquadPostDriveBoost1);
+        SET_BIQUAD_COEFFICIENTS (post, biquadPostDriveBoost2);
+        SET_BIQUAD_COEFFICIENTS (post, biquadPostDriveBoost3);
+
+#undef SET_BIQUAD_COEFFICIENTS
+
+        // Tone
+        toneStack.setHpAmount (chainParameters.hpAmount);
+        toneStack.setTone     (chainParameters.tone);
+
+        post[lpf6_3kAndTone] = BiquadSection::combine (lpf6_3kCoefficients, toneStack.getCoefficients());
+    }
+
+private:
+    // To avoid extremely much typing when assigning filter coefficients
+    using BiquadCoeffs = juce::dsp::IIR::ArrayCoefficients<float>;
+
+    double sampleRate = 0.0;
+
+    ToneStack toneStack;
+    std::array<float, 4> lpf6_3kCoefficients { 1.0f, 0.0f, 1.0f, 0.0f };
+};
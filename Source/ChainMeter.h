@@ -0,0 +1,157 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "Waveshaper.h"
+
+/**
+ * The input and output levels of the chain and how hard it drives the waveshaper. The audio thread measures them and
+ * the editor reads them, using only atomics, so neither side ever blocks the other.
+ *
+ * Peaks and the waveshaper counts are accumulated until the editor reads them, so nothing that happened between two
+ * frames is missed, no matter how slowly the editor reads. The RMS levels are smoothed with a time constant of
+ * rmsTimeConstant.
+ */
+class ChainMeter
+{
+public:
+    struct Levels
+    {
+        float inputPeak  = 0.0f;
+        float inputRms   = 0.0f;
+        float outputPeak = 0.0f;
+        float outputRms  = 0.0f;
+
+        /** The fractions of oversampled samples that hit one of the knees of the waveshaper curve or clipped hard */
+        float kneeFraction    = 0.0f;
+        float clippedFraction = 0.0f;
+
+        /** The quality level of the last processed block, see OJDCore::setQualityLevel */
+        int qualityLevel = 0;
+    };
+
+    static constexpr double rmsTimeConstant = 0.3;
+
+    /** Must not be called while the audio thread measures */
+    void prepare (double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        input .meanSquare = 0.0f;
+        output.meanSquare = 0.0f;
+    }
+
+    /** Called by the audio thread with the block before it is processed */
+    void measureInput (const juce::dsp::AudioBlock<float>& block)  { measure (block, input); }
+
+    /** Called by the audio thread with the processed block */
+    void measureOutput (const juce::dsp::AudioBlock<float>& block) { measure (block, output); }
+
+    /** Called by the audio thread after processing a block */
+    void addWaveshaperActivity (const Waveshaper::Activity& activity)
+    {
+        numOversampledSamples.fetch_add (activity.numSamples, std::memory_order_relaxed);
+        numInKnee            .fetch_add (activity.numInKnee,  std::memory_order_relaxed);
+        numClipped           .fetch_add (activity.numClipped, std::memory_order_relaxed);
+    }
+
+    /** Called by the audio thread after processing a block with the quality level it used */
+    void setQualityLevel (int level) { qualityLevel.store (level, std::memory_order_relaxed); }
+
+    /** Called by the editor, returns the peaks and waveshaper activity since the last call and the current RMS levels */
+    Levels read()
+    {
+        Levels levels;
+
+        levels.inputPeak  = input .peak.exchange (0.0f, std::memory_order_relaxed);
+        levels.inputRms   = input .rms.load (std::memory_order_relaxed);
+        levels.outputPeak = output.peak.exchange (0.0f, std::memory_order_relaxed);
+        levels.outputRms  = output.rms.load (std::memory_order_relaxed);
+
+        levels.qualityLevel = qualityLevel.load (std::memory_order_relaxed);
+
+        const auto total = numOversampledSamples.exchange (0, std::memory_order_relaxed);
+
+        if (total > 0)
+        {
+            // The counters are not read as one snapshot, a block finishing in between may push a fraction above one
+            const auto totalFloat = static_cast<float> (total);
+            levels.kneeFraction    = juce::jmin (1.0f, static_cast<float> (numInKnee .exchange (0, std::memory_order_relaxed)) / totalFloat);
+            levels.clippedFraction = juce::jmin (1.0f, static_cast<float> (numClipped.exchange (0, std::memory_order_relaxed)) / totalFloat);
+        }
+
+        return levels;
+    }
+
+private:
+    struct Level
+    {
+        std::atomic<float> peak { 0.0f };
+        std::atomic<float> rms  { 0.0f };
+
+        // Only accessed by the audio thread
+        float meanSquare = 0.0f;
+    };
+
+    double sampleRate = 44100.0;
+
+    Level input, output;
+
+    std::atomic<size_t> numOversampledSamples { 0 };
+    std::atomic<size_t> numInKnee  { 0 };
+    std::atomic<size_t> numClipped { 0 };
+
+    std::atomic<int> qualityLevel { 0 };
+
+    void measure (const juce::dsp::AudioBlock<float>& block, Level& level)
+    {
+        const auto numSamples  = block.getNumSamples();
+        const auto numChannels = block.getNumChannels();
+
+        if (numSamples == 0 || numChannels == 0)
+            return;
+
+        auto peak = 0.0f;
+        auto sumOfSquares = 0.0f;
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            const auto* samples = block.getChannelPointer (ch);
+            const auto range = juce::FloatVectorOperations::findMinAndMax (samples, static_cast<int> (numSamples));
+            peak = juce::jmax (peak, -range.getStart(), range.getEnd());
+
+            for (size_t i = 0; i < numSamples; ++i)
+                sumOfSquares += samples[i] * samples[i];
+        }
+
+        // One pole smoothing of the mean square, advanced by the block length
+        const auto blockMeanSquare = sumOfSquares / static_cast<float> (numSamples * numChannels);
+        const auto alpha = static_cast<float> (std::exp (-static_cast<double> (numSamples) / (rmsTimeConstant * sampleRate)));
+
+        level.meanSquare = blockMeanSquare + alpha * (level.meanSquare - blockMeanSquare);
+        level.rms.store (std::sqrt (level.meanSquare), std::memory_order_relaxed);
+
+        // The peak is held until the editor reads it
+        auto held = level.peak.load (std::memory_order_relaxed);
+        while (peak > held && ! level.peak.compare_exchange_weak (held, peak, std::memory_order_relaxed)) {}
+    }
+};
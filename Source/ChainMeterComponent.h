@@ -0,0 +1,151 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_gui_basics/juce_gui_basics.h>
+#include "ChainMeter.h"
+#include "OJDCore.h"
+
+/**
+ * Shows the input and output levels of the chain, how much of the signal hits the knees of the waveshaper curve or
+ * clips and how far the quality has been reduced to save CPU time. Each level bar shows the RMS level with a line at
+ * the peak level. The meter is only read and repainted while the component is showing, at refreshRateHz.
+ */
+class ChainMeterComponent : public juce::Component, private juce::Timer
+{
+public:
+    static constexpr int refreshRateHz = 30;
+
+    explicit ChainMeterComponent (ChainMeter& meterToShow) : meter (meterToShow) {}
+
+    void setFontHeight (float newFontHeight)
+    {
+        fontHeight = newFontHeight;
+        repaint();
+    }
+
+    void paint (juce::Graphics& g) override
+    {
+        const auto qualityReduction = static_cast<float> (displayed.qualityLevel) / static_cast<float> (OJDCore::numQualityLevels - 1);
+
+        const std::array<Row, 5> rows
+        { {
+            { "In",    toProportion (displayed.inputRms),  toProportion (displayed.inputPeak),  levelToText (displayed.inputPeak) },
+            { "Out",   toProportion (displayed.outputRms), toProportion (displayed.outputPeak), levelToText (displayed.outputPeak) },
+            { "Knee",  displayed.kneeFraction,    -1.0f, fractionToText (displayed.kneeFraction) },
+            { "Clip",  displayed.clippedFraction, -1.0f, fractionToText (displayed.clippedFraction) },
+            { "Load",  qualityReduction,          -1.0f, qualityLevelToText (displayed.qualityLevel) }
+        } };
+
+        g.setFont (fontHeight);
+
+        auto bounds = getLocalBounds().toFloat();
+        const auto rowHeight = bounds.getHeight() / static_cast<float> (rows.size());
+
+        for (auto& row : rows)
+        {
+            auto rowBounds = bounds.removeFromTop (rowHeight).reduced (0.0f, rowHeight * 0.15f);
+
+            g.setColour (juce::Colours::white);
+            g.drawText (row.name,  rowBounds.removeFromLeft (rowBounds.getWidth() * 0.15f), juce::Justification::centredLeft);
+            g.drawText (row.value, rowBounds.removeFromRight (rowBounds.getWidth() * 0.25f), juce::Justification::centredRight);
+
+            auto bar = rowBounds.reduced (rowBounds.getHeight() * 0.05f, rowBounds.getHeight() * 0.2f);
+
+            g.setColour (juce::Colours::white.withAlpha (0.2f));
+            g.fillRect (bar);
+
+            g.setColour (row.fill >= 1.0f ? juce::Colours::red : juce::Colours::white.withAlpha (0.8f));
+            g.fillRect (bar.withWidth (bar.getWidth() * juce::jlimit (0.0f, 1.0f, row.fill)));
+
+            if (row.peak >= 0.0f)
+            {
+                g.setColour (row.peak >= 1.0f ? juce::Colours::red : juce::Colours::white);
+                g.fillRect (bar.getX() + bar.getWidth() * juce::jlimit (0.0f, 1.0f, row.peak) - 1.0f, bar.getY(), 2.0f, bar.getHeight());
+            }
+        }
+    }
+
+    void visibilityChanged() override
+    {
+        if (isShowing())
+            startTimerHz (refreshRateHz);
+        else
+            stopTimer();
+    }
+
+    void parentHierarchyChanged() override { visibilityChanged(); }
+
+private:
+    struct Row
+    {
+        const char* name;
+        float fill;
+        float peak;
+        juce::String value;
+    };
+
+    static constexpr float minDb = -60.0f;
+    static constexpr float maxDb = 0.0f;
+
+    // The displayed peaks fall by this factor per frame, so that short peaks stay visible for a moment
+    static constexpr float peakDecayPerFrame = 0.9f;
+
+    ChainMeter& meter;
+    ChainMeter::Levels displayed;
+    float fontHeight = 12.0f;
+
+    void timerCallback() override
+    {
+        const auto levels = meter.read();
+
+        displayed.inputPeak       = juce::jmax (levels.inputPeak,  displayed.inputPeak  * peakDecayPerFrame);
+        displayed.outputPeak      = juce::jmax (levels.outputPeak, displayed.outputPeak * peakDecayPerFrame);
+        displayed.inputRms        = levels.inputRms;
+        displayed.outputRms       = levels.outputRms;
+        displayed.kneeFraction    = levels.kneeFraction;
+        displayed.clippedFraction = levels.clippedFraction;
+        displayed.qualityLevel    = levels.qualityLevel;
+
+        repaint();
+    }
+
+    static float toProportion (float gain)
+    {
+        return juce::jmap (juce::Decibels::gainToDecibels (gain, minDb), minDb, maxDb, 0.0f, 1.0f);
+    }
+
+    static juce::String levelToText (float gain)
+    {
+        return gain > juce::Decibels::decibelsToGain (minDb) ? juce::String (juce::Decibels::gainToDecibels (gain), 1) + " dB" : "-inf dB";
+    }
+
+    static juce::String fractionToText (float fraction)
+    {
+        return juce::String (fraction * 100.0f, 1) + " %";
+    }
+
+    static juce::String qualityLevelToText (int level)
+    {
+        return level == 0 ? juce::String ("Full quality") : "Reduced " + juce::String (level);
+    }
+};
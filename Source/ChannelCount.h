@@ -0,0 +1,57 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+
+/**
+ * The stages take the number of channels they process as template argument. Callers that know it at compile time, e.g.
+ * OJDCore for mono and stereo blocks, get channel loops with a constant trip count, which the compiler fully unrolls,
+ * and interleaved accesses with a constant stride. With ChannelCount::dynamic, the count is taken from the block.
+ */
+struct ChannelCount
+{
+    static constexpr size_t dynamic = 0;
+
+    /** Returns the number of channels to process, the block has to have exactly numChannels unless it is dynamic */
+    template <size_t numChannels, typename Block>
+    static size_t of (const Block& block)
+    {
+        jassert (numChannels == dynamic || block.getNumChannels() == numChannels);
+        return numChannels == dynamic ? block.getNumChannels() : numChannels;
+    }
+};
+
+/**
+ * Calls fn with a std::integral_constant holding the channel count if there is a specialisation for it, e.g. for mono
+ * and stereo, or ChannelCount::dynamic otherwise.
+ */
+template <typename Fn>
+void withChannelCount (size_t numChannels, Fn&& fn)
+{
+    switch (numChannels)
+    {
+        case 1:  fn (std::integral_constant<size_t, 1>()); break;
+        case 2:  fn (std::integral_constant<size_t, 2>()); break;
+        default: fn (std::integral_constant<size_t, ChannelCount::dynamic>()); break;
+    }
+}
@@ -0,0 +1,142 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "DSPArena.h"
+#include "ScratchPool.h"
+#include "ChannelCount.h"
+
+/**
+ * Delays all channels by a whole number of samples, which can change between blocks without allocating. It keeps the
+ * latency of the chain constant while a quality level with less oversampling latency is active. The most recent
+ * maxDelay input samples are always kept, so changing the delay continues with the actual past input.
+ */
+class CompensationDelay
+{
+public:
+    void prepare (const juce::dsp::ProcessSpec& spec, DSPArena& arena, size_t newMaxDelay)
+    {
+        numChannels = spec.numChannels;
+        maxDelay = newMaxDelay;
+        history = arena.allocate<float> (numChannels * maxDelay);
+
+        scratchSize = ScratchPool::getAllocationSize<float> (spec.maximumBlockSize);
+        ScratchPool::reserve (scratchSize);
+    }
+
+    void reset()
+    {
+        if (history != nullptr)
+            std::fill (history, history + numChannels * maxDelay, 0.0f);
+    }
+
+    void setDelay (size_t newDelay)
+    {
+        jassert (newDelay <= maxDelay);
+        delay = juce::jmin (newDelay, maxDelay);
+    }
+
+    size_t getDelay() const { return delay; }
+
+    /** The number of bytes borrowed from the ScratchPool during process */
+    size_t getScratchSize() const { return scratchSize; }
+
+    template <size_t numBlockChannels = ChannelCount::dynamic>
+    void process (const juce::dsp::AudioBlock<float>& block)
+    {
+        processChannels<numBlockChannels> (block, delay, true);
+    }
+
+    /** Delays the block by the given delay without adding it to the history, e.g. to fade out a previous delay */
+    template <size_t numBlockChannels = ChannelCount::dynamic>
+    void processWithoutHistory (const juce::dsp::AudioBlock<float>& block, size_t delayToUse)
+    {
+        jassert (delayToUse <= maxDelay);
+        processChannels<numBlockChannels> (block, juce::jmin (delayToUse, maxDelay), false);
+    }
+
+    void copyChannelState (size_t source, size_t destination)
+    {
+        if (history != nullptr)
+            std::copy (history + source * maxDelay, history + (source + 1) * maxDelay, history + destination * maxDelay);
+    }
+
+    float getChannelStateDifference (size_t a, size_t b) const
+    {
+        auto difference = 0.0f;
+
+        if (history != nullptr)
+            for (size_t i = 0; i < maxDelay; ++i)
+                difference = juce::jmax (difference, std::abs (history[a * maxDelay + i] - history[b * maxDelay + i]));
+
+        return difference;
+    }
+
+private:
+    size_t numChannels = 0;
+    size_t maxDelay = 0;
+    size_t delay = 0;
+    size_t scratchSize = 0;
+    float* history = nullptr;
+
+    template <size_t numBlockChannels>
+    void processChannels (const juce::dsp::AudioBlock<float>& block, size_t delayToUse, bool addToHistory)
+    {
+        if (maxDelay == 0)
+            return;
+
+        const auto numSamples = block.getNumSamples();
+
+        ScratchPool::Scope scratch;
+        auto* input = scratch.allocate<float> (numSamples);
+
+        if (input == nullptr)
+            return;
+
+        for (size_t ch = 0; ch < ChannelCount::of<numBlockChannels> (block); ++ch)
+        {
+            auto* samples = block.getChannelPointer (ch);
+            auto* channelHistory = history + ch * maxDelay;
+
+            std::copy (samples, samples + numSamples, input);
+
+            // The first samples of the output come from the history, which holds the oldest sample first
+            const auto numFromHistory = juce::jmin (delayToUse, numSamples);
+            std::copy (channelHistory + maxDelay - delayToUse, channelHistory + maxDelay - delayToUse + numFromHistory, samples);
+            std::copy (input, input + numSamples - numFromHistory, samples + numFromHistory);
+
+            if (! addToHistory)
+                continue;
+
+            if (numSamples >= maxDelay)
+            {
+                std::copy (input + numSamples - maxDelay, input + numSamples, channelHistory);
+            }
+            else
+            {
+                std::copy (channelHistory + numSamples, channelHistory + maxDelay, channelHistory);
+                std::copy (input, input + numSamples, channelHistory + maxDelay - numSamples);
+            }
+        }
+    }
+};
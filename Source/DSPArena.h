@@ -0,0 +1,96 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+/**
+ * One contiguous, cache line aligned memory block holding the state and scratch memory of all DSP stages of an
+ * instance. Memory is handed out sequentially, so the stages end up next to each other in the order they request it.
+ *
+ * The required size is found with a measuring pass: After beginMeasuring, all stages request their memory as usual
+ * but get a nullptr and must not touch it. allocateMeasuredSize then allocates the block and all stages request
+ * their memory a second time in the same order.
+ */
+class DSPArena
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    /** Starts a measuring pass, all following calls to allocate return a nullptr */
+    void beginMeasuring()
+    {
+        isMeasuring = true;
+        offset = 0;
+    }
+
+    /** Allocates the size found in the measuring pass and starts handing out real memory, which is zero initialised */
+    void allocateMeasuredSize()
+    {
+        jassert (isMeasuring);
+
+        if (memory == nullptr || offset > capacity)
+        {
+            memory.allocate (offset + alignment - 1, true);
+            capacity = offset;
+        }
+        else
+        {
+            memory.clear (capacity + alignment - 1);
+        }
+
+        const auto address = reinterpret_cast<uintptr_t> (memory.get());
+        alignedStart = memory.get() + (alignUp (address) - address);
+
+        sizeInBytes = offset;
+        isMeasuring = false;
+        offset = 0;
+    }
+
+    /** Returns memory for the given number of elements, starting at a cache line boundary */
+    template <typename T>
+    T* allocate (size_t numElements)
+    {
+        static_assert (std::is_trivially_destructible<T>::value, "Only trivial types can be stored in the arena");
+
+        offset = alignUp (offset);
+        auto* ptr = isMeasuring ? nullptr : reinterpret_cast<T*> (alignedStart + offset);
+        offset += numElements * sizeof (T);
+
+        jassert (isMeasuring || offset <= sizeInBytes);
+        return ptr;
+    }
+
+    /** The number of bytes used by all stages, which is the DSP memory footprint of one instance */
+    size_t getSizeInBytes() const { return sizeInBytes; }
+
+private:
+    juce::HeapBlock<char> memory;
+    char* alignedStart = nullptr;
+
+    size_t capacity = 0;
+    size_t sizeInBytes = 0;
+    size_t offset = 0;
+    bool isMeasuring = false;
+
+    static size_t alignUp (size_t value) { return (value + alignment - 1) & ~(alignment - 1); }
+};
@@ -0,0 +1,333 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+/**
+ * The implementations of all DSPKernels. This file is included by one translation unit per instruction set, each of
+ * them compiled with the flags for that instruction set, so the compiler vectorises and schedules the same plain loops
+ * for each one. The loops are written so that they vectorise without reassociating floating point operations.
+ *
+ * Everything lives in an anonymous namespace and nothing but DSPKernels.h is included: Inline functions from other
+ * headers would be compiled with the instruction set specific flags too, and the linker might pick such a copy for code
+ * that runs on any CPU.
+ */
+
+#include "DSPKernels.h"
+
+namespace
+{
+    inline float minimum (float a, float b) { return b < a ? b : a; }
+    inline float maximum (float a, float b) { return a < b ? b : a; }
+    inline float clamp   (float x, float low, float high) { return minimum (maximum (x, low), high); }
+
+    /** Same as juce::dsp::util::snapToZero */
+    inline void snapToZero (float& x)
+    {
+        if (! (x < -1.0e-8f || x > 1.0e-8f))
+            x = 0.0f;
+    }
+
+    // This is where the magic happens :D
+    // The curve is the identity between -0.3 and 0.9 with parabolic knees down to -1.7 and up to 1.1, where it
+    // saturates at -1 and 1. Written as the sum of the clamped linear part and both clamped knees, it has no branches
+    inline float shapeSample (float in)
+    {
+        const auto lower = clamp (in, -1.7f, -0.3f) + 0.3f;
+        const auto upper = clamp (in,  0.9f,  1.1f) - 0.9f;
+
+        return clamp (in, -0.3f, 0.9f)
+             + lower + (lower * lower) / (4 * (1 - 0.3f))
+             + upper - (upper * upper) / (4 * (1 - 0.9f));
+    }
+
+    void shape (float* samples, size_t numSamples)
+    {
+        for (size_t i = 0; i < numSamples; ++i)
+            samples[i] = shapeSample (samples[i]);
+    }
+
+    void shapeAndCount (float* samples, size_t numSamples, size_t* numInKnee, size_t* numClipped)
+    {
+        // 32 bit counters of the same width as the samples keep the comparisons in vector registers. Callers pass
+        // oversampled tiles, far below 2^32 samples
+        unsigned int nonLinear = 0;
+        unsigned int clipped   = 0;
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            const auto in = samples[i];
+
+            nonLinear += (in < -0.3f) | (in > 0.9f);
+            clipped   += (in < -1.7f) | (in > 1.1f);
+
+            samples[i] = shapeSample (in);
+        }
+
+        *numInKnee  += nonLinear - clipped;
+        *numClipped += clipped;
+    }
+
+    void convolve (const float* reversedImpulseResponse, size_t length, const float* input, float* output, size_t numSamples)
+    {
+        for (size_t i = 0; i < numSamples; ++i)
+            output[i] = 0.0f;
+
+        // Iterating over the impulse response in the outer loop keeps the inner loop free of a reduction
+        for (size_t k = 0; k < length; ++k)
+        {
+            const auto h = reversedImpulseResponse[k];
+            const auto* x = input + k;
+
+            for (size_t i = 0; i < numSamples; ++i)
+                output[i] += h * x[i];
+        }
+    }
+
+    void biquadCascade (const float* coefficients, size_t numSections, float* state,
+                        const float* input, float* output, size_t numSamples,
+                        float gainStart, float gainStep, size_t numRampSamples, float gainTarget)
+    {
+        float c[5 * DSPKernels::maxSections];
+        float s[2 * DSPKernels::maxSections];
+
+        for (size_t n = 0; n < 5 * numSections; ++n)
+            c[n] = coefficients[n];
+
+        for (size_t n = 0; n < 2 * numSections; ++n)
+            s[n] = state[n];
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            auto value = input[i];
+
+            for (size_t k = 0; k < numSections; ++k)
+            {
+                const auto* ck = c + 5 * k;
+                auto* sk = s + 2 * k;
+
+                const auto y = ck[0] * value + sk[0];
+
+                sk[0] = ck[1] * value - ck[3] * y + sk[1];
+                sk[1] = ck[2] * value - ck[4] * y;
+
+                value = y;
+            }
+
+            output[i] = value * (i < numRampSamples ? gainStart + gainStep * static_cast<float> (i + 1) : gainTarget);
+        }
+
+        for (size_t n = 0; n < 2 * numSections; ++n)
+        {
+            snapToZero (s[n]);
+            state[n] = s[n];
+        }
+    }
+
+    // The lane kernels are templates for each supported number of lanes, so that the lane loops have a length known
+    // at compile time and map to whole vector registers
+    template <size_t numLanes>
+    void biquadCascadeLanes (const float* coefficients, size_t numSections, float* state, float* frames, size_t numFrames,
+                             const float* gainStart, const float* gainStep, const float* numRampSamples, const float* gainTarget)
+    {
+        float s[DSPKernels::maxSections][2][numLanes];
+
+        for (size_t k = 0; k < numSections; ++k)
+            for (size_t l = 0; l < numLanes; ++l)
+                for (size_t n = 0; n < 2; ++n)
+                    s[k][n][l] = state[(2 * k + n) * numLanes + l];
+
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * numLanes;
+
+            float value[numLanes];
+
+            for (size_t l = 0; l < numLanes; ++l)
+                value[l] = frame[l];
+
+            for (size_t k = 0; k < numSections; ++k)
+            {
+                const auto* ck = coefficients + 5 * numLanes * k;
+
+                for (size_t l = 0; l < numLanes; ++l)
+                {
+                    const auto y = ck[l] * value[l] + s[k][0][l];
+
+                    s[k][0][l] = ck[numLanes + l] * value[l] - ck[3 * numLanes + l] * y + s[k][1][l];
+                    s[k][1][l] = ck[2 * numLanes + l] * value[l] - ck[4 * numLanes + l] * y;
+
+                    value[l] = y;
+                }
+            }
+
+            const auto position = static_cast<float> (i);
+
+            for (size_t l = 0; l < numLanes; ++l)
+                frame[l] = value[l] * (position < numRampSamples[l] ? gainStart[l] + gainStep[l] * (position + 1.0f) : gainTarget[l]);
+        }
+
+        for (size_t k = 0; k < numSections; ++k)
+        {
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                for (size_t n = 0; n < 2; ++n)
+                {
+                    snapToZero (s[k][n][l]);
+                    state[(2 * k + n) * numLanes + l] = s[k][n][l];
+                }
+            }
+        }
+    }
+
+    /** Runs one frame of all lanes through the allpass sections first to last */
+    template <size_t numLanes>
+    inline void allpassChain (const float* alpha, size_t first, size_t last, float (&lanes)[numLanes], float (*state)[numLanes])
+    {
+        for (auto n = first; n < last; ++n)
+        {
+            const auto a = alpha[n];
+
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                const auto y = a * lanes[l] + state[n][l];
+                state[n][l] = lanes[l] - a * y;
+                lanes[l] = y;
+            }
+        }
+    }
+
+    template <size_t numLanes>
+    void upsample (const float* alpha, size_t numDirect, size_t numSections, const float* input, float* output, size_t numFrames, float* state)
+    {
+        float s[DSPKernels::maxSections][numLanes];
+
+        for (size_t n = 0; n < numSections; ++n)
+            for (size_t l = 0; l < numLanes; ++l)
+                s[n][l] = state[n * numLanes + l];
+
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            float direct[numLanes], delayed[numLanes];
+
+            for (size_t l = 0; l < numLanes; ++l)
+                direct[l] = delayed[l] = input[i * numLanes + l];
+
+            allpassChain (alpha, 0, numDirect, direct, s);
+            allpassChain (alpha, numDirect, numSections, delayed, s);
+
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                output[(2 * i)     * numLanes + l] = direct[l];
+                output[(2 * i + 1) * numLanes + l] = delayed[l];
+            }
+        }
+
+        for (size_t n = 0; n < numSections; ++n)
+        {
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                snapToZero (s[n][l]);
+                state[n * numLanes + l] = s[n][l];
+            }
+        }
+    }
+
+    template <size_t numLanes>
+    void downsample (const float* alpha, size_t numDirect, size_t numSections, const float* input, float* output, size_t numFrames, float* state)
+    {
+        // The last set of states holds the one sample delay of the delayed path
+        float s[DSPKernels::maxSections + 1][numLanes];
+
+        for (size_t n = 0; n <= numSections; ++n)
+            for (size_t l = 0; l < numLanes; ++l)
+                s[n][l] = state[n * numLanes + l];
+
+        auto& delay = s[numSections];
+
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            float direct[numLanes], delayed[numLanes];
+
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                direct[l]  = input[(2 * i)     * numLanes + l];
+                delayed[l] = input[(2 * i + 1) * numLanes + l];
+            }
+
+            allpassChain (alpha, 0, numDirect, direct, s);
+            allpassChain (alpha, numDirect, numSections, delayed, s);
+
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                output[i * numLanes + l] = (delay[l] + direct[l]) * 0.5f;
+                delay[l] = delayed[l];
+            }
+        }
+
+        for (size_t n = 0; n <= numSections; ++n)
+        {
+            for (size_t l = 0; l < numLanes; ++l)
+            {
+                snapToZero (s[n][l]);
+                state[n * numLanes + l] = s[n][l];
+            }
+        }
+    }
+
+    template <size_t n>
+    struct LaneCount { static constexpr size_t value = n; };
+
+    /** Calls fn with a LaneCount for the number of lanes, only powers of two up to 16 lanes are supported */
+    template <typename Fn>
+    void withNumLanes (size_t numLanes, Fn&& fn)
+    {
+        switch (numLanes)
+        {
+            case 1:  fn (LaneCount<1>());  break;
+            case 2:  fn (LaneCount<2>());  break;
+            case 4:  fn (LaneCount<4>());  break;
+            case 8:  fn (LaneCount<8>());  break;
+            case 16: fn (LaneCount<16>()); break;
+            default: break;
+        }
+    }
+
+    void biquadCascadeLanes (const float* coefficients, size_t numSections, size_t numLanes, float* state,
+                             float* frames, size_t numFrames,
+                             const float* gainStart, const float* gainStep, const float* numRampSamples, const float* gainTarget)
+    {
+        withNumLanes (numLanes, [&] (auto lanes)
+        {
+            biquadCascadeLanes<decltype (lanes)::value> (coefficients, numSections, state, frames, numFrames, gainStart, gainStep, numRampSamples, gainTarget);
+        });
+    }
+
+    void upsample (const float* alpha, size_t numDirect, size_t numSections, size_t numLanes, const float* input, float* output, size_t numFrames, float* state)
+    {
+        withNumLanes (numLanes, [&] (auto lanes) { upsample<decltype (lanes)::value> (alpha, numDirect, numSections, input, output, numFrames, state); });
+    }
+
+    void downsample (const float* alpha, size_t numDirect, size_t numSections, size_t numLanes, const float* input, float* output, size_t numFrames, float* state)
+    {
+        withNumLanes (numLanes, [&] (auto lanes) { downsample<decltype (lanes)::value> (alpha, numDirect, numSections, input, output, numFrames, state); });
+    }
+
+    const DSPKernels kernels { shape, shapeAndCount, convolve, biquadCascade, biquadCascadeLanes, upsample, downsample, OJD_KERNELS_INSTRUCTION_SET, OJD_KERNELS_NAME, OJD_KERNELS_NUM_LANES };
+}
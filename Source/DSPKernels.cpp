@@ -0,0 +1,167 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "DSPKernels.h"
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined (_M_X64) || defined (_M_IX86) || defined (__x86_64__) || defined (__i386__)
+ #define OJD_X86 1
+ #if defined (_MSC_VER)
+  #include <intrin.h>
+ #else
+  #include <cpuid.h>
+ #endif
+#endif
+
+// Defined in the instruction set specific translation units. They must only be called if the CPU supports the
+// instruction set
+const DSPKernels* getBaselineDSPKernels();
+const DSPKernels* getAVX2DSPKernels();
+const DSPKernels* getAVX512DSPKernels();
+
+// The register state that has to be saved by the OS, as bits of the XCR0 register: SSE and AVX for the YMM registers,
+// additionally the opmask and the upper ZMM state for AVX-512
+static constexpr juce::uint64 avxRegisterState    = 0x06;
+static constexpr juce::uint64 avx512RegisterState = 0xe6;
+
+/**
+ * Returns true if the OS saves and restores the given register state on context switches. Otherwise instructions using
+ * these registers fault, even if the CPU supports them.
+ */
+static bool isRegisterStateEnabled (juce::uint64 state)
+{
+   #if OJD_X86
+    // xgetbv itself is only available if the OS has enabled it
+    unsigned int registers[4] {};
+
+   #if defined (_MSC_VER)
+    __cpuid (reinterpret_cast<int*> (registers), 1);
+   #else
+    __get_cpuid (1, &registers[0], &registers[1], &registers[2], &registers[3]);
+   #endif
+
+    if ((registers[2] & (1u << 27)) == 0)
+        return false;
+
+   #if defined (_MSC_VER)
+    const auto enabledState = static_cast<juce::uint64> (_xgetbv (0));
+   #else
+    unsigned int low, high;
+    __asm__ volatile ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+    const auto enabledState = (static_cast<juce::uint64> (high) << 32) | low;
+   #endif
+
+    return (enabledState & state) == state;
+   #else
+    juce::ignoreUnused (state);
+    return false;
+   #endif
+}
+
+/** The AVX2 kernels are compiled with FMA, see CMakeLists.txt */
+static bool supportsAVX2()
+{
+    return juce::SystemStats::hasAVX2() && juce::SystemStats::hasFMA3() && isRegisterStateEnabled (avxRegisterState);
+}
+
+/** The AVX-512 kernels are compiled with FMA, see CMakeLists.txt */
+static bool supportsAVX512()
+{
+    if (! (juce::SystemStats::hasAVX512F() && juce::SystemStats::hasFMA3() && isRegisterStateEnabled (avx512RegisterState)))
+        return false;
+
+   #if defined (_MSC_VER)
+    // MSVC can't limit /arch:AVX512 to AVX-512F, it enables BW, DQ and VL as well
+    return juce::SystemStats::hasAVX512BW() && juce::SystemStats::hasAVX512DQ() && juce::SystemStats::hasAVX512VL();
+   #else
+    return true;
+   #endif
+}
+
+static const DSPKernels* findBestKernels()
+{
+    for (auto i = DSPKernels::numInstructionSets; --i >= 0;)
+        if (auto* kernels = DSPKernels::get (static_cast<DSPKernels::InstructionSet> (i)))
+            return kernels;
+
+    return getBaselineDSPKernels();
+}
+
+static std::atomic<const DSPKernels*>& getActiveKernels()
+{
+    static std::atomic<const DSPKernels*> active { []
+    {
+        // Forcing an instruction set through the environment allows testing the plugin inside a host
+        if (auto* forced = std::getenv ("OJD_INSTRUCTION_SET"))
+            if (auto* kernels = DSPKernels::find (forced))
+                return kernels;
+
+        return findBestKernels();
+    }() };
+
+    return active;
+}
+
+const DSPKernels& DSPKernels::getActive()
+{
+    return *getActiveKernels().load();
+}
+
+const DSPKernels* DSPKernels::get (InstructionSet instructionSet)
+{
+    switch (instructionSet)
+    {
+        case InstructionSet::baseline: return getBaselineDSPKernels();
+        case InstructionSet::avx2:     return supportsAVX2()   ? getAVX2DSPKernels()   : nullptr;
+        case InstructionSet::avx512:   return supportsAVX512() ? getAVX512DSPKernels() : nullptr;
+    }
+
+    return nullptr;
+}
+
+const DSPKernels* DSPKernels::find (const char* name)
+{
+    for (int i = 0; i < numInstructionSets; ++i)
+        if (auto* kernels = get (static_cast<InstructionSet> (i)))
+            if (std::strcmp (kernels->name, name) == 0)
+                return kernels;
+
+    return nullptr;
+}
+
+bool DSPKernels::forceInstructionSet (InstructionSet instructionSet)
+{
+    if (auto* kernels = get (instructionSet))
+    {
+        getActiveKernels().store (kernels);
+        return true;
+    }
+
+    return false;
+}
+
+void DSPKernels::resetInstructionSet()
+{
+    getActiveKernels().store (findBestKernels());
+}
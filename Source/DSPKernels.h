@@ -0,0 +1,123 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * The hot inner loops of the DSP stages, compiled once for each supported instruction set and selected at runtime. The
+ * stages fetch the active kernels in prepare, which are the ones for the best instruction set the CPU supports unless
+ * another one has been forced, either by calling forceInstructionSet or by setting the OJD_INSTRUCTION_SET environment
+ * variable to the name of an instruction set before the first stage is prepared.
+ *
+ * The kernel translation units are compiled with instruction set specific flags and include this header, so it must not
+ * contain or include any inline function definitions, see DSPKernelImplementations.h.
+ */
+struct DSPKernels
+{
+    enum class InstructionSet
+    {
+        baseline, // SSE2 on x86, NEON on ARM
+        avx2,     // AVX2 and FMA
+        avx512    // AVX-512F and FMA
+    };
+
+    static constexpr int numInstructionSets = 3;
+
+    /** The lane kernels take the number of lanes as argument, which can be any power of two up to maxLanes */
+    static constexpr size_t maxLanes = 16;
+
+    /** The highest number of sections the cascade and allpass kernels support */
+    static constexpr size_t maxSections = 16;
+
+    /** Applies the waveshaper curve in place */
+    void (*shape) (float* samples, size_t numSamples);
+
+    /**
+     * Applies the waveshaper curve in place like shape and adds the number of input samples that hit one of the knees
+     * of the curve to numInKnee and the number of those beyond the knees, where the curve clips hard, to numClipped
+     */
+    void (*shapeAndCount) (float* samples, size_t numSamples, size_t* numInKnee, size_t* numClipped);
+
+    /**
+     * Computes output[i] as the sum of reversedImpulseResponse[k] * input[i + k] for all k < length. The input has to
+     * hold numSamples + length - 1 samples.
+     */
+    void (*convolve) (const float* reversedImpulseResponse, size_t length, const float* input, float* output, size_t numSamples);
+
+    /**
+     * Runs a cascade of second order sections in transposed direct form II. Each section takes five coefficients in
+     * the b0, b1, b2, a1, a2 order and two state variables. The output is multiplied with a gain, which ramps linearly
+     * from gainStart in steps of gainStep for numRampSamples samples and stays at gainTarget after that. Input and
+     * output may be the same buffer.
+     */
+    void (*biquadCascade) (const float* coefficients, size_t numSections, float* state,
+                           const float* input, float* output, size_t numSamples,
+                           float gainStart, float gainStep, size_t numRampSamples, float gainTarget);
+
+    /**
+     * Runs numLanes independent cascades like biquadCascade over interleaved frames in place, each lane with its own
+     * coefficients and gain ramp. The coefficients are stored per section, coefficient and lane, e.g. b0 of all lanes
+     * of the first section, then b1 of all lanes and so on. The state holds two values per section and lane in the same
+     * order. The gain ramp arrays hold one value per lane, numRampSamples as float.
+     */
+    void (*biquadCascadeLanes) (const float* coefficients, size_t numSections, size_t numLanes, float* state,
+                                float* frames, size_t numFrames,
+                                const float* gainStart, const float* gainStep, const float* numRampSamples, const float* gainTarget);
+
+    /**
+     * A 2x polyphase half band up- or downsampler for numLanes interleaved channels. The first numDirect allpass
+     * coefficients belong to the direct path, the rest to the delayed path. The state holds numLanes values per
+     * section, the downsampler one more set for the delay of the delayed path. numFrames is the number of frames at the
+     * lower rate.
+     */
+    void (*upsample)   (const float* alpha, size_t numDirect, size_t numSections, size_t numLanes, const float* input, float* output, size_t numFrames, float* state);
+    void (*downsample) (const float* alpha, size_t numDirect, size_t numSections, size_t numLanes, const float* input, float* output, size_t numFrames, float* state);
+
+    InstructionSet instructionSet;
+    const char* name;
+
+    /**
+     * The number of channels the lane kernels of this instruction set process best at once, interleaved frame by frame.
+     * Groups of up to this many channels are processed together by default, see LaneOversampler. It is 16 for AVX-512,
+     * which only pays off with wide groups, and 4 for the others.
+     */
+    size_t numLanes;
+
+    /** Returns the kernels all stages prepared from now on will use */
+    static const DSPKernels& getActive();
+
+    /** Returns the kernels for the instruction set or nullptr if they are not compiled in or the CPU doesn't support them */
+    static const DSPKernels* get (InstructionSet instructionSet);
+
+    /** Returns the kernels with the given name, e.g. "avx2", or nullptr if they are not available */
+    static const DSPKernels* find (const char* name);
+
+    /**
+     * Makes the kernels of the instruction set the active ones, e.g. for testing or benchmarking. Stages that are
+     * already prepared keep their kernels until they are prepared again. Returns false if the kernels are not available.
+     */
+    static bool forceInstructionSet (InstructionSet instructionSet);
+
+    /** Makes the kernels of the best instruction set the CPU supports the active ones again */
+    static void resetInstructionSet();
+};
@@ -0,0 +1,28 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+// Compiled with the default flags of the target, e.g. SSE2 on x86 and NEON on ARM
+#define OJD_KERNELS_INSTRUCTION_SET DSPKernels::InstructionSet::baseline
+#define OJD_KERNELS_NAME "baseline"
+#define OJD_KERNELS_NUM_LANES 4
+#include "DSPKernelImplementations.h"
+
+const DSPKernels* getBaselineDSPKernels() { return &kernels; }
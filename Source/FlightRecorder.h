@@ -0,0 +1,380 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include <thread>
+#include "ParameterMorph.h"
+
+/**
+ * Keeps the input audio and the parameters of the most recent blocks processed by the chain, together with the time
+ * each block took, so that glitches and CPU spikes reported by users can be replayed offline, see
+ * Tools/FlightRecorderReplay.cpp.
+ *
+ * All memory is allocated in prepare, recording a block only copies into ring buffers. A dump is either requested or
+ * triggered by a block that took longer to process than its own duration. In both cases recording stops until
+ * writeDump has written the history from a thread other than the recording one. Automatic dumps are triggered at most
+ * once per history length, so that a run of slow blocks doesn't produce a run of overlapping dumps.
+ *
+ * The history is limited by its length in samples and by the number of blocks, which allows an average block size of
+ * minAverageBlockSize. Hosts using smaller blocks get a shorter history.
+ */
+class FlightRecorder
+{
+public:
+    /** What is recorded for each block besides its input audio */
+    struct Block
+    {
+        int numSamples = 0;
+
+        /** The raw plugin parameter values in the order Drive, Tone, Volume, HP / LP */
+        std::array<float, 4> rawParameterValues {};
+
+        /** The parameters the chain has been set to morph to before processing the block and the morph time used */
+        ChainParameters target;
+        float morphTimeInSeconds = 0.0f;
+
+        int oversamplingOrder = 0;
+
+        /** The quality level the block was processed with, see OJDCore::setQualityLevel */
+        int qualityLevel = 0;
+
+        float processingTimeMs = 0.0f;
+    };
+
+    enum class Trigger
+    {
+        request        = 0,
+        missedDeadline = 1
+    };
+
+    /** A dump read back by readDump */
+    struct Recording
+    {
+        double sampleRate = 0.0;
+        Trigger trigger = Trigger::request;
+        std::vector<Block> blocks;
+
+        /** The input of all blocks, one after the other */
+        juce::AudioBuffer<float> audio;
+    };
+
+    static constexpr int minAverageBlockSize = 32;
+
+    /** Allocates the history. Must not be called while recording */
+    void prepare (double newSampleRate, int newNumChannels, int maximumBlockSize, double historyInSeconds)
+    {
+        const juce::ScopedLock scopedLock (dumpLock);
+
+        sampleRate = newSampleRate;
+        numChannels = newNumChannels;
+        capacity = juce::jmax (maximumBlockSize, static_cast<int> (historyInSeconds * sampleRate));
+
+        audio.setSize (numChannels, capacity);
+        blocks.resize (static_cast<size_t> (capacity / minAverageBlockSize + 1));
+
+        clear();
+    }
+
+    /** Frees the history, so that nothing is recorded. Must not be called while recording */
+    void release()
+    {
+        const juce::ScopedLock scopedLock (dumpLock);
+
+        capacity = 0;
+        audio.setSize (0, 0);
+        blocks.clear();
+        blocks.shrink_to_fit();
+
+        clear();
+    }
+
+    bool isPrepared() const { return capacity > 0; }
+
+    /** Called before processing a block with its input. Real time safe */
+    void record (const juce::dsp::AudioBlock<float>& input, const Block& block)
+    {
+        const ScopedRecording scopedRecording (*this);
+
+        if (! scopedRecording.canRecord())
+            return;
+
+        jassert (static_cast<int> (input.getNumChannels()) <= numChannels && static_cast<int> (input.getNumSamples()) <= capacity);
+
+        const auto numSamples = static_cast<int> (input.getNumSamples());
+        const auto size1 = juce::jmin (numSamples, capacity - audioWritePosition);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            if (ch < static_cast<int> (input.getNumChannels()))
+            {
+                const auto* source = input.getChannelPointer (static_cast<size_t> (ch));
+                audio.copyFrom (ch, audioWritePosition, source, size1);
+                audio.copyFrom (ch, 0, source + size1, numSamples - size1);
+            }
+            else
+            {
+                audio.clear (ch, audioWritePosition, size1);
+                audio.clear (ch, 0, numSamples - size1);
+            }
+        }
+
+        audioWritePosition = (audioWritePosition + numSamples) % capacity;
+
+        auto& recorded = blocks[numBlocksRecorded % blocks.size()];
+        recorded = block;
+        recorded.numSamples = numSamples;
+        recorded.processingTimeMs = 0.0f;
+
+        ++numBlocksRecorded;
+        numSamplesSinceLastDump = juce::jmin (numSamplesSinceLastDump + numSamples, capacity);
+    }
+
+    /** Called after processing the block passed to record with the time it took and its quality level. Real time safe */
+    void finishBlock (double processingTimeMs, int qualityLevel)
+    {
+        const ScopedRecording scopedRecording (*this);
+
+        if (! scopedRecording.canRecord() || numBlocksRecorded == 0)
+            return;
+
+        auto& recorded = blocks[(numBlocksRecorded - 1) % blocks.size()];
+        recorded.processingTimeMs = static_cast<float> (processingTimeMs);
+        recorded.qualityLevel = qualityLevel;
+
+        const auto deadlineMs = 1000.0 * recorded.numSamples / sampleRate;
+
+        if (processingTimeMs > deadlineMs && numSamplesSinceLastDump >= capacity)
+            triggerDump (Trigger::missedDeadline);
+    }
+
+    /** Stops recording until the history has been written by writeDump. Can be called from any thread */
+    void requestDump()
+    {
+        if (isPrepared())
+            triggerDump (Trigger::request);
+    }
+
+    bool isDumpPending() const { return dumpPending.load(); }
+
+    /**
+     * Writes the history to the stream and continues recording afterwards. Must not be called on the recording thread.
+     * Returns false if no dump was pending or the stream failed.
+     */
+    bool writeDump (juce::OutputStream& stream)
+    {
+        const juce::ScopedLock scopedLock (dumpLock);
+
+        if (! dumpPending.load())
+            return false;
+
+        // A block that started before the dump was requested is finished first
+        while (isRecording.load())
+            std::this_thread::yield();
+
+        // Walk back from the most recent block as far as both ring buffers reach
+        const auto numAvailableBlocks = juce::jmin (numBlocksRecorded, blocks.size());
+        size_t numBlocks = 0;
+        int numSamples = 0;
+
+        while (numBlocks < numAvailableBlocks)
+        {
+            const auto& block = blocks[(numBlocksRecorded - numBlocks - 1) % blocks.size()];
+
+            if (numSamples + block.numSamples > capacity)
+                break;
+
+            numSamples += block.numSamples;
+            ++numBlocks;
+        }
+
+        stream.writeInt (magic);
+        stream.writeInt (version);
+        stream.writeDouble (sampleRate);
+        stream.writeInt (numChannels);
+        stream.writeInt (static_cast<int> (trigger.load()));
+        stream.writeInt (static_cast<int> (numBlocks));
+
+        auto readPosition = (audioWritePosition - numSamples + capacity) % capacity;
+
+        for (auto b = numBlocks; b > 0; --b)
+        {
+            const auto& block = blocks[(numBlocksRecorded - b) % blocks.size()];
+
+            stream.writeInt (block.numSamples);
+
+            for (auto value : block.rawParameterValues)
+                stream.writeFloat (value);
+
+            stream.writeFloat (block.target.drive);
+            stream.writeFloat (block.target.tone);
+            stream.writeFloat (block.target.volumeDb);
+            stream.writeFloat (block.target.hpAmount);
+            stream.writeFloat (block.morphTimeInSeconds);
+            stream.writeInt   (block.oversamplingOrder);
+            stream.writeInt   (block.qualityLevel);
+            stream.writeFloat (block.processingTimeMs);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                for (int i = 0; i < block.numSamples; ++i)
+                    stream.writeFloat (audio.getSample (ch, (readPosition + i) % capacity));
+
+            readPosition = (readPosition + block.numSamples) % capacity;
+        }
+
+        stream.flush();
+
+        numSamplesSinceLastDump = 0;
+        dumpPending.store (false);
+
+        return stream.getStatus().wasOk();
+    }
+
+    /** Reads a dump written by writeDump, returns false if the stream doesn't contain a valid dump */
+    static bool readDump (juce::InputStream& stream, Recording& recording)
+    {
+        if (stream.readInt() != magic)
+            return false;
+
+        // Version 1 had no quality levels, all blocks were processed with full quality
+        const auto dumpVersion = stream.readInt();
+
+        if (dumpVersion < 1 || dumpVersion > version)
+            return false;
+
+        recording.sampleRate = stream.readDouble();
+        const auto numDumpChannels = stream.readInt();
+        recording.trigger = static_cast<Trigger> (stream.readInt());
+        const auto numBlocks = stream.readInt();
+
+        if (recording.sampleRate <= 0.0 || numDumpChannels <= 0 || numDumpChannels > maxNumDumpChannels || numBlocks < 0)
+            return false;
+
+        recording.blocks.clear();
+        std::vector<std::vector<float>> channels (static_cast<size_t> (numDumpChannels));
+
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            Block block;
+            block.numSamples = stream.readInt();
+
+            for (auto& value : block.rawParameterValues)
+                value = stream.readFloat();
+
+            block.target.drive       = stream.readFloat();
+            block.target.tone        = stream.readFloat();
+            block.target.volumeDb    = stream.readFloat();
+            block.target.hpAmount    = stream.readFloat();
+            block.morphTimeInSeconds = stream.readFloat();
+            block.oversamplingOrder  = stream.readInt();
+            block.qualityLevel       = dumpVersion >= 2 ? stream.readInt() : 0;
+            block.processingTimeMs   = stream.readFloat();
+
+            if (block.numSamples < 0 || stream.isExhausted())
+                return false;
+
+            // A corrupt sample count is rejected before reading, the length of some streams is unknown though
+            const auto numBlockBytes = static_cast<juce::int64> (block.numSamples) * numDumpChannels
+                                     * static_cast<juce::int64> (sizeof (float));
+            const auto numBytesRemaining = stream.getNumBytesRemaining();
+
+            if (numBytesRemaining >= 0 && numBlockBytes > numBytesRemaining)
+                return false;
+
+            for (auto& channel : channels)
+            {
+                for (int i = 0; i < block.numSamples; ++i)
+                {
+                    if (stream.isExhausted())
+                        return false;
+
+                    channel.push_back (stream.readFloat());
+                }
+            }
+
+            recording.blocks.push_back (block);
+        }
+
+        const auto numSamples = static_cast<int> (channels.front().size());
+        recording.audio.setSize (numDumpChannels, numSamples);
+
+        for (int ch = 0; ch < numDumpChannels; ++ch)
+            recording.audio.copyFrom (ch, 0, channels[static_cast<size_t> (ch)].data(), numSamples);
+
+        return true;
+    }
+
+private:
+    static constexpr int magic   = 0x52444a4f; // "OJDR"
+    static constexpr int version = 2;
+
+    // Instances record at most stereo, anything far above that is a corrupt dump
+    static constexpr int maxNumDumpChannels = 64;
+
+    double sampleRate = 44100.0;
+    int numChannels = 0;
+    int capacity = 0;
+
+    juce::AudioBuffer<float> audio;
+    int audioWritePosition = 0;
+
+    std::vector<Block> blocks;
+    size_t numBlocksRecorded = 0;
+
+    int numSamplesSinceLastDump = 0;
+    std::atomic<Trigger> trigger { Trigger::request };
+
+    // The recording thread marks the time it writes to the history, writeDump waits for that after setting dumpPending.
+    // Both use sequentially consistent order, so either the recording thread sees the pending dump or writeDump sees
+    // it recording
+    std::atomic<bool> dumpPending { false };
+    std::atomic<bool> isRecording { false };
+
+    // Serialises writeDump with prepare and release, the recording thread never takes it
+    juce::CriticalSection dumpLock;
+
+    struct ScopedRecording
+    {
+        explicit ScopedRecording (FlightRecorder& r) : recorder (r) { recorder.isRecording.store (true); }
+        ~ScopedRecording() { recorder.isRecording.store (false); }
+
+        bool canRecord() const { return recorder.isPrepared() && ! recorder.dumpPending.load(); }
+
+        FlightRecorder& recorder;
+    };
+
+    void triggerDump (Trigger reason)
+    {
+        auto expected = false;
+
+        if (dumpPending.compare_exchange_strong (expected, true))
+            trigger.store (reason);
+    }
+
+    void clear()
+    {
+        audioWritePosition = 0;
+        numBlocksRecorded = 0;
+        numSamplesSinceLastDump = capacity;
+        dumpPending.store (false);
+    }
+};
@@ -0,0 +1,409 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include "Oversampler.h"
+#include "DSPKernels.h"
+
+/**
+ * A cascade of 2x polyphase IIR half band stages specialised for the waveshaper. Compared to the Oversampler, which
+ * matches juce::dsp::Oversampling, it differs in two ways:
+ *
+ * - Only the first stage needs a steep transition band, it separates the audio band from its first image. Every later
+ *   stage only has to keep the images of the audio band from folding back into it, so its transition band gets wider
+ *   with each stage and the filters need far fewer allpass sections. The stopband attenuation targets stay the same.
+ * - Channels are interleaved into lanes and processed together by the up- and downsampling kernels, e.g. both
+ *   channels of a stereo block run through the allpass cascades in a single pass. Blocks with fewer channels than
+ *   lanes only process as many lanes as they need, so a mono block costs a single lane. The kernels are compiled for
+ *   several instruction sets and the best one is picked in prepare.
+ *
+ * The interface matches the Oversampler, so both can be used interchangeably. The only difference is the layout of the
+ * buffers passed to the process callback, see getNumInterleavedChannels.
+ */
+class LaneOversampler
+{
+public:
+    using Path = Oversampler::Path;
+
+    /**
+     * Designs the filters for the given number of 2x stages, e.g. 4 for 16x oversampling. Channels are processed in
+     * groups of numLanes channels, which has to be 4, 8 or 16. By default, the groups are as wide as the kernels picked
+     * in prepare process best, see DSPKernels::numLanes.
+     */
+    explicit LaneOversampler (size_t order, size_t numLanesToUse = 0)
+        : numLanes (numLanesToUse > 0 ? numLanesToUse : DSPKernels::getActive().numLanes),
+          usesKernelLanes (numLanesToUse == 0)
+    {
+        jassert (order <= maxOrder);
+        jassert (numLanes == 4 || numLanes == 8 || numLanes == 16);
+
+        for (size_t n = 0; n < order; ++n)
+        {
+            const auto design = getStageDesign (n);
+
+            stages.push_back ({ Path::design (design.transitionWidthUp,   design.stopbandUp),
+                                Path::design (design.transitionWidthDown, design.stopbandDown) });
+
+            jassert (stages.back().up.alpha.size() <= DSPKernels::maxSections && stages.back().down.alpha.size() <= DSPKernels::maxSections);
+        }
+    }
+
+    /** The normalised transition widths and the stopband attenuations in dB of the up and down filters of a stage */
+    struct StageDesign
+    {
+        float transitionWidthUp, stopbandUp;
+        float transitionWidthDown, stopbandDown;
+    };
+
+    /**
+     * Returns the filter design of stage n, e.g. to set up a juce::dsp::Oversampling of the same quality through
+     * addOversamplingStage
+     */
+    static StageDesign getStageDesign (size_t n)
+    {
+        const auto nf = static_cast<float> (n);
+
+        // At stage n, the audio band takes up 1 / 2^(n + 2) of the stage's output rate and its images must not reach
+        // it, which allows a transition band of up to 0.5 - 1 / 2^(n + 1). A margin of 20 % is kept
+        const auto maxTransitionWidth = 0.5f - 1.0f / static_cast<float> (size_t (2) << n);
+
+        // Same stopband attenuation as used by juce::dsp::Oversampling for maximum quality
+        return { n == 0 ? 0.05f : 0.8f * maxTransitionWidth, -75.0f + 10.0f * nf,
+                 n == 0 ? 0.06f : 0.8f * maxTransitionWidth, -70.0f + 10.0f * nf };
+    }
+
+    /** Requests the filter state memory for all stages from the arena and the scratch memory from the ScratchPool */
+    void prepare (const juce::dsp::ProcessSpec& spec, DSPArena& arena)
+    {
+        prepareWithoutScratch (spec, arena);
+        ScratchPool::reserve (scratchSize);
+    }
+
+    /**
+     * Like prepare, but leaves the ScratchPool alone. Such an instance may only be processed by processWithBuffers, e.g.
+     * to measure the filters without raising the scratch memory reserved for all instances.
+     */
+    void prepareWithoutScratch (const juce::dsp::ProcessSpec& spec, DSPArena& arena)
+    {
+        kernels = &DSPKernels::getActive();
+
+        if (usesKernelLanes)
+            numLanes = kernels->numLanes;
+
+        numChannels = spec.numChannels;
+        numGroups = (numChannels + numLanes - 1) / numLanes;
+
+        auto numSamples = static_cast<size_t> (spec.maximumBlockSize);
+
+        // The interleaved input of one group of channels, followed by the buffers of all stages
+        scratchSize = ScratchPool::getAllocationSize<float> (numSamples * numLanes);
+
+        for (auto& stage : stages)
+        {
+            stage.stateUp   = arena.allocate<float> (numGroups * getStateSizeUp (stage));
+            stage.stateDown = arena.allocate<float> (numGroups * getStateSizeDown (stage));
+
+            numSamples *= 2;
+            scratchSize += ScratchPool::getAllocationSize<float> (numSamples * numLanes);
+        }
+    }
+
+    /** The number of bytes borrowed from the ScratchPool during process */
+    size_t getScratchSize() const { return scratchSize; }
+
+    void reset()
+    {
+        for (auto& stage : stages)
+        {
+            if (stage.stateUp != nullptr)
+                std::fill (stage.stateUp, stage.stateUp + numGroups * getStateSizeUp (stage), 0.0f);
+
+            if (stage.stateDown != nullptr)
+                std::fill (stage.stateDown, stage.stateDown + numGroups * getStateSizeDown (stage), 0.0f);
+        }
+    }
+
+    /** Copies the filter states of one channel to another one */
+    void copyChannelState (size_t source, size_t destination)
+    {
+        for (auto& stage : stages)
+        {
+            forEachStateElement (stage.stateUp,   stage.up.alpha.size(),       source, destination, [] (float& s, float& d) { d = s; });
+            forEachStateElement (stage.stateDown, stage.down.alpha.size() + 1, source, destination, [] (float& s, float& d) { d = s; });
+        }
+    }
+
+    /** Returns the largest absolute difference between the filter states of two channels */
+    float getChannelStateDifference (size_t a, size_t b) const
+    {
+        auto difference = 0.0f;
+        auto compare = [&difference] (float& x, float& y) { difference = juce::jmax (difference, std::abs (x - y)); };
+
+        for (auto& stage : stages)
+        {
+            forEachStateElement (stage.stateUp,   stage.up.alpha.size(),       a, b, compare);
+            forEachStateElement (stage.stateDown, stage.down.alpha.size() + 1, a, b, compare);
+        }
+
+        return difference;
+    }
+
+    size_t getOversamplingFactor() const { return size_t (1) << stages.size(); }
+
+    /**
+     * The oversampled buffers passed to the process callback hold the frames of up to this number of channels, e.g.
+     * the first sample of each lane, then the second one and so on. Unused lanes contain silence.
+     */
+    size_t getNumInterleavedChannels() const { return numLanes; }
+
+    /**
+     * Returns the number of lanes process runs for a group with the given number of channels, which is the smallest
+     * power of two that holds them
+     */
+    size_t getNumActiveLanes (size_t numGroupChannels) const
+    {
+        jassert (numGroupChannels > 0 && numGroupChannels <= numLanes);
+
+        size_t numActiveLanes = 1;
+        while (numActiveLanes < numGroupChannels)
+            numActiveLanes *= 2;
+
+        return numActiveLanes;
+    }
+
+    /** Returns the latency of up and downsampling in samples at the original rate */
+    float getLatencyInSamples() const
+    {
+        auto latency = 0.0f;
+        auto factor  = 1.0f;
+
+        for (auto& stage : stages)
+        {
+            factor *= 2.0f;
+            latency += (stage.up.latency + stage.down.latency) / factor;
+        }
+
+        return latency;
+    }
+
+    /**
+     * Upsamples the channels of the block in groups of numLanes channels, calls processOversampled with a pointer to
+     * the interleaved oversampled samples of a group and their number and finally samples the result back down into
+     * the block. Each group only runs the lanes it needs, see getNumActiveLanes. If that leaves a lane without a channel
+     * in the block, the lane processes silence, so unlike with the Oversampler, the state of a prepared channel missing
+     * from the block may change too.
+     */
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename ProcessOversampledFn>
+    void process (const juce::dsp::AudioBlock<float>& block, ProcessOversampledFn&& processOversampled)
+    {
+        ScratchPool::Scope scratch;
+
+        const auto numSamples = block.getNumSamples();
+        const auto nc = ChannelCount::of<numBlockChannels> (block);
+
+        auto* interleaved = scratch.allocate<float> (numSamples * numLanes);
+
+        if (scratch.hasFailed())
+            return;
+
+        for (size_t group = 0; group * numLanes < nc; ++group)
+        {
+            const auto firstChannel = group * numLanes;
+            const auto numGroupChannels = juce::jmin (numLanes, nc - firstChannel);
+            const auto numActiveLanes = getNumActiveLanes (numGroupChannels);
+
+            if (numGroupChannels < numActiveLanes)
+                std::fill (interleaved, interleaved + numSamples * numActiveLanes, 0.0f);
+
+            for (size_t lane = 0; lane < numGroupChannels; ++lane)
+            {
+                const auto* channel = block.getChannelPointer (firstChannel + lane);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                    interleaved[i * numActiveLanes + lane] = channel[i];
+            }
+
+            ScratchPool::Scope stageScratch;
+            const auto buffers = allocateStageBuffers (stageScratch, numSamples, numActiveLanes);
+
+            if (stageScratch.hasFailed())
+                return;
+
+            processGroup (interleaved, numSamples, group, numActiveLanes, buffers.data(), processOversampled);
+
+            for (size_t lane = 0; lane < numGroupChannels; ++lane)
+            {
+                auto* channel = block.getChannelPointer (firstChannel + lane);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                    channel[i] = interleaved[i * numActiveLanes + lane];
+            }
+        }
+    }
+
+    /**
+     * Processes the frames of one group of channels in place, which are already interleaved into numLanes lanes. This
+     * is what process does for each group, without the (de)interleaving around it.
+     */
+    template <typename ProcessOversampledFn>
+    void processInterleaved (float* interleaved, size_t numFrames, size_t group, ProcessOversampledFn&& processOversampled)
+    {
+        ScratchPool::Scope scratch;
+        const auto buffers = allocateStageBuffers (scratch, numFrames, numLanes);
+
+        if (! scratch.hasFailed())
+            processGroup (interleaved, numFrames, group, numLanes, buffers.data(), processOversampled);
+    }
+
+    /**
+     * Processes the frames of the first numActiveLanes channels of a group in place like processInterleaved, but with
+     * buffers owned by the caller instead of ScratchPool memory. The frames hold numActiveLanes interleaved channels,
+     * which has to be a power of two up to numLanes. buffers[s] has to hold the numActiveLanes * numFrames * 2^(s + 1)
+     * samples of stage s.
+     */
+    template <typename ProcessOversampledFn>
+    void processWithBuffers (float* interleaved, size_t numFrames, size_t group, size_t numActiveLanes,
+                             float* const* buffers, ProcessOversampledFn&& processOversampled)
+    {
+        processGroup (interleaved, numFrames, group, numActiveLanes, buffers, processOversampled);
+    }
+
+private:
+    static constexpr size_t maxOrder = Oversampler::maxOrder;
+
+    struct Stage
+    {
+        Path up, down;
+
+        float* stateUp   = nullptr;
+        float* stateDown = nullptr;
+    };
+
+    size_t getStateSizeUp   (const Stage& stage) const { return stage.up.alpha.size() * numLanes; }
+    size_t getStateSizeDown (const Stage& stage) const { return (stage.down.alpha.size() + 1) * numLanes; }
+
+    std::array<float*, maxOrder> allocateStageBuffers (ScratchPool::Scope& scratch, size_t numFrames, size_t numActiveLanes) const
+    {
+        std::array<float*, maxOrder> buffers {};
+
+        for (size_t s = 0; s < stages.size(); ++s)
+        {
+            numFrames *= 2;
+            buffers[s] = scratch.allocate<float> (numFrames * numActiveLanes);
+        }
+
+        return buffers;
+    }
+
+    template <typename ProcessOversampledFn>
+    void processGroup (float* interleaved, size_t numFrames, size_t group, size_t numActiveLanes,
+                       float* const* buffers, ProcessOversampledFn&& processOversampled)
+    {
+        jassert (group < numGroups);
+        jassert (numActiveLanes <= numLanes && (numActiveLanes & (numActiveLanes - 1)) == 0);
+
+        const float* input = interleaved;
+        auto stageNumFrames = numFrames;
+
+        for (size_t s = 0; s < stages.size(); ++s)
+        {
+            auto& stage = stages[s];
+
+            withActiveLaneState (stage.stateUp + group * getStateSizeUp (stage), stage.up.alpha.size(), numActiveLanes, [&] (float* state)
+            {
+                kernels->upsample (stage.up.alpha.data(), stage.up.numDirect, stage.up.alpha.size(), numActiveLanes,
+                                   input, buffers[s], stageNumFrames, state);
+            });
+
+            input = buffers[s];
+            stageNumFrames *= 2;
+        }
+
+        // Without any stages, the interleaved input itself is processed
+        processOversampled (stages.empty() ? interleaved : buffers[stages.size() - 1], stageNumFrames * numActiveLanes);
+
+        for (auto s = stages.size(); s-- > 0;)
+        {
+            auto& stage = stages[s];
+            stageNumFrames /= 2;
+
+            auto* output = s > 0 ? buffers[s - 1] : interleaved;
+
+            withActiveLaneState (stage.stateDown + group * getStateSizeDown (stage), stage.down.alpha.size() + 1, numActiveLanes, [&] (float* state)
+            {
+                kernels->downsample (stage.down.alpha.data(), stage.down.numDirect, stage.down.alpha.size(), numActiveLanes,
+                                     buffers[s], output, stageNumFrames, state);
+            });
+        }
+    }
+
+    /**
+     * Calls fn with the state of the first numActiveLanes lanes of a group, which holds numPerLane interleaved elements
+     * per lane. If not all lanes are active, the state is packed into a local copy with numActiveLanes elements per
+     * row first and written back afterwards, so the states of the inactive lanes stay untouched.
+     */
+    template <typename Fn>
+    void withActiveLaneState (float* groupState, size_t numPerLane, size_t numActiveLanes, Fn&& fn) const
+    {
+        if (numActiveLanes == numLanes)
+        {
+            fn (groupState);
+            return;
+        }
+
+        float packed[(DSPKernels::maxSections + 1) * DSPKernels::maxLanes];
+
+        for (size_t n = 0; n < numPerLane; ++n)
+            std::copy_n (groupState + n * numLanes, numActiveLanes, packed + n * numActiveLanes);
+
+        fn (packed);
+
+        for (size_t n = 0; n < numPerLane; ++n)
+            std::copy_n (packed + n * numActiveLanes, numActiveLanes, groupState + n * numLanes);
+    }
+
+    /**
+     * Calls fn with the matching state elements of two channels. Each group of channels holds numPerLane interleaved
+     * elements per lane.
+     */
+    template <typename Fn>
+    void forEachStateElement (float* state, size_t numPerLane, size_t a, size_t b, Fn&& fn) const
+    {
+        if (state == nullptr)
+            return;
+
+        auto* stateA = state + (a / numLanes) * numPerLane * numLanes + a % numLanes;
+        auto* stateB = state + (b / numLanes) * numPerLane * numLanes + b % numLanes;
+
+        for (size_t n = 0; n < numPerLane; ++n)
+            fn (stateA[n * numLanes], stateB[n * numLanes]);
+    }
+
+    size_t numLanes;
+    bool usesKernelLanes;
+    std::vector<Stage> stages;
+    const DSPKernels* kernels = &DSPKernels::getActive();
+    size_t numChannels = 0;
+    size_t numGroups = 0;
+    size_t scratchSize = 0;
+};
+
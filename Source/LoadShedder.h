@@ -0,0 +1,174 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <cmath>
+
+/**
+ * Picks the quality level of the chain from the time it takes to process each block, see OJDCore::setQualityLevel.
+ * The budget of a block is budgetShare of its duration, the rest of it belongs to the host and the other plugins.
+ *
+ * The load relative to the budget is smoothed over smoothingTime. The quality steps down as soon as the smoothed load
+ * exceeds the budget or numSpikesToStepDown blocks in a row take more than twice the budget, so a single outlier e.g.
+ * caused by a page fault doesn't count. The blocks within settleTime after prepare or reset are not measured at all,
+ * they are slowed down by cold caches and the first use of the memory. It steps up again once the load expected at
+ * the higher level has stayed below stepUpLoad for the hold time. The expected load is the current one scaled by the
+ * ratio measured when stepping down to the current level. Each step up that has to be taken back within twice the hold
+ * time doubles the hold time up to maxHoldTime, so an instance close to its limit doesn't keep switching. The hold time
+ * is reset after maxHoldTime without any switch.
+ */
+class LoadShedder
+{
+public:
+    static constexpr double budgetShare   = 0.3;
+    static constexpr double stepUpLoad    = 0.6;
+    static constexpr double smoothingTime = 0.1;
+    static constexpr double minHoldTime   = 1.0;
+    static constexpr double maxHoldTime   = 16.0;
+    static constexpr double settleTime    = 0.05;
+
+    static constexpr int numSpikesToStepDown = 2;
+
+    static constexpr int maxNumLevels = 8;
+
+    /** Assumed cost ratio between two adjacent levels until it has been measured */
+    static constexpr double defaultCostRatio = 4.0;
+
+    void prepare (double newSampleRate, int newNumLevels)
+    {
+        jassert (newNumLevels > 0 && newNumLevels <= maxNumLevels);
+
+        sampleRate = newSampleRate;
+        numLevels = juce::jlimit (1, maxNumLevels, newNumLevels);
+
+        reset();
+    }
+
+    /** Returns to full quality and forgets all measurements */
+    void reset()
+    {
+        level = 0;
+        smoothedLoad = 0.0;
+        // fill takes a reference, which would need a definition of the constant in C++14
+        costRatios.fill (static_cast<double> (defaultCostRatio));
+        loadBeforeStepDown = 0.0;
+        secondsAtLevel = 0.0;
+        secondsBelowStepUpLoad = 0.0;
+        secondsSinceStepUp = maxHoldTime;
+        holdTime = minHoldTime;
+        secondsSinceReset = 0.0;
+        numConsecutiveSpikes = 0;
+    }
+
+    /** Called after each block with the time processing it took, returns the level to use for the next block */
+    int update (double processingSeconds, int numSamples)
+    {
+        const auto duration = static_cast<double> (numSamples) / sampleRate;
+
+        if (duration <= 0.0)
+            return level;
+
+        if (secondsSinceReset < settleTime)
+        {
+            secondsSinceReset += duration;
+            return level;
+        }
+
+        const auto load = processingSeconds / (budgetShare * duration);
+        numConsecutiveSpikes = load > 2.0 ? numConsecutiveSpikes + 1 : 0;
+
+        smoothedLoad += (1.0 - std::exp (-duration / smoothingTime)) * (load - smoothedLoad);
+
+        secondsAtLevel     += duration;
+        secondsSinceStepUp += duration;
+
+        // The ratio to the previous level is measured once the smoothed load has settled at the new level
+        if (level > 0 && loadBeforeStepDown > 0.0 && secondsAtLevel >= 3.0 * smoothingTime)
+        {
+            costRatios[static_cast<size_t> (level)] = juce::jlimit (1.0, 16.0, loadBeforeStepDown / juce::jmax (smoothedLoad, 1e-6));
+            loadBeforeStepDown = 0.0;
+        }
+
+        if (level < numLevels - 1 && (smoothedLoad > 1.0 || numConsecutiveSpikes >= numSpikesToStepDown))
+        {
+            if (secondsSinceStepUp < 2.0 * holdTime)
+                holdTime = juce::jmin (2.0 * holdTime, maxHoldTime);
+
+            loadBeforeStepDown = smoothedLoad;
+            ++level;
+
+            // Until the next blocks tell, the load is expected to fall by the last measured ratio
+            smoothedLoad /= costRatios[static_cast<size_t> (level)];
+            startLevel();
+
+            return level;
+        }
+
+        const auto expectedLoad = level > 0 ? smoothedLoad * costRatios[static_cast<size_t> (level)] : 0.0;
+        secondsBelowStepUpLoad = level > 0 && expectedLoad < stepUpLoad ? secondsBelowStepUpLoad + duration : 0.0;
+
+        if (level > 0 && secondsBelowStepUpLoad >= holdTime)
+        {
+            smoothedLoad = expectedLoad;
+            --level;
+            secondsSinceStepUp = 0.0;
+            startLevel();
+
+            return level;
+        }
+
+        if (secondsAtLevel >= maxHoldTime)
+            holdTime = minHoldTime;
+
+        return level;
+    }
+
+    int getLevel() const { return level; }
+
+private:
+    double sampleRate = 44100.0;
+    int numLevels = 1;
+    int level = 0;
+
+    double smoothedLoad = 0.0;
+
+    // The load of the level above divided by the load of this level, index 0 is unused
+    std::array<double, maxNumLevels> costRatios;
+    double loadBeforeStepDown = 0.0;
+
+    double secondsAtLevel = 0.0;
+    double secondsBelowStepUpLoad = 0.0;
+    double secondsSinceStepUp = 0.0;
+    double holdTime = minHoldTime;
+
+    double secondsSinceReset = 0.0;
+    int numConsecutiveSpikes = 0;
+
+    void startLevel()
+    {
+        secondsAtLevel = 0.0;
+        secondsBelowStepUpLoad = 0.0;
+        numConsecutiveSpikes = 0;
+    }
+};
@@ -26,6 +26,7 @@ OJDAudioProcessorEditor::OJDAudioProcessorEditor (OJDAudioProcessor& proc)
  :  jb::PluginEditorBase<contentMinWidth, overallMinHeight> (proc, IsResizable::Yes, UseConstrainer::Yes),
     background       (BinaryData::background_svg, BinaryData::background_svgSize),
     pedal            (proc, *this),
+    settingsPage     (proc),
     activeView       (ActiveView::pedal),
     messageOkButton  ("OK"),
     messageLearnMoreButton ("Learn more"),
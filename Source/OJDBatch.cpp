@@ -0,0 +1,249 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDBatch.h"
+
+OJDBatch::OJDBatch (int numStreams)
+    : numLanes (static_cast<size_t> (numStreams)),
+      oversampler (Waveshaper::defaultOversamplingOrder, numLanes),
+      parameterMorphs (numLanes),
+      appliedParameters (numLanes),
+      numSamplesLeftInMorphStep (numLanes, 0),
+      volumes (numLanes),
+      gainStart (numLanes, 1.0f),
+      gainStep (numLanes, 0.0f),
+      numRampSamples (numLanes, 0.0f),
+      gainTarget (numLanes, 1.0f),
+      unityGains (numLanes, 1.0f),
+      noRampSamples (numLanes, 0.0f)
+{
+    jassert (numStreams == 4 || numStreams == 8 || numStreams == 16);
+
+    for (auto& morph : parameterMorphs)
+        morph.jumpTo (OJDCore::toChainParameters (OJDCore::Parameters()));
+}
+
+void OJDBatch::prepare (double newSampleRate)
+{
+    sampleRate = newSampleRate;
+    kernels = &DSPKernels::getActive();
+
+    // Each stream is one lane of the oversampler, which processes all of them as a single group
+    const juce::dsp::ProcessSpec spec { sampleRate, static_cast<juce::uint32> (tileSize), static_cast<juce::uint32> (numLanes) };
+
+    // The first pass only measures the memory needed by all stages, the second one hands out the arena memory
+    dspArena.beginMeasuring();
+    prepareArenaStages (spec);
+    dspArena.allocateMeasuredSize();
+    prepareArenaStages (spec);
+
+    chainCoefficients.prepare (sampleRate);
+
+    // The interleaved frames of one tile are borrowed during process, the oversampler borrows its buffers within that time
+    ScratchPool::reserve (ScratchPool::getAllocationSize<float> (tileSize * numLanes) + oversampler.getScratchSize());
+
+    for (size_t lane = 0; lane < numLanes; ++lane)
+    {
+        volumes[lane].prepare (spec);
+        volumes[lane].setRampDurationSeconds (static_cast<double> (morphUpdateInterval) / sampleRate);
+
+        auto& morph = parameterMorphs[lane];
+        morph.prepare (sampleRate);
+        morph.jumpTo (morph.getTarget());
+        numSamplesLeftInMorphStep[lane] = 0;
+        applyChainParameters (lane, morph.getCurrent());
+        volumes[lane].reset();
+    }
+}
+
+void OJDBatch::prepareArenaStages (const juce::dsp::ProcessSpec& spec)
+{
+    // Called in signal path order, so that the memory of each stage follows the memory of the previous stage
+    preCoefficients  = dspArena.allocate<float> (5 * numPreSections * numLanes);
+    preState         = dspArena.allocate<float> (2 * numPreSections * numLanes);
+
+    oversampler.prepare (spec, dspArena);
+
+    postCoefficients = dspArena.allocate<float> (5 * numPostSections * numLanes);
+    postState        = dspArena.allocate<float> (2 * numPostSections * numLanes);
+}
+
+void OJDBatch::reset()
+{
+    if (preState != nullptr)
+        std::fill (preState, preState + 2 * numPreSections * numLanes, 0.0f);
+
+    if (postState != nullptr)
+        std::fill (postState, postState + 2 * numPostSections * numLanes, 0.0f);
+
+    oversampler.reset();
+
+    for (auto& volume : volumes)
+        volume.reset();
+}
+
+void OJDBatch::setParameters (int stream, const OJDCore::Parameters& parameters, double smoothingTimeInSeconds)
+{
+    setChainParameters (stream, OJDCore::toChainParameters (parameters), smoothingTimeInSeconds);
+}
+
+void OJDBatch::setChainParameters (int stream, const ChainParameters& chainParameters, double morphTimeInSeconds)
+{
+    jassert (juce::isPositiveAndBelow (stream, getNumStreams()));
+
+    auto& morph = parameterMorphs[static_cast<size_t> (stream)];
+
+    if (chainParameters != morph.getTarget())
+    {
+        morph.morphTo (chainParameters, morphTimeInSeconds);
+        numSamplesLeftInMorphStep[static_cast<size_t> (stream)] = 0;
+    }
+}
+
+void OJDBatch::setOversamplingOrder (int order)
+{
+    oversamplingOrder = juce::jlimit (0, static_cast<int> (Waveshaper::maxOversamplingOrder), order);
+    oversampler = LaneOversampler (static_cast<size_t> (oversamplingOrder), numLanes);
+}
+
+void OJDBatch::process (float* const* streams, int numSamples)
+{
+    juce::ScopedNoDenormals noDenormals;
+
+    const auto ns = static_cast<size_t> (numSamples);
+
+    const auto outputSilence = [&]
+    {
+        for (size_t lane = 0; lane < numLanes; ++lane)
+            std::fill_n (streams[lane], ns, 0.0f);
+    };
+
+    // The frames of one tile, holding the samples of all streams interleaved
+    ScratchPool::Scope scratch;
+    auto* frames = scratch.allocate<float> (tileSize * numLanes);
+
+    if (frames == nullptr)
+    {
+        outputSilence();
+        return;
+    }
+
+    for (size_t start = 0; start < ns;)
+    {
+        // Each stream counts its morph steps from the start of its own morph, like OJDCore does. A sub tile ends at the
+        // first step boundary of any stream
+        auto length = juce::jmin (tileSize, ns - start);
+
+        for (size_t lane = 0; lane < numLanes; ++lane)
+            length = juce::jmin (length, beginMorphStep (lane));
+
+        for (size_t lane = 0; lane < numLanes; ++lane)
+        {
+            updateLane (lane, length);
+
+            const auto* stream = streams[lane] + start;
+
+            for (size_t i = 0; i < length; ++i)
+                frames[i * numLanes + lane] = stream[i];
+        }
+
+        kernels->biquadCascadeLanes (preCoefficients, numPreSections, numLanes, preState, frames, length,
+                                     unityGains.data(), noRampSamples.data(), noRampSamples.data(), unityGains.data());
+
+        oversampler.processInterleaved (frames, length, 0, [this] (float* samples, size_t n) { kernels->shape (samples, n); });
+
+        kernels->biquadCascadeLanes (postCoefficients, numPostSections, numLanes, postState, frames, length,
+                                     gainStart.data(), gainStep.data(), numRampSamples.data(), gainTarget.data());
+
+        for (size_t lane = 0; lane < numLanes; ++lane)
+        {
+            auto* stream = streams[lane] + start;
+
+            for (size_t i = 0; i < length; ++i)
+                stream[i] = frames[i * numLanes + lane];
+        }
+
+        start += length;
+    }
+
+    // The oversampler skips its processing if it runs out of scratch memory
+    if (scratch.hasFailed())
+        outputSilence();
+}
+
+size_t OJDBatch::beginMorphStep (size_t lane)
+{
+    auto& morph = parameterMorphs[lane];
+    auto& numSamplesLeft = numSamplesLeftInMorphStep[lane];
+
+    if (numSamplesLeft == 0)
+    {
+        if (morph.isMorphing())
+        {
+            applyChainParameters (lane, morph.advance (static_cast<int> (morphUpdateInterval)));
+            numSamplesLeft = morphUpdateInterval;
+        }
+        else if (appliedParameters[lane] != morph.getCurrent())
+        {
+            applyChainParameters (lane, morph.getCurrent());
+        }
+    }
+
+    return numSamplesLeft > 0 ? numSamplesLeft : tileSize;
+}
+
+void OJDBatch::updateLane (size_t lane, size_t numSamples)
+{
+    numSamplesLeftInMorphStep[lane] -= juce::jmin (numSamplesLeftInMorphStep[lane], numSamples);
+
+    const auto ramp = volumes[lane].getNextRamp (numSamples);
+
+    gainStart[lane]      = ramp.start;
+    gainStep[lane]       = ramp.step;
+    numRampSamples[lane] = static_cast<float> (ramp.numRampSamples);
+    gainTarget[lane]     = ramp.target;
+}
+
+void OJDBatch::applyChainParameters (size_t lane, const ChainParameters& chainParameters)
+{
+    if (sampleRate == 0.0)
+        return;
+
+    chainCoefficients.update (chainParameters);
+
+    setLaneSections (preCoefficients,  lane, chainCoefficients.pre);
+    setLaneSections (postCoefficients, lane, chainCoefficients.post);
+
+    volumes[lane].setGainDecibels (chainParameters.volumeDb);
+
+    appliedParameters[lane] = chainParameters;
+}
+
+template <size_t numSections>
+void OJDBatch::setLaneSections (float* coefficients, size_t lane, const std::array<BiquadSection::Coefficients, numSections>& sections)
+{
+    if (coefficients == nullptr)
+        return;
+
+    for (size_t s = 0; s < numSections; ++s)
+        for (size_t c = 0; c < 5; ++c)
+            coefficients[(5 * s + c) * numLanes + lane] = sections[s][c];
+}
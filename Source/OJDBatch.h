@@ -0,0 +1,134 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "OJDCore.h"
+#include "ChainCoefficients.h"
+#include "LaneOversampler.h"
+
+/**
+ * Processes many independent mono OJD voices at once, e.g. for rendering farms or multi voice instruments. The streams
+ * are interleaved into 4, 8 or 16 vector lanes, which run through the whole chain together: Both filter cascades use
+ * per lane coefficients and states and the waveshaper shapes all lanes of the oversampled frames in one pass. Each
+ * stream has its own parameters, which are morphed independently.
+ *
+ * Unlike the OJDCore, the batch always runs the oversampled waveshaper, there is no linear path for quiet blocks. The
+ * result of each stream matches a mono OJDCore otherwise.
+ *
+ * prepare has to be called before processing. All other functions are real time safe and have to be called from the
+ * thread that calls process.
+ */
+class OJDBatch
+{
+public:
+    /** Creates a batch for the given number of streams, which has to be 4, 8 or 16 */
+    explicit OJDBatch (int numStreams);
+
+    int getNumStreams() const { return static_cast<int> (numLanes); }
+
+    /** Allocates all memory needed for processing. The current parameters of all streams are applied without smoothing */
+    void prepare (double sampleRate);
+
+    /** Clears the state of all streams */
+    void reset();
+
+    /** Sets new parameters for one stream, the change is smoothed over the given time */
+    void setParameters (int stream, const OJDCore::Parameters& parameters, double smoothingTimeInSeconds = OJDCore::defaultSmoothingTime);
+
+    /** Morphs one stream to already mapped parameters over the given time. A time of zero applies them directly */
+    void setChainParameters (int stream, const ChainParameters& chainParameters, double morphTimeInSeconds);
+
+    /** Processes one mono buffer per stream in place, all with the same number of samples */
+    void process (float* const* streams, int numSamples);
+
+    /**
+     * Sets the number of 2x oversampling stages of the waveshaper like OJDCore::setOversamplingOrder. This is not real
+     * time safe, prepare has to be called afterwards.
+     */
+    void setOversamplingOrder (int order);
+
+    int getOversamplingOrder() const { return oversamplingOrder; }
+
+    /** The latency introduced by the oversampling, rounded down to whole samples */
+    int getLatencyInSamples() const { return static_cast<int> (oversampler.getLatencyInSamples()); }
+
+    /** Returns the number of bytes of coefficient and filter state memory of all streams */
+    size_t getDSPMemoryFootprint() const { return dspArena.getSizeInBytes(); }
+
+private:
+    static constexpr auto numPreSections  = static_cast<size_t> (ChainCoefficients::numPreCascadeSections);
+    static constexpr auto numPostSections = static_cast<size_t> (ChainCoefficients::numPostCascadeSections);
+
+    // The frames are processed through all stages in tiles of this size, parameters are updated in sub tiles of at most
+    // morphUpdateInterval samples while any stream is morphing
+    static constexpr size_t tileSize = OJDCore::tileSize;
+    static constexpr size_t morphUpdateInterval = 32;
+
+    const size_t numLanes;
+    int oversamplingOrder = static_cast<int> (Waveshaper::defaultOversamplingOrder);
+
+    LaneOversampler oversampler;
+    const DSPKernels* kernels = &DSPKernels::getActive();
+
+    // Holds the lane interleaved coefficients and states of both cascades followed by the oversampler states
+    DSPArena dspArena;
+    float* preCoefficients  = nullptr;
+    float* preState         = nullptr;
+    float* postCoefficients = nullptr;
+    float* postState        = nullptr;
+
+    double sampleRate = 0.0;
+
+    ChainCoefficients chainCoefficients;
+
+    // One entry per stream
+    std::vector<ParameterMorph>  parameterMorphs;
+    std::vector<ChainParameters> appliedParameters;
+    std::vector<size_t>          numSamplesLeftInMorphStep;
+    std::vector<OutputVolume>    volumes;
+
+    // The output gain ramps of all lanes for the current sub tile, as passed to the lane cascade kernel
+    std::vector<float> gainStart, gainStep, numRampSamples, gainTarget;
+
+    // The pre cascade runs without any gain
+    std::vector<float> unityGains, noRampSamples;
+
+    void prepareArenaStages (const juce::dsp::ProcessSpec& spec);
+
+    /**
+     * Starts the next morph step of one lane if the last one is complete or applies changed parameters. Returns the
+     * number of samples the coefficients of the lane stay valid for, at most tileSize
+     */
+    size_t beginMorphStep (size_t lane);
+
+    /** Counts down the morph step of one lane and fetches its gain ramp for the next samples */
+    void updateLane (size_t lane, size_t numSamples);
+
+    void applyChainParameters (size_t lane, const ChainParameters& chainParameters);
+
+    /** Copies the sections to the lane interleaved coefficient memory of a cascade */
+    template <size_t numSections>
+    void setLaneSections (float* coefficients, size_t lane, const std::array<BiquadSection::Coefficients, numSections>& sections);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OJDBatch)
+};
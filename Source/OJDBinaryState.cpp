@@ -0,0 +1,153 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDBinaryState.h"
+
+// The type the AudioProcessorValueTreeState uses for the child trees holding the parameter values
+const juce::Identifier OJDBinaryState::parameterType ("PARAM");
+
+void OJDBinaryState::write (juce::AudioProcessorValueTreeState& parameters, juce::MemoryBlock& destData)
+{
+    juce::MemoryOutputStream stream (destData, false);
+
+    stream.writeInt (static_cast<int> (magicNumber));
+    stream.writeInt (static_cast<int> (currentVersion));
+
+    auto& processorParameters = parameters.processor.getParameters();
+    stream.writeInt (processorParameters.size());
+
+    for (auto* p : processorParameters)
+    {
+        auto* ranged = dynamic_cast<juce::RangedAudioParameter*> (p);
+        jassert (ranged != nullptr);
+
+        stream.writeString (ranged->paramID);
+        stream.writeFloat (ranged->convertFrom0to1 (ranged->getValue()));
+    }
+
+    // Everything that is not a parameter, e.g. the editor UI state, is stored as binary value tree
+    auto remainingState = parameters.copyState();
+
+    for (auto i = remainingState.getNumChildren() - 1; i >= 0; --i)
+        if (remainingState.getChild (i).hasType (parameterType))
+            remainingState.removeChild (i, nullptr);
+
+    juce::MemoryOutputStream remainingStateData;
+    remainingState.writeToStream (remainingStateData);
+
+    stream.writeInt (static_cast<int> (remainingStateData.getDataSize()));
+    stream.write (remainingStateData.getData(), remainingStateData.getDataSize());
+}
+
+bool OJDBinaryState::isBinaryState (const void* data, int sizeInBytes)
+{
+    if (data == nullptr || sizeInBytes < 8)
+        return false;
+
+    return static_cast<juce::uint32> (juce::ByteOrder::littleEndianInt (data)) == magicNumber;
+}
+
+bool OJDBinaryState::read (juce::AudioProcessorValueTreeState& parameters, const void* data, int sizeInBytes)
+{
+    if (! isBinaryState (data, sizeInBytes))
+        return false;
+
+    juce::MemoryInputStream stream (data, static_cast<size_t> (sizeInBytes), false);
+    stream.skipNextBytes (4);
+
+    const auto version = static_cast<juce::uint32> (stream.readInt());
+
+    if (version > currentVersion)
+        return false;
+
+    const auto numParameters = stream.readInt();
+
+    if (numParameters < 0)
+        return false;
+
+    // Everything is read and validated before anything is applied, so that damaged data leaves the state untouched
+    std::vector<std::pair<juce::String, float>> values;
+
+    for (int i = 0; i < numParameters; ++i)
+    {
+        auto id = stream.readString();
+
+        if (stream.getNumBytesRemaining() < static_cast<juce::int64> (sizeof (float)))
+            return false;
+
+        values.emplace_back (std::move (id), stream.readFloat());
+    }
+
+    juce::ValueTree remainingState;
+
+    if (version < 2)
+    {
+        // Without the size, only a tree of the wrong type or nothing at all reveals damaged data
+        remainingState = juce::ValueTree::readFromStream (stream);
+
+        if (! remainingState.hasType (parameters.state.getType()))
+            return false;
+    }
+    else
+    {
+        if (stream.getNumBytesRemaining() < static_cast<juce::int64> (sizeof (juce::uint32)))
+            return false;
+
+        const auto remainingStateSize = static_cast<juce::uint32> (stream.readInt());
+
+        if (static_cast<juce::int64> (remainingStateSize) != stream.getNumBytesRemaining())
+            return false;
+
+        if (remainingStateSize > 0)
+        {
+            const auto* remainingStateStart = static_cast<const char*> (data) + stream.getPosition();
+            juce::MemoryInputStream remainingStateData (remainingStateStart, remainingStateSize, false);
+            remainingState = juce::ValueTree::readFromStream (remainingStateData);
+
+            if (! remainingState.hasType (parameters.state.getType()) || ! remainingStateData.isExhausted())
+                return false;
+        }
+    }
+
+    // Parameters that don't exist anymore are skipped, parameters that were added later keep their current value
+    for (const auto& v : values)
+        if (auto* parameter = parameters.getParameter (v.first))
+            parameter->setValueNotifyingHost (parameter->convertTo0to1 (v.second));
+
+    // A state that only holds parameters leaves the rest of the state tree as it is
+    if (! remainingState.isValid())
+        return true;
+
+    parameters.state.copyPropertiesFrom (remainingState, nullptr);
+
+    // Existing child trees are updated in place, so that e.g. an open editor keeps a valid reference to its subtree
+    for (const auto& child : remainingState)
+    {
+        auto existingChild = parameters.state.getChildWithName (child.getType());
+
+        if (existingChild.isValid())
+            existingChild.copyPropertiesAndChildrenFrom (child, nullptr);
+        else
+            parameters.state.appendChild (child.createCopy(), nullptr);
+    }
+
+    return true;
+}
@@ -0,0 +1,59 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_audio_processors/juce_audio_processors.h>
+
+/**
+ * The compact binary format the plugin state is saved in. Older versions of the plugin stored the whole
+ * AudioProcessorValueTreeState tree as XML, which is still accepted when restoring a state, see isBinaryState.
+ *
+ * Layout, all numbers little endian:
+ * - uint32 magic number
+ * - uint32 format version
+ * - uint32 number of parameters, followed by the parameter id as null terminated UTF-8 string and the unnormalised
+ *   value as float32 for each parameter
+ * - Since version 2: uint32 size of the remaining state tree in bytes, 0 if the state only holds parameters
+ * - The remaining state tree with all parameter children stripped, written with juce::ValueTree::writeToStream
+ */
+struct OJDBinaryState
+{
+    static constexpr juce::uint32 magicNumber    = 0x444a4f53; // "SOJD"
+    static constexpr juce::uint32 currentVersion = 2;
+
+    /** Writes the current parameter values and the rest of the state tree to the memory block */
+    static void write (juce::AudioProcessorValueTreeState& parameters, juce::MemoryBlock& destData);
+
+    /** Returns true if the data starts with the header of the binary format */
+    static bool isBinaryState (const void* data, int sizeInBytes);
+
+    /**
+     * Sets all parameters stored in the data directly and replaces the rest of the state tree. Returns false and
+     * leaves the state untouched if the data is not a valid binary state, is truncated, holds an invalid state tree or
+     * has been written by a newer, incompatible version. Hosts may restore a state on any thread, so this doesn't
+     * assume the message thread.
+     */
+    static bool read (juce::AudioProcessorValueTreeState& parameters, const void* data, int sizeInBytes);
+
+private:
+    static const juce::Identifier parameterType;
+};
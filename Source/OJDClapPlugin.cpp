@@ -0,0 +1,570 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDCore.h"
+#include <clap/clap.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * The OJD as CLAP plugin. It is built directly on the DSP core without the JUCE plugin wrapper and has no editor, hosts
+ * display the parameters with their generic controls.
+ *
+ * Parameter events are applied at their exact sample offset. The block is split into segments at the events and each
+ * segment is processed with the parameters that are valid for it, so automation does not depend on the host block size.
+ *
+ * Each channel is processed by its own mono core. If the host provides the thread pool extension and the oversampling
+ * makes processing expensive, both channels are processed as separate tasks in parallel on the threads of the host.
+ */
+class OJDClapPlugin
+{
+public:
+    enum ParameterId : clap_id
+    {
+        driveId,
+        toneId,
+        volumeId,
+        hpModeId,
+        numParameters
+    };
+
+    static const clap_plugin_descriptor_t descriptor;
+
+    OJDClapPlugin (const clap_host_t* hostToUse) : host (hostToUse)
+    {
+        setValues (OJDCore::Parameters());
+
+        plugin.desc             = &descriptor;
+        plugin.plugin_data      = this;
+        plugin.init             = [] (const clap_plugin_t* p) { return from (p).init(); };
+        plugin.destroy          = [] (const clap_plugin_t* p) { delete &from (p); };
+        plugin.activate         = [] (const clap_plugin_t* p, double sr, uint32_t minFrames, uint32_t maxFrames) { return from (p).activate (sr, minFrames, maxFrames); };
+        plugin.deactivate       = [] (const clap_plugin_t* p) { from (p).deactivate(); };
+        plugin.start_processing = [] (const clap_plugin_t*) { return true; };
+        plugin.stop_processing  = [] (const clap_plugin_t*) {};
+        plugin.reset            = [] (const clap_plugin_t* p) { from (p).reset(); };
+        plugin.process          = [] (const clap_plugin_t* p, const clap_process_t* process) { return from (p).process (process); };
+        plugin.get_extension    = [] (const clap_plugin_t*, const char* id) { return getExtension (id); };
+        plugin.on_main_thread   = [] (const clap_plugin_t*) {};
+    }
+
+    const clap_plugin_t* getPlugin() const { return &plugin; }
+
+private:
+    static constexpr uint32_t maxNumChannels = 2;
+
+    // Blocks with more parameter changes than this apply all remaining events at the start of the last segment
+    static constexpr size_t maxNumSegments = 64;
+
+    // The thread pool is only used if a block is expensive enough to outweigh the cost of waking up the host threads
+    static constexpr int      minOversamplingOrderForThreadPool = 3;
+    static constexpr uint32_t minNumFramesForThreadPool         = 64;
+
+    static constexpr uint32_t stateMagic   = 0x4f4a4443; // OJDC
+    static constexpr uint32_t stateVersion = 1;
+
+    struct Segment
+    {
+        uint32_t start = 0;
+        uint32_t end   = 0;
+        OJDCore::Parameters parameters;
+    };
+
+    struct State
+    {
+        uint32_t magic   = stateMagic;
+        uint32_t version = stateVersion;
+        double values[numParameters] = {};
+    };
+
+    clap_plugin_t plugin {};
+    const clap_host_t* host;
+    const clap_host_thread_pool_t* hostThreadPool = nullptr;
+
+    // Written by the audio thread while active and by the main thread otherwise, read by the main thread
+    std::array<std::atomic<double>, numParameters> values;
+
+    // Set if the main thread changed the values while the plugin is active, they are picked up by the next process call
+    std::atomic<bool> valuesChangedOnMainThread { false };
+
+    std::array<std::unique_ptr<OJDCore>, maxNumChannels> cores;
+    std::array<OJDCore::Parameters, maxNumChannels> appliedParameters;
+    bool active = false;
+
+    // Only used during process
+    OJDCore::Parameters currentParameters;
+    std::array<Segment, maxNumSegments> segments;
+    size_t numSegments = 0;
+    std::array<float*, maxNumChannels> channels {};
+    uint32_t numChannelsToProcess = 0;
+
+    static OJDClapPlugin& from (const clap_plugin_t* p) { return *static_cast<OJDClapPlugin*> (p->plugin_data); }
+
+    //==================================================================================================================
+    bool init()
+    {
+        hostThreadPool = static_cast<const clap_host_thread_pool_t*> (host->get_extension (host, CLAP_EXT_THREAD_POOL));
+
+        if (hostThreadPool != nullptr && hostThreadPool->request_exec == nullptr)
+            hostThreadPool = nullptr;
+
+        return true;
+    }
+
+    bool activate (double sampleRate, uint32_t, uint32_t maxFramesCount)
+    {
+        currentParameters = getValues();
+        valuesChangedOnMainThread = false;
+
+        for (size_t ch = 0; ch < maxNumChannels; ++ch)
+        {
+            // The cores are kept across activations, preparing them again only redoes what changed
+            if (cores[ch] == nullptr)
+                cores[ch] = std::make_unique<OJDCore>();
+
+            // Parameters are set before preparing, so that the core starts with them instead of morphing towards them
+            cores[ch]->setParameters (currentParameters, 0.0);
+            cores[ch]->prepare (sampleRate, static_cast<int> (maxFramesCount), 1);
+            appliedParameters[ch] = currentParameters;
+        }
+
+        active = true;
+        return true;
+    }
+
+    void deactivate()
+    {
+        active = false;
+    }
+
+    void reset()
+    {
+        for (auto& core : cores)
+            if (core != nullptr)
+                core->reset();
+    }
+
+    //==================================================================================================================
+    clap_process_status process (const clap_process_t* p)
+    {
+        if (valuesChangedOnMainThread.exchange (false))
+            currentParameters = getValues();
+
+        const auto numFrames = p->frames_count;
+        buildSegments (p->in_events, numFrames);
+
+        if (p->audio_inputs_count == 0 || p->audio_outputs_count == 0 || numFrames == 0)
+            return CLAP_PROCESS_CONTINUE;
+
+        const auto& input  = p->audio_inputs[0];
+        const auto& output = p->audio_outputs[0];
+
+        if (input.data32 == nullptr || output.data32 == nullptr || input.channel_count == 0)
+            return CLAP_PROCESS_ERROR;
+
+        numChannelsToProcess = std::min (output.channel_count, maxNumChannels);
+
+        // Processing happens in place in the output buffers, a mono input is fed to both channels
+        for (uint32_t ch = 0; ch < numChannelsToProcess; ++ch)
+        {
+            const auto* in = input.data32[std::min (ch, input.channel_count - 1)];
+            channels[ch] = output.data32[ch];
+
+            if (in != channels[ch])
+                std::memcpy (channels[ch], in, numFrames * sizeof (float));
+        }
+
+        const auto useThreadPool = hostThreadPool != nullptr &&
+                                   numChannelsToProcess > 1 &&
+                                   numFrames >= minNumFramesForThreadPool &&
+                                   cores[0]->getOversamplingOrder() >= minOversamplingOrderForThreadPool;
+
+        // The host may refuse to run the tasks, e.g. if its pool is busy, they are processed serially then
+        if (! useThreadPool || ! hostThreadPool->request_exec (host, numChannelsToProcess))
+            for (uint32_t ch = 0; ch < numChannelsToProcess; ++ch)
+                processChannel (ch);
+
+        for (auto ch = numChannelsToProcess; ch < output.channel_count; ++ch)
+            std::memset (output.data32[ch], 0, numFrames * sizeof (float));
+
+        return CLAP_PROCESS_CONTINUE;
+    }
+
+    /** Splits the block into segments at the sample offsets of all parameter events */
+    void buildSegments (const clap_input_events_t* events, uint32_t numFrames)
+    {
+        numSegments = 0;
+        uint32_t segmentStart = 0;
+
+        const auto numEvents = events->size (events);
+
+        for (uint32_t e = 0; e < numEvents; ++e)
+        {
+            const auto* header = events->get (events, e);
+            const auto time = std::min (header->time, numFrames);
+
+            if (! isParameterValueEvent (header))
+                continue;
+
+            // Events are sorted by time, the segment before the event ends at its offset
+            if (time > segmentStart && numSegments + 1 < maxNumSegments)
+            {
+                segments[numSegments++] = { segmentStart, time, currentParameters };
+                segmentStart = time;
+            }
+
+            applyParameterEvent (reinterpret_cast<const clap_event_param_value_t*> (header), currentParameters);
+        }
+
+        segments[numSegments++] = { segmentStart, numFrames, currentParameters };
+    }
+
+    /** Processes all segments of one channel, called either from process or as a task on a thread of the host */
+    void processChannel (uint32_t ch)
+    {
+        jassert (ch < numChannelsToProcess);
+
+        auto& core = *cores[ch];
+
+        for (size_t s = 0; s < numSegments; ++s)
+        {
+            const auto& segment = segments[s];
+
+            if (! equals (segment.parameters, appliedParameters[ch]))
+            {
+                core.setParameters (segment.parameters);
+                appliedParameters[ch] = segment.parameters;
+            }
+
+            if (segment.end > segment.start)
+            {
+                auto* channel = channels[ch] + segment.start;
+                core.process (&channel, 1, static_cast<int> (segment.end - segment.start));
+            }
+        }
+    }
+
+    //==================================================================================================================
+    static bool isParameterValueEvent (const clap_event_header_t* header)
+    {
+        return header->space_id == CLAP_CORE_EVENT_SPACE_ID && header->type == CLAP_EVENT_PARAM_VALUE;
+    }
+
+    /** Applies the event to the parameters and updates the value reported to the host */
+    void applyParameterEvent (const clap_event_param_value_t* event, OJDCore::Parameters& parameters)
+    {
+        if (event->param_id >= numParameters)
+            return;
+
+        const auto value = clampValue (event->param_id, event->value);
+        values[event->param_id] = value;
+
+        switch (event->param_id)
+        {
+            case driveId:  parameters.drive  = static_cast<float> (value); break;
+            case toneId:   parameters.tone   = static_cast<float> (value); break;
+            case volumeId: parameters.volume = static_cast<float> (value); break;
+            case hpModeId: parameters.hpMode = value >= 0.5;               break;
+            default: break;
+        }
+    }
+
+    static bool equals (const OJDCore::Parameters& a, const OJDCore::Parameters& b)
+    {
+        return a.drive == b.drive && a.tone == b.tone && a.volume == b.volume && a.hpMode == b.hpMode;
+    }
+
+    static double clampValue (clap_id id, double value)
+    {
+        if (id == hpModeId)
+            return value >= 0.5 ? 1.0 : 0.0;
+
+        return juce::jlimit (double (OJDCore::minKnobValue), double (OJDCore::maxKnobValue), value);
+    }
+
+    OJDCore::Parameters getValues() const
+    {
+        OJDCore::Parameters parameters;
+        parameters.drive  = static_cast<float> (values[driveId].load());
+        parameters.tone   = static_cast<float> (values[toneId].load());
+        parameters.volume = static_cast<float> (values[volumeId].load());
+        parameters.hpMode = values[hpModeId].load() >= 0.5;
+        return parameters;
+    }
+
+    void setValues (const OJDCore::Parameters& parameters)
+    {
+        values[driveId]  = parameters.drive;
+        values[toneId]   = parameters.tone;
+        values[volumeId] = parameters.volume;
+        values[hpModeId] = parameters.hpMode ? 1.0 : 0.0;
+    }
+
+    //==================================================================================================================
+    static const void* getExtension (const char* id)
+    {
+        if (std::strcmp (id, CLAP_EXT_PARAMS) == 0)      return &paramsExtension;
+        if (std::strcmp (id, CLAP_EXT_AUDIO_PORTS) == 0) return &audioPortsExtension;
+        if (std::strcmp (id, CLAP_EXT_STATE) == 0)       return &stateExtension;
+        if (std::strcmp (id, CLAP_EXT_LATENCY) == 0)     return &latencyExtension;
+        if (std::strcmp (id, CLAP_EXT_THREAD_POOL) == 0) return &threadPoolExtension;
+
+        return nullptr;
+    }
+
+    static const clap_plugin_params_t       paramsExtension;
+    static const clap_plugin_audio_ports_t  audioPortsExtension;
+    static const clap_plugin_state_t        stateExtension;
+    static const clap_plugin_latency_t      latencyExtension;
+    static const clap_plugin_thread_pool_t  threadPoolExtension;
+
+    //==================================================================================================================
+    static bool getParameterInfo (uint32_t index, clap_param_info_t* info)
+    {
+        if (index >= numParameters)
+            return false;
+
+        static const char* const names[] = { "Drive", "Tone", "Volume", "HP / LP" };
+        const OJDCore::Parameters defaults;
+
+        std::memset (info, 0, sizeof (clap_param_info_t));
+        info->id        = index;
+        info->flags     = CLAP_PARAM_IS_AUTOMATABLE;
+        info->min_value = OJDCore::minKnobValue;
+        info->max_value = OJDCore::maxKnobValue;
+        std::snprintf (info->name, sizeof (info->name), "%s", names[index]);
+
+        switch (index)
+        {
+            case driveId:  info->default_value = defaults.drive;  break;
+            case toneId:   info->default_value = defaults.tone;   break;
+            case volumeId: info->default_value = defaults.volume; break;
+            case hpModeId:
+                info->flags        |= CLAP_PARAM_IS_STEPPED;
+                info->min_value     = 0.0;
+                info->max_value     = 1.0;
+                info->default_value = defaults.hpMode ? 1.0 : 0.0;
+                break;
+            default: break;
+        }
+
+        return true;
+    }
+
+    static bool valueToText (clap_id id, double value, char* buffer, uint32_t capacity)
+    {
+        if (id >= numParameters)
+            return false;
+
+        if (id == hpModeId)
+            std::snprintf (buffer, capacity, "%s", value >= 0.5 ? "HP" : "LP");
+        else
+            std::snprintf (buffer, capacity, "%.2f", value);
+
+        return true;
+    }
+
+    static bool textToValue (clap_id id, const char* text, double* value)
+    {
+        if (id >= numParameters)
+            return false;
+
+        if (id == hpModeId && (std::strcmp (text, "HP") == 0 || std::strcmp (text, "LP") == 0))
+        {
+            *value = text[0] == 'H' ? 1.0 : 0.0;
+            return true;
+        }
+
+        char* end = nullptr;
+        const auto parsed = std::strtod (text, &end);
+
+        if (end == text)
+            return false;
+
+        *value = clampValue (id, parsed);
+        return true;
+    }
+
+    /** Called by the host while the plugin is not processing, either on the audio thread if active or on the main thread */
+    void flush (const clap_input_events_t* events)
+    {
+        const auto numEvents = events->size (events);
+
+        auto parameters = active ? currentParameters : getValues();
+
+        for (uint32_t e = 0; e < numEvents; ++e)
+        {
+            const auto* header = events->get (events, e);
+
+            if (isParameterValueEvent (header))
+                applyParameterEvent (reinterpret_cast<const clap_event_param_value_t*> (header), parameters);
+        }
+
+        if (active)
+            currentParameters = parameters;
+    }
+
+    //==================================================================================================================
+    bool saveState (const clap_ostream_t* stream) const
+    {
+        State state;
+
+        for (size_t i = 0; i < numParameters; ++i)
+            state.values[i] = values[i].load();
+
+        const auto* data = reinterpret_cast<const char*> (&state);
+
+        for (size_t written = 0; written < sizeof (State);)
+        {
+            const auto n = stream->write (stream, data + written, sizeof (State) - written);
+
+            if (n <= 0)
+                return false;
+
+            written += static_cast<size_t> (n);
+        }
+
+        return true;
+    }
+
+    bool loadState (const clap_istream_t* stream)
+    {
+        State state;
+        auto* data = reinterpret_cast<char*> (&state);
+
+        for (size_t read = 0; read < sizeof (State);)
+        {
+            const auto n = stream->read (stream, data + read, sizeof (State) - read);
+
+            if (n <= 0)
+                return false;
+
+            read += static_cast<size_t> (n);
+        }
+
+        if (state.magic != stateMagic || state.version > stateVersion)
+            return false;
+
+        for (clap_id i = 0; i < numParameters; ++i)
+            values[i] = clampValue (i, state.values[i]);
+
+        valuesChangedOnMainThread = true;
+        return true;
+    }
+
+    uint32_t getLatency() const
+    {
+        return cores[0] != nullptr ? static_cast<uint32_t> (cores[0]->getLatencyInSamples()) : 0;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (OJDClapPlugin)
+};
+
+//======================================================================================================================
+static const char* const features[] = { CLAP_PLUGIN_FEATURE_AUDIO_EFFECT, CLAP_PLUGIN_FEATURE_DISTORTION, CLAP_PLUGIN_FEATURE_STEREO, nullptr };
+
+const clap_plugin_descriptor_t OJDClapPlugin::descriptor =
+{
+    CLAP_VERSION_INIT,
+    "io.schrammel.ojd",
+    "OJD",
+    "Schrammel",
+    "https://schrammel.io",
+    "",
+    "https://github.com/JanosGit/Schrammel_OJD/issues",
+    OJD_VERSION_STRING,
+    "Model of a modern classic guitar overdrive pedal",
+    features
+};
+
+const clap_plugin_params_t OJDClapPlugin::paramsExtension =
+{
+    [] (const clap_plugin_t*) -> uint32_t { return numParameters; },
+    [] (const clap_plugin_t*, uint32_t index, clap_param_info_t* info) { return getParameterInfo (index, info); },
+    [] (const clap_plugin_t* p, clap_id id, double* value)
+    {
+        if (id >= numParameters)
+            return false;
+
+        *value = from (p).values[id].load();
+        return true;
+    },
+    [] (const clap_plugin_t*, clap_id id, double value, char* buffer, uint32_t capacity) { return valueToText (id, value, buffer, capacity); },
+    [] (const clap_plugin_t*, clap_id id, const char* text, double* value) { return textToValue (id, text, value); },
+    [] (const clap_plugin_t* p, const clap_input_events_t* in, const clap_output_events_t*) { from (p).flush (in); }
+};
+
+const clap_plugin_audio_ports_t OJDClapPlugin::audioPortsExtension =
+{
+    [] (const clap_plugin_t*, bool) -> uint32_t { return 1; },
+    [] (const clap_plugin_t*, uint32_t index, bool isInput, clap_audio_port_info_t* info)
+    {
+        if (index != 0)
+            return false;
+
+        info->id            = 0;
+        info->flags         = CLAP_AUDIO_PORT_IS_MAIN;
+        info->channel_count = maxNumChannels;
+        info->port_type     = CLAP_PORT_STEREO;
+        info->in_place_pair = 0;
+        std::snprintf (info->name, sizeof (info->name), "%s", isInput ? "Input" : "Output");
+        return true;
+    }
+};
+
+const clap_plugin_state_t OJDClapPlugin::stateExtension =
+{
+    [] (const clap_plugin_t* p, const clap_ostream_t* stream) { return from (p).saveState (stream); },
+    [] (const clap_plugin_t* p, const clap_istream_t* stream) { return from (p).loadState (stream); }
+};
+
+const clap_plugin_latency_t OJDClapPlugin::latencyExtension =
+{
+    [] (const clap_plugin_t* p) { return from (p).getLatency(); }
+};
+
+const clap_plugin_thread_pool_t OJDClapPlugin::threadPoolExtension =
+{
+    [] (const clap_plugin_t* p, uint32_t taskIndex) { from (p).processChannel (taskIndex); }
+};
+
+//======================================================================================================================
+static const clap_plugin_factory_t factory =
+{
+    [] (const clap_plugin_factory_t*) -> uint32_t { return 1; },
+    [] (const clap_plugin_factory_t*, uint32_t index) { return index == 0 ? &OJDClapPlugin::descriptor : nullptr; },
+    [] (const clap_plugin_factory_t*, const clap_host_t* host, const char* pluginId) -> const clap_plugin_t*
+    {
+        if (! clap_version_is_compatible (host->clap_version) || std::strcmp (pluginId, OJDClapPlugin::descriptor.id) != 0)
+            return nullptr;
+
+        return (new OJDClapPlugin (host))->getPlugin();
+    }
+};
+
+extern "C" CLAP_EXPORT const clap_plugin_entry_t clap_entry =
+{
+    CLAP_VERSION_INIT,
+    [] (const char*) { return true; },
+    [] () {},
+    [] (const char* factoryId) -> const void* { return std::strcmp (factoryId, CLAP_PLUGIN_FACTORY_ID) == 0 ? &factory : nullptr; }
+};
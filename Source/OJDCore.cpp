@@ -0,0 +1,531 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDCore.h"
+
+ChainParameters OJDCore::toChainParameters (const Parameters& parameters)
+{
+    ChainParameters chainParameters;
+
+    chainParameters.drive    = parameters.drive / maxKnobValue;
+    chainParameters.tone     = parameters.tone  / maxKnobValue;
+    chainParameters.volumeDb = juce::jmap (parameters.volume, minKnobValue, maxKnobValue, minVolumeDb, maxVolumeDb);
+    chainParameters.hpAmount = parameters.hpMode ? 1.0f : 0.0f;
+
+    return chainParameters;
+}
+
+OJDCore::OJDCore()
+{
+    // Limits the oversampling of the lower quality levels
+    setOversamplingOrder (static_cast<int> (Waveshaper::defaultOversamplingOrder));
+
+    parameterMorph.jumpTo (toChainParameters (Parameters()));
+}
+
+void OJDCore::prepare (double newSampleRate, int maximumBlockSize, int numChannels)
+{
+    // All stages are prepared for a single tile, independent of the block size of the caller
+    juce::ignoreUnused (maximumBlockSize);
+
+    // Mono and stereo share one memory layout, so switching between them doesn't lay out the stages again
+    const auto numChannelsToAllocate = static_cast<juce::uint32> (juce::jmax (numChannels, minNumAllocatedChannels));
+
+    const auto needsLayout = numChannelsToAllocate > numAllocatedChannels ||
+                             oversamplingOrderChanged ||
+                             preparedKernels != &DSPKernels::getActive();
+
+    const auto sampleRateChanged = newSampleRate != sampleRate;
+
+    sampleRate = newSampleRate;
+    const juce::dsp::ProcessSpec spec { sampleRate, static_cast<juce::uint32> (tileSize), juce::jmax (numChannelsToAllocate, numAllocatedChannels) };
+
+    if (needsLayout)
+    {
+        // The first pass only measures the memory needed by all stages, the second one hands out the arena memory. The
+        // arena only allocates if it needs more memory than before
+        dspArena.beginMeasuring();
+        prepareArenaStages (spec);
+        dspArena.allocateMeasuredSize();
+        prepareArenaStages (spec);
+
+        // processInterleaved borrows a planar working buffer, the waveshaper borrows its own scratch buffers within that time
+        const auto planarBufferSize = ScratchPool::getAllocationSize<float*> (spec.numChannels) +
+                                      ScratchPool::getAllocationSize<float> (spec.maximumBlockSize) * spec.numChannels;
+
+        auto stageScratchSize = compensationDelay.getScratchSize();
+
+        for (auto& w : waveshapers)
+            stageScratchSize = juce::jmax (stageScratchSize, w.getScratchSize());
+
+        // Fading between quality levels borrows a second planar buffer for the previous level
+        ScratchPool::reserve (2 * planarBufferSize + stageScratchSize);
+
+        numAllocatedChannels = spec.numChannels;
+        oversamplingOrderChanged = false;
+        preparedKernels = &DSPKernels::getActive();
+        dualMonoActive = false;
+    }
+
+    if (sampleRateChanged)
+    {
+        // The fixed filters of common sample rates are looked up, see ChainCoefficients::getFixedCoefficients
+        chainCoefficients.prepare (sampleRate);
+        volume.prepare (spec);
+
+        // Volume changes are ramped over one morph update interval
+        volume.setRampDurationSeconds (static_cast<double> (morphUpdateInterval) / sampleRate);
+
+        parameterMorph.prepare (sampleRate);
+
+        // The filter states don't match the new rate, a freshly laid out arena is cleared already
+        if (! needsLayout)
+            reset();
+    }
+
+    parameterMorph.jumpTo (parameterMorph.getTarget());
+    numSamplesLeftInMorphStep = 0;
+    applyChainParameters (parameterMorph.getCurrent());
+    volume.reset();
+}
+
+void OJDCore::prepareArenaStages (const juce::dsp::ProcessSpec& spec)
+{
+    // Called in signal path order, so that the memory of each stage follows the memory of the previous stage
+    preCascade .prepare (spec, dspArena);
+
+    for (auto& w : waveshapers)
+        w.prepare (spec, dspArena);
+
+    size_t maxCompensationDelay = 0;
+
+    for (size_t level = 0; level < waveshapers.size(); ++level)
+        maxCompensationDelay = juce::jmax (maxCompensationDelay, getCompensationDelay (level));
+
+    compensationDelay.prepare (spec, dspArena, maxCompensationDelay);
+    compensationDelay.setDelay (getCompensationDelay (activeQualityLevel));
+
+    postCascade.prepare (spec, dspArena);
+}
+
+void OJDCore::reset()
+{
+    preCascade.reset();
+
+    for (auto& w : waveshapers)
+        w.reset();
+
+    compensationDelay.reset();
+    numQualityLevelFadeSamplesLeft = 0;
+    warmingQualityLevel = activeQualityLevel;
+    numWarmUpSamplesLeft = 0;
+    postCascade.reset();
+    volume.reset();
+    dualMonoActive = false;
+}
+
+void OJDCore::setParameters (const Parameters& parameters, double smoothingTimeInSeconds)
+{
+    setChainParameters (toChainParameters (parameters), smoothingTimeInSeconds);
+}
+
+void OJDCore::setChainParameters (const ChainParameters& chainParameters, double morphTimeInSeconds)
+{
+    if (chainParameters != parameterMorph.getTarget())
+    {
+        // The new morph starts with the next processed sample
+        parameterMorph.morphTo (chainParameters, morphTimeInSeconds);
+        numSamplesLeftInMorphStep = 0;
+    }
+}
+
+template <typename Fn>
+void OJDCore::withChannelSpecialisation (size_t numChannels, Fn&& fn)
+{
+    if (channelSpecialisationsEnabled)
+        withChannelCount (numChannels, std::forward<Fn> (fn));
+    else
+        fn (std::integral_constant<size_t, ChannelCount::dynamic>());
+}
+
+template <size_t numBlockChannels, typename ProcessPreCascade, typename ProcessPostCascade>
+void OJDCore::processStages (const juce::dsp::AudioBlock<float>& block, size_t firstOffset, ProcessPreCascade&& processPreCascade, ProcessPostCascade&& processPostCascade)
+{
+    juce::ScopedNoDenormals noDenormals;
+
+    const auto numSamples = block.getNumSamples();
+
+    // Each tile runs through all stages before the next one starts. While morphing, all coefficients are recalculated
+    // once per sub block from the interpolated parameter set
+    for (size_t start = 0; start < numSamples;)
+    {
+        size_t length;
+
+        if (parameterMorph.isMorphing() || numSamplesLeftInMorphStep > 0)
+        {
+            // Morph steps are counted from the start of the morph. A step cut off by the end of the block continues
+            // with the same coefficients in the next block, so the result does not depend on the block size
+            if (numSamplesLeftInMorphStep == 0)
+            {
+                const auto updateInterval = activeQualityLevel == static_cast<size_t> (numQualityLevels - 1) ? reducedMorphUpdateInterval : morphUpdateInterval;
+
+                applyChainParameters (parameterMorph.advance (static_cast<int> (updateInterval)));
+                numSamplesLeftInMorphStep = updateInterval;
+            }
+
+            length = juce::jmin (numSamplesLeftInMorphStep, numSamples - start);
+            numSamplesLeftInMorphStep -= length;
+        }
+        else
+        {
+            length = juce::jmin (tileSize, numSamples - start);
+
+            if (appliedParameters != parameterMorph.getCurrent())
+                applyChainParameters (parameterMorph.getCurrent());
+        }
+
+        auto subBlock = block.getSubBlock (start, length);
+        const auto offset = firstOffset + start;
+
+        processPreCascade (subBlock, offset);
+        processWaveshaper<numBlockChannels> (subBlock);
+        processPostCascade (subBlock, offset, volume.getNextRamp (length));
+
+        start += length;
+    }
+}
+
+template <size_t numBlockChannels>
+void OJDCore::processWaveshaper (const juce::dsp::AudioBlock<float>& block)
+{
+    if (numWarmUpSamplesLeft > 0)
+        warmUpQualityLevel<numBlockChannels> (block);
+
+    if (numQualityLevelFadeSamplesLeft == 0)
+    {
+        waveshapers[activeQualityLevel].process<numBlockChannels> (juce::dsp::ProcessContextReplacing<float> (block));
+        compensationDelay.process<numBlockChannels> (block);
+        return;
+    }
+
+    const auto nc = ChannelCount::of<numBlockChannels> (block);
+    const auto numSamples = block.getNumSamples();
+
+    ScratchPool::Scope scratch;
+    const auto previous = copyToScratch (scratch, block);
+
+    if (scratch.hasFailed())
+        return;
+
+    // The previous level continues with its own state, only the history of the delay follows the active level
+    waveshapers[previousQualityLevel].process<numBlockChannels> (juce::dsp::ProcessContextReplacing<float> (previous));
+    compensationDelay.processWithoutHistory<numBlockChannels> (previous, getCompensationDelay (previousQualityLevel));
+
+    waveshapers[activeQualityLevel].process<numBlockChannels> (juce::dsp::ProcessContextReplacing<float> (block));
+    compensationDelay.process<numBlockChannels> (block);
+
+    const auto fadeStart = qualityLevelFadeLength - numQualityLevelFadeSamplesLeft;
+
+    for (size_t ch = 0; ch < nc; ++ch)
+    {
+        auto* samples = block.getChannelPointer (ch);
+        const auto* previousSamples = previous.getChannelPointer (ch);
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            const auto gain = static_cast<float> (juce::jmin (fadeStart + i + 1, qualityLevelFadeLength)) / static_cast<float> (qualityLevelFadeLength);
+            samples[i] = previousSamples[i] + gain * (samples[i] - previousSamples[i]);
+        }
+    }
+
+    numQualityLevelFadeSamplesLeft -= juce::jmin (numQualityLevelFadeSamplesLeft, numSamples);
+}
+
+template <size_t numBlockChannels>
+void OJDCore::warmUpQualityLevel (const juce::dsp::AudioBlock<float>& block)
+{
+    ScratchPool::Scope scratch;
+    const auto copy = copyToScratch (scratch, block);
+
+    if (scratch.hasFailed())
+        return;
+
+    waveshapers[warmingQualityLevel].process<numBlockChannels> (juce::dsp::ProcessContextReplacing<float> (copy));
+    numWarmUpSamplesLeft -= juce::jmin (numWarmUpSamplesLeft, block.getNumSamples());
+}
+
+juce::dsp::AudioBlock<float> OJDCore::copyToScratch (ScratchPool::Scope& scratch, const juce::dsp::AudioBlock<float>& block)
+{
+    const auto nc = block.getNumChannels();
+    const auto numSamples = block.getNumSamples();
+
+    auto** channels = scratch.allocate<float*> (nc);
+
+    if (channels == nullptr)
+        return {};
+
+    for (size_t ch = 0; ch < nc; ++ch)
+    {
+        channels[ch] = scratch.allocate<float> (numSamples);
+
+        if (channels[ch] == nullptr)
+            return {};
+
+        std::copy (block.getChannelPointer (ch), block.getChannelPointer (ch) + numSamples, channels[ch]);
+    }
+
+    return { channels, nc, numSamples };
+}
+
+void OJDCore::process (const juce::dsp::AudioBlock<float>& block)
+{
+    // All stages borrow their scratch memory within this scope
+    ScratchPool::Scope scratch;
+
+    if (! scratch.isValid())
+    {
+        block.clear();
+        return;
+    }
+
+    updateQualityLevel();
+
+    if (updateDualMono (block))
+    {
+        const auto monoBlock = block.getSingleChannelBlock (0);
+
+        process (monoBlock);
+        block.getSingleChannelBlock (1).copyFrom (monoBlock);
+    }
+    else
+    {
+        // The stages are compiled for mono and stereo blocks, switching between them happens at block boundaries only
+        withChannelSpecialisation (block.getNumChannels(), [&] (auto numChannels)
+        {
+            processPlanar<decltype (numChannels)::value> (block);
+        });
+    }
+
+    // Stages that ran out of scratch memory skipped their processing
+    if (scratch.hasFailed())
+        block.clear();
+}
+
+template <size_t numBlockChannels>
+void OJDCore::processPlanar (const juce::dsp::AudioBlock<float>& block)
+{
+    processStages<numBlockChannels> (block, 0,
+                                     [this] (juce::dsp::AudioBlock<float>& subBlock, size_t) { preCascade.process<numBlockChannels> (juce::dsp::ProcessContextReplacing<float> (subBlock)); },
+                                     [this] (juce::dsp::AudioBlock<float>& subBlock, size_t, const OutputVolume::Ramp& ramp) { postCascade.processWithGain<numBlockChannels> (subBlock, ramp); });
+}
+
+void OJDCore::process (float* const* channels, int numChannels, int numSamples)
+{
+    process (juce::dsp::AudioBlock<float> (channels, static_cast<size_t> (numChannels), static_cast<size_t> (numSamples)));
+}
+
+void OJDCore::processInterleaved (const void* input, SampleFormat inputFormat,
+                                  void* output, SampleFormat outputFormat,
+                                  int numChannels, int numSamples)
+{
+    const auto nc = static_cast<size_t> (numChannels);
+    const auto ns = static_cast<size_t> (numSamples);
+
+    const auto outputSilence = [&] { std::fill_n (static_cast<char*> (output), ns * nc * getNumBytesPerSample (outputFormat), char (0)); };
+
+    // The planar working buffer for the waveshaper in between the two cascades, holding one tile at a time
+    ScratchPool::Scope scratch;
+
+    if (! scratch.isValid())
+    {
+        outputSilence();
+        return;
+    }
+
+    updateQualityLevel();
+
+    auto** channels = scratch.allocate<float*> (nc);
+
+    if (channels != nullptr)
+        for (size_t ch = 0; ch < nc; ++ch)
+            channels[ch] = scratch.allocate<float> (tileSize);
+
+    if (scratch.hasFailed())
+    {
+        outputSilence();
+        return;
+    }
+
+    auto* in  = static_cast<const char*> (input);
+    auto* out = static_cast<char*> (output);
+
+    withInterleavedSamples (inputFormat, [&] (auto inputSamples)
+    {
+        withInterleavedSamples (outputFormat, [&] (auto outputSamples)
+        {
+            withChannelSpecialisation (nc, [&] (auto numChannels)
+            {
+                constexpr auto numBlockChannels = decltype (numChannels)::value;
+
+                for (size_t start = 0; start < ns; start += tileSize)
+                {
+                    const juce::dsp::AudioBlock<float> tile (channels, nc, juce::jmin (tileSize, ns - start));
+
+                    processStages<numBlockChannels> (tile, start,
+                                                     [&] (juce::dsp::AudioBlock<float>& subBlock, size_t offset) { preCascade.processFromInterleaved<numBlockChannels> (inputSamples, in, offset, subBlock); },
+                                                     [&] (juce::dsp::AudioBlock<float>& subBlock, size_t offset, const OutputVolume::Ramp& ramp) { postCascade.processToInterleaved<numBlockChannels> (outputSamples, subBlock, out, offset, ramp); });
+                }
+            });
+        });
+    });
+
+    // Stages that ran out of scratch memory skipped their processing
+    if (scratch.hasFailed())
+        outputSilence();
+}
+
+bool OJDCore::updateDualMono (const juce::dsp::AudioBlock<float>& block)
+{
+    if (block.getNumChannels() != 2)
+        return false;
+
+    const auto identicalInputs = std::memcmp (block.getChannelPointer (0), block.getChannelPointer (1), block.getNumSamples() * sizeof (float)) == 0;
+
+    if (! identicalInputs)
+    {
+        // The second channel hasn't been processed while in dual mono, it continues where the first one is now
+        if (dualMonoActive)
+            copyChannelState (0, 1);
+
+        dualMonoActive = false;
+        return false;
+    }
+
+    // Identical inputs make the states converge, the remaining tiny difference is removed when switching
+    if (! dualMonoActive && getChannelStateDifference (0, 1) <= dualMonoStateTolerance)
+    {
+        copyChannelState (0, 1);
+        dualMonoActive = true;
+    }
+
+    return dualMonoActive;
+}
+
+void OJDCore::copyChannelState (size_t source, size_t destination)
+{
+    preCascade .copyChannelState (source, destination);
+    waveshapers[activeQualityLevel].copyChannelState (source, destination);
+
+    // The levels processing the input alongside the active one skip the second channel in dual mono as well
+    if (numQualityLevelFadeSamplesLeft > 0)
+        waveshapers[previousQualityLevel].copyChannelState (source, destination);
+
+    if (numWarmUpSamplesLeft > 0)
+        waveshapers[warmingQualityLevel].copyChannelState (source, destination);
+    compensationDelay.copyChannelState (source, destination);
+    postCascade.copyChannelState (source, destination);
+}
+
+float OJDCore::getChannelStateDifference (size_t a, size_t b) const
+{
+    return std::max ({ preCascade .getChannelStateDifference (a, b),
+                       waveshapers[activeQualityLevel].getChannelStateDifference (a, b),
+                       compensationDelay.getChannelStateDifference (a, b),
+                       postCascade.getChannelStateDifference (a, b) });
+}
+
+void OJDCore::setOversamplingOrder (int order)
+{
+    const auto fullQualityOrder = static_cast<size_t> (juce::jlimit (0, static_cast<int> (Waveshaper::maxOversamplingOrder), order));
+
+    // The highest order of each quality level
+    const std::array<size_t, numQualityLevels> maxOrders { { Waveshaper::maxOversamplingOrder, 2, 1 } };
+
+    for (size_t level = 0; level < waveshapers.size(); ++level)
+        waveshapers[level].setOversamplingOrder (juce::jmin (fullQualityOrder, maxOrders[level]));
+
+    oversamplingOrderChanged = true;
+}
+
+void OJDCore::updateQualityLevel()
+{
+    if (requestedQualityLevel == activeQualityLevel)
+    {
+        // A level requested before but not reached is abandoned
+        warmingQualityLevel = activeQualityLevel;
+        numWarmUpSamplesLeft = 0;
+        return;
+    }
+
+    if (warmingQualityLevel != requestedQualityLevel)
+    {
+        warmingQualityLevel = requestedQualityLevel;
+
+        // The previous level still processes all input while the output fades over from it, any other level starts
+        // from a reset state and processes a copy of the input until it has caught up
+        if (numQualityLevelFadeSamplesLeft > 0 && requestedQualityLevel == previousQualityLevel)
+        {
+            numWarmUpSamplesLeft = 0;
+        }
+        else
+        {
+            waveshapers[requestedQualityLevel].reset();
+            numWarmUpSamplesLeft = waveshapers[requestedQualityLevel].getWarmUpLength();
+        }
+    }
+
+    if (numWarmUpSamplesLeft > 0)
+        return;
+
+    compensationDelay.setDelay (getCompensationDelay (requestedQualityLevel));
+
+    previousQualityLevel = activeQualityLevel;
+    activeQualityLevel = requestedQualityLevel;
+    numQualityLevelFadeSamplesLeft = qualityLevelFadeLength;
+}
+
+size_t OJDCore::getCompensationDelay (size_t qualityLevel) const
+{
+    const auto latencyDifference = waveshapers.front().getLatencyInSamples() - waveshapers[qualityLevel].getLatencyInSamples();
+    return static_cast<size_t> (juce::jmax (0, juce::roundToInt (latencyDifference)));
+}
+
+int OJDCore::getLatencyInSamples() const
+{
+    // The oversampling in the waveshaper might introduce fractional sample delay
+    return static_cast<int> (waveshapers.front().getLatencyInSamples());
+}
+
+void OJDCore::applyChainParameters (const ChainParameters& chainParameters)
+{
+    if (sampleRate == 0.0)
+        return;
+
+    chainCoefficients.update (chainParameters);
+
+    preCascade .setSections (chainCoefficients.pre);
+    postCascade.setSections (chainCoefficients.post);
+
+    // Volume
+    volume.setGainDecibels (chainParameters.volumeDb);
+
+    appliedParameters = chainParameters;
+}
@@ -0,0 +1,279 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "ChainCoefficients.h"
+#include "Waveshaper.h"
+#include "BiquadCascade.h"
+#include "DSPArena.h"
+#include "ParameterMorph.h"
+#include "OutputVolume.h"
+#include "CompensationDelay.h"
+#include "SampleFormat.h"
+
+/**
+ * The complete OJD signal chain without any plugin, GUI or networking dependencies. It only depends on juce_dsp and
+ * is built as the OJD-Core library, so that it can be embedded into other audio engines. The plugin processor is a
+ * thin wrapper around it.
+ *
+ * prepare has to be called before processing. All other functions are real time safe and have to be called from the
+ * thread that calls process.
+ */
+class OJDCore
+{
+public:
+    /** The user facing parameters, using the same 0 to 10 range as the knobs of the pedal */
+    struct Parameters
+    {
+        float drive  = 1.65f;
+        float tone   = 5.0f;
+        float volume = 8.35f;
+        bool  hpMode = false;
+    };
+
+    static constexpr float minKnobValue = 0.0f;
+    static constexpr float maxKnobValue = 10.0f;
+    static constexpr float minVolumeDb  = -60.0f;
+    static constexpr float maxVolumeDb  = -20.0f;
+
+    /** Smoothing time used by setParameters if none is specified */
+    static constexpr double defaultSmoothingTime = 0.02;
+
+    /** Maps the user facing parameters to the values the chain works with */
+    static ChainParameters toChainParameters (const Parameters& parameters);
+
+    OJDCore();
+
+    /**
+     * Allocates all memory needed for processing. The current parameters are applied without smoothing.
+     *
+     * Blocks are processed internally in tiles of at most tileSize samples, which run through all stages before the
+     * next tile starts, so the working set stays in the L1 cache. The memory use only depends on the tile size, so
+     * blocks of any size can be processed, even if they are larger than maximumBlockSize.
+     *
+     * Preparing again only redoes what the changed settings require. Memory is laid out for at least
+     * minNumAllocatedChannels channels and only laid out again for more channels or after the oversampling order
+     * changed, which also clears the state. A new sample rate looks up the fixed filter coefficients and clears the
+     * state, all other calls keep it. Apart from laying out memory for more channels than ever before, nothing is
+     * allocated.
+     */
+    void prepare (double sampleRate, int maximumBlockSize, int numChannels);
+
+    /** The memory is always laid out for at least this number of channels, so that mono and stereo share it */
+    static constexpr int minNumAllocatedChannels = 2;
+
+    /** The number of samples processed through all stages at once */
+    static constexpr size_t tileSize = 64;
+
+    /** Clears the state of all filters */
+    void reset();
+
+    /** Sets new parameters, the change is smoothed over the given time */
+    void setParameters (const Parameters& parameters, double smoothingTimeInSeconds = defaultSmoothingTime);
+
+    /** Morphs to already mapped parameters over the given time. A time of zero applies them directly */
+    void setChainParameters (const ChainParameters& chainParameters, double morphTimeInSeconds);
+
+    /** Returns the parameters the chain is currently morphing to or those it has reached */
+    const ChainParameters& getTargetChainParameters() const { return parameterMorph.getTarget(); }
+
+    /** Returns true while the chain moves to new parameters */
+    bool isMorphing() const { return parameterMorph.isMorphing(); }
+
+    /**
+     * Processes the block in place. The block must not have more channels than prepared for, but any number of samples.
+     *
+     * Stereo blocks with bit identical channels are processed as dual mono: Once the filter states of both channels
+     * have converged, only the first channel is processed and copied to the second one. As soon as the channels differ,
+     * the second channel continues with the state of the first one and both are processed again.
+     *
+     * In the unlikely case that every ScratchPool is in use by other threads, the block is cleared instead. The same
+     * applies to the other process functions.
+     */
+    void process (const juce::dsp::AudioBlock<float>& block);
+
+    /** Processes planar channel buffers in place */
+    void process (float* const* channels, int numChannels, int numSamples);
+
+    /**
+     * Processes interleaved buffers of the given formats. The filter cascade before the waveshaper reads and converts
+     * the input directly and the one after it applies the volume and interleaves its output directly, so there are no
+     * extra conversion passes. The planar working buffer in between is borrowed from the ScratchPool. Input and output
+     * may point to the same memory if both use the same format.
+     */
+    void processInterleaved (const void* input, SampleFormat inputFormat,
+                             void* output, SampleFormat outputFormat,
+                             int numChannels, int numSamples);
+
+    /**
+     * Sets the number of 2x oversampling stages of the waveshaper, from 0 for no oversampling up to 5. The default is 4,
+     * e.g. 16x oversampling. This is not real time safe, prepare has to be called afterwards.
+     */
+    void setOversamplingOrder (int order);
+
+    int getOversamplingOrder() const { return static_cast<int> (waveshapers.front().getOversamplingOrder()); }
+
+    /** The number of quality levels, see setQualityLevel */
+    static constexpr int numQualityLevels = 3;
+
+    /**
+     * Sets how much sound quality the chain trades for CPU time, from 0 for full quality up to numQualityLevels - 1.
+     * Level 1 limits the oversampling to 4x, level 2 limits it to 2x and recalculates the coefficients half as often
+     * while morphing. All levels are prepared up front, so switching is real time safe. The waveshaper of the new level
+     * first processes a copy of the input alongside the active one until it has caught up with the signal, which
+     * spreads its warm up over the blocks before the switch. The switch happens at the start of the next block after
+     * that and the output fades over from the previous level within qualityLevelFadeLength samples. The latency stays
+     * the one of full quality, levels with less oversampling latency are delayed to match.
+     */
+    void setQualityLevel (int level) { requestedQualityLevel = static_cast<size_t> (juce::jlimit (0, numQualityLevels - 1, level)); }
+
+    /** Returns the quality level used for the last processed block */
+    int getQualityLevel() const { return static_cast<int> (activeQualityLevel); }
+
+    static constexpr size_t qualityLevelFadeLength = tileSize;
+
+    /** Returns true if the last block was processed as dual mono */
+    bool isDualMonoActive() const { return dualMonoActive; }
+
+    /**
+     * Mono and stereo blocks are processed by stages compiled for exactly that number of channels, picked for each
+     * block. Disabling this processes them like any other channel count, which is only meant for benchmarking.
+     */
+    void setChannelSpecialisationsEnabled (bool shouldBeEnabled) { channelSpecialisationsEnabled = shouldBeEnabled; }
+
+    /**
+     * Returns how hard the waveshaper has been driven since the last call to resetWaveshaperActivity, see
+     * Waveshaper::getActivity. Channels skipped in dual mono mode are not counted.
+     */
+    const Waveshaper::Activity& getWaveshaperActivity() const { return waveshapers[activeQualityLevel].getActivity(); }
+
+    void resetWaveshaperActivity()
+    {
+        for (auto& w : waveshapers)
+            w.resetActivity();
+    }
+
+    /** The latency introduced by the oversampling, rounded down to whole samples */
+    int getLatencyInSamples() const;
+
+    /**
+     * Returns the number of bytes of filter state memory the chain uses. Scratch buffers are not included, they are
+     * borrowed from the ScratchPool shared by all instances.
+     */
+    size_t getDSPMemoryFootprint() const { return dspArena.getSizeInBytes(); }
+
+private:
+    // Signal path: preCascade -> waveshaper of the active quality level -> compensationDelay -> postCascade with the
+    // output volume applied while writing the result
+    BiquadCascade<ChainCoefficients::numPreCascadeSections>  preCascade;
+    std::array<Waveshaper, numQualityLevels>                 waveshapers;
+    CompensationDelay                                        compensationDelay;
+    BiquadCascade<ChainCoefficients::numPostCascadeSections> postCascade;
+
+    size_t activeQualityLevel = 0;
+    size_t requestedQualityLevel = 0;
+
+    // While switching, the previous level processes the same input and the output fades over from it
+    size_t previousQualityLevel = 0;
+    size_t numQualityLevelFadeSamplesLeft = 0;
+
+    // Before switching, the requested level processes a copy of the input until its warm up length has passed
+    size_t warmingQualityLevel = 0;
+    size_t numWarmUpSamplesLeft = 0;
+
+    ChainCoefficients chainCoefficients;
+    OutputVolume volume;
+
+    // Holds the coefficients and states of the chain, laid out in signal path order
+    DSPArena dspArena;
+
+    // The chain parameters are updated in sub blocks of this size while morphing, it must not exceed the tile size
+    static constexpr size_t morphUpdateInterval = 32;
+    static_assert (morphUpdateInterval <= tileSize, "Morph sub blocks have to fit into a tile");
+
+    // The update interval of the lowest quality level
+    static constexpr size_t reducedMorphUpdateInterval = 2 * morphUpdateInterval;
+    static_assert (reducedMorphUpdateInterval <= tileSize, "Morph sub blocks have to fit into a tile");
+
+    double sampleRate = 0.0;
+
+    // What the memory is laid out for, prepare only lays it out again if any of these changed
+    juce::uint32 numAllocatedChannels = 0;
+    bool oversamplingOrderChanged = true;
+    const DSPKernels* preparedKernels = nullptr;
+
+    ParameterMorph parameterMorph;
+    ChainParameters appliedParameters;
+
+    // The number of samples the coefficients of the current morph step still apply to
+    size_t numSamplesLeftInMorphStep = 0;
+
+    // The states of both channels are considered converged if they don't differ by more than this
+    static constexpr float dualMonoStateTolerance = 1e-6f;
+    bool dualMonoActive = false;
+
+    bool channelSpecialisationsEnabled = true;
+
+    void prepareArenaStages (const juce::dsp::ProcessSpec& spec);
+    void applyChainParameters (const ChainParameters& chainParameters);
+
+    /** Warms up and switches to the requested quality level, called at the start of each block */
+    void updateQualityLevel();
+
+    /** Runs the waveshaper and compensation delay of the active level, fading over from the previous one if switching */
+    template <size_t numBlockChannels>
+    void processWaveshaper (const juce::dsp::AudioBlock<float>& block);
+
+    /** Runs a copy of the block through the waveshaper of the level that is warmed up, its output is discarded */
+    template <size_t numBlockChannels>
+    void warmUpQualityLevel (const juce::dsp::AudioBlock<float>& block);
+
+    /** Copies the block to buffers borrowed from the scope, returns an empty block if that fails */
+    static juce::dsp::AudioBlock<float> copyToScratch (ScratchPool::Scope& scratch, const juce::dsp::AudioBlock<float>& block);
+
+    /** The delay that matches the latency of the given quality level with the one of full quality */
+    size_t getCompensationDelay (size_t qualityLevel) const;
+
+    /** Returns true if the block can be processed as dual mono, switches the channel states if needed */
+    bool updateDualMono (const juce::dsp::AudioBlock<float>& block);
+    void copyChannelState (size_t source, size_t destination);
+    float getChannelStateDifference (size_t a, size_t b) const;
+
+    /**
+     * Runs the chain over the block in tiles, updating the parameters in smaller sub blocks while morphing. The pre
+     * and post cascades are processed by calling processPreCascade (subBlock, offset) and processPostCascade (subBlock,
+     * offset, volumeRamp), so that they can read from or write to other buffer formats. The offsets passed to them
+     * count from firstOffset.
+     */
+    template <size_t numBlockChannels, typename ProcessPreCascade, typename ProcessPostCascade>
+    void processStages (const juce::dsp::AudioBlock<float>& block, size_t firstOffset, ProcessPreCascade&& processPreCascade, ProcessPostCascade&& processPostCascade);
+
+    template <size_t numBlockChannels>
+    void processPlanar (const juce::dsp::AudioBlock<float>& block);
+
+    /** Calls fn with the ChannelCount specialisation to process the given number of channels with, see withChannelCount */
+    template <typename Fn>
+    void withChannelSpecialisation (size_t numChannels, Fn&& fn);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OJDCore)
+};
@@ -20,6 +20,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
  */
 
 #include "OJDParameters.h"
+#include "OJDCore.h"
 
 //================ IDs =================================================================================================
 const juce::String OJDParameters::Sliders::Drive::id  ("Drive");
@@ -30,21 +31,22 @@ const juce::String OJDParameters::Switches::Bypass::id ("Bypass");
 
 
 //================ Ranges ==============================================================================================
-constexpr float minDisplayRange = 0.0f;
-constexpr float maxDisplayRange = 10.0f;
-constexpr float minVolumeDb = -60.0f;
-constexpr float maxVolumeDb = -20.0f;
+// The value mapping itself is part of the core, so that it is the same for the plugin and all other users of it
+constexpr float minDisplayRange = OJDCore::minKnobValue;
+constexpr float maxDisplayRange = OJDCore::maxKnobValue;
+constexpr float minVolumeDb = OJDCore::minVolumeDb;
+constexpr float maxVolumeDb = OJDCore::maxVolumeDb;
 
 const juce::NormalisableRange<float> OJDParameters::Sliders::displayRange (minDisplayRange, maxDisplayRange, 0.01f);
 
-float OJDParameters::Sliders::normaliseRawValue (const std::atomic<float>& rawValue)
+float OJDParameters::Sliders::normaliseRawValue (float rawValue)
 {
     return rawValue / maxDisplayRange;
 }
 
-float OJDParameters::Sliders::Volume::dBValueFromRawValue (const std::atomic<float>& rawValue)
+float OJDParameters::Sliders::Volume::dBValueFromRawValue (float rawValue)
 {
-    return juce::jmap (rawValue.load(), minDisplayRange, maxDisplayRange, minVolumeDb, maxVolumeDb);
+    return juce::jmap (rawValue, minDisplayRange, maxDisplayRange, minVolumeDb, maxVolumeDb);
 }
 
 //================ String <-> value conversion =========================================================================
@@ -74,7 +76,7 @@ bool OJDParameters::Switches::Bypass::boolFromStringConversion (const juce::Stri
 }
 
 //================ Raw parameter to meaningful value conversion ========================================================
-ToneStack::Mode OJDParameters::Switches::HpLp::getModeFromRaw (const std::atomic<float>& rawValue)
+ToneStack::Mode OJDParameters::Switches::HpLp::getModeFromRaw (float rawValue)
 {
     return rawValue > 0.5 ? ToneStack::hp : ToneStack::lp;
 }
@@ -84,6 +86,18 @@ bool OJDParameters::Switches::Bypass::isActive (const std::atomic<float>& rawVal
     return rawValue > 0.5;
 }
 
+ChainParameters OJDParameters::toChainParameters (float rawDrive, float rawTone, float rawVolume, float rawHpLp)
+{
+    OJDCore::Parameters coreParameters;
+
+    coreParameters.drive  = rawDrive;
+    coreParameters.tone   = rawTone;
+    coreParameters.volume = rawVolume;
+    coreParameters.hpMode = Switches::HpLp::getModeFromRaw (rawHpLp) == ToneStack::hp;
+
+    return OJDCore::toChainParameters (coreParameters);
+}
+
 
 //================ Parameter layout creation ===========================================================================
 juce::AudioProcessorValueTreeState::ParameterLayout OJDParameters::createParameterLayout()
@@ -96,11 +110,13 @@ juce::AudioProcessorValueTreeState::ParameterLayout OJDParameters::createParamet
                                                  Switches::Name::stringFromBoolConversion,   \
                                                  Switches::Name::boolFromStringConversion)
 
+    const OJDCore::Parameters defaults;
+
     return juce::AudioProcessorValueTreeState::ParameterLayout (
     {
-        MAKE_ROTARY_PARAMETER (Drive,  1.65f),
-        MAKE_ROTARY_PARAMETER (Tone,   5.0f),
-        MAKE_ROTARY_PARAMETER (Volume, 8.35),
+        MAKE_ROTARY_PARAMETER (Drive,  defaults.drive),
+        MAKE_ROTARY_PARAMETER (Tone,   defaults.tone),
+        MAKE_ROTARY_PARAMETER (Volume, defaults.volume),
 
         MAKE_SWITCH_PARAMETER (HpLp,   "HP / LP"),
         MAKE_SWITCH_PARAMETER (Bypass, "Bypass")
@@ -23,6 +23,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 
 #include <juce_audio_processors/juce_audio_processors.h>
 #include "ToneStack.h"
+#include "ParameterMorph.h"
 
 /**
  * A class containing all parameter-related things, e.g. parameter IDs, normalizable ranges,
@@ -37,7 +38,7 @@ struct OJDParameters
         static const juce::NormalisableRange<float> displayRange;
 
         /** Takes the raw 0 to 10 parameter value and returns a 0 to 1 value */
-        static float normaliseRawValue (const std::atomic<float>& rawValue);
+        static float normaliseRawValue (float rawValue);
 
         struct Drive
         {
@@ -54,7 +55,7 @@ struct OJDParameters
             static const juce::String                   id;
 
             /** Takes the raw 0 to 10 parameter value and returns a -60dB to -20dB value */
-            static float dBValueFromRawValue (const std::atomic<float>& rawValue);
+            static float dBValueFromRawValue (float rawValue);
         };
     };
 
@@ -66,7 +67,7 @@ struct OJDParameters
             static const juce::String id;
 
             /** Returns if the tone stack should work in LP or HP mode */
-            static ToneStack::Mode getModeFromRaw (const std::atomic<float>& rawValue);
+            static ToneStack::Mode getModeFromRaw (float rawValue);
 
         private:
             friend OJDParameters;
@@ -89,6 +90,9 @@ struct OJDParameters
         };
     };
 
+    /** Converts a set of raw parameter values into the values the signal chain works with */
+    static ChainParameters toChainParameters (float rawDrive, float rawTone, float rawVolume, float rawHpLp);
+
     /** Used to report the Bypass parameter to PluginAudioProcessorBase */
     using Bypass = Switches::Bypass;
 
@@ -21,9 +21,9 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 
 #include "OJDProcessor.h"
 #include "OJDAudioProcessorEditor.h"
+#include "OJDBinaryState.h"
 
-// To avoid extremely much typing when assigning filter coefficients
-using BiquadCoeffs = juce::dsp::IIR::ArrayCoefficients<float>;
+const juce::Identifier OJDAudioProcessor::cabinetImpulseResponseId ("CabinetImpulseResponse");
 
 OJDAudioProcessor::OJDAudioProcessor()
   : rawValueDrive  (*parameters.getRawParameterValue (OJDParameters::Sliders::Drive::id)),
@@ -31,21 +31,36 @@ OJDAudioProcessor::OJDAudioProcessor()
     rawValueVolume (*parameters.getRawParameterValue (OJDParameters::Sliders::Volume::id)),
     rawValueHpLp   (*parameters.getRawParameterValue (OJDParameters::Switches::HpLp::id))
 {
-    // setup always constant elements in the chain
-    chain.get<preWaveshaperGain>().setGainLinear (11.0f);
-
-    // If the drive or hp/lp mode changes, some allocating biquad coefficient recalculation is done. The parameter
-    // listener callback is used for this
-    parameters.addParameterListener (OJDParameters::Sliders::Drive::id, this);
-    parameters.addParameterListener (OJDParameters::Switches::HpLp::id, this);
+    // Recalling a preset replaces the whole state tree. We listen to that to publish the complete preset at once
+    parameters.state.addListener (this);
 
     // Add a subtree where the editor stores some states
     parameters.state.appendChild (OJDAudioProcessorEditor::createUIStateSubtree(), nullptr);
 
+    auto& settingsManager = *jb::SettingsManager::getInstance();
+    presetMorphTime.store (static_cast<double> (settingsManager.getInt64Setting ("PresetMorphTimeMs", 100)) / 1000.0);
+    workerThreadMode.store (settingsManager.getInt64Setting ("WorkerThreadMode", 0) != 0);
+    flightRecorderEnabled.store (settingsManager.getInt64Setting ("FlightRecorder", 0) != 0);
+    loadSheddingEnabled.store (settingsManager.getInt64Setting ("LoadShedding", 0) != 0);
+
+    // Polls for dumps requested by the editor or triggered by a missed deadline, only needed while recording
+    if (flightRecorderEnabled.load())
+        startTimer (500);
+
     // Try to reach the schrammel server to find out if there is e.g. an update message to display
     checkForMessageOfTheDay();
 }
 
+OJDAudioProcessor::~OJDAudioProcessor()
+{
+    // The worker must not process the chain while its members are destroyed
+    if (workerThreadProcessor != nullptr)
+        workerThreadProcessor->release();
+
+    stopTimer();
+    parameters.state.removeListener (this);
+}
+
 void OJDAudioProcessor::prepareResources (bool sampleRateChanged, bool maxBlockSizeChanged, bool numChannelsChanged)
 {
     if (numChannelsChanged)
@@ -54,24 +69,60 @@ void OJDAudioProcessor::prepareResources (bool sampleRateChanged, bool maxBlockS
         numChannels = getTotalNumInputChannels();
     }
 
-    juce::ignoreUnused (sampleRateChanged, maxBlockSizeChanged);
+    const auto workerThreadModeChanged = workerThreadMode.load() != (workerThreadProcessor != nullptr);
+    const auto flightRecorderChanged   = flightRecorderEnabled.load() != flightRecorder.isPrepared();
 
-    auto spec = createProcessSpec (numChannels);
+    // Hosts re-prepare frequently, e.g. when toggling offline rendering. If nothing changed, all state is kept
+    if (! (sampleRateChanged || maxBlockSizeChanged || numChannelsChanged || workerThreadModeChanged || flightRecorderChanged || ! isPrepared))
+        return;
 
-    chain.prepare (spec);
-    recalculateFilters();
+    // The worker may still be processing the last block with the chain that is prepared below
+    if (workerThreadProcessor != nullptr)
+        workerThreadProcessor->release();
 
-    // Some fixed coefficients
-    *chain.get<hpf30>()  .state = BiquadCoeffs::makeFirstOrderHighPass (spec.sampleRate, 30.0f);
-    *chain.get<lpf6_3k>().state = BiquadCoeffs::makeFirstOrderLowPass  (spec.sampleRate, 6.3e3f);
+    // All stages are prepared for stereo, so a switch between mono and stereo doesn't allocate
+    auto spec = createProcessSpec (maxNumChannels);
 
-    updateParametersForProcessorChain();
+    // The core only redoes what the changed settings require, see OJDCore::prepare
+    core.prepare (spec.sampleRate, static_cast<int> (spec.maximumBlockSize), numChannels);
+    core.setChainParameters (getChainParametersFromRawValues(), 0.0);
 
-    // Computing the chains latency. The oversampling in the waveshaper might introduce fractional sample delay
-    const auto waveshaperLatency = chain.get<waveshaper>().getLatencyInSamples();
-    setLatencySamples (static_cast<int> (waveshaperLatency));
-}
+    chainMeter.prepare (spec.sampleRate);
+
+    // Load measured at another rate or block size doesn't tell anything about the new one
+    loadShedder.prepare (spec.sampleRate, OJDCore::numQualityLevels);
+    core.setQualityLevel (0);
+
+    // The convolution rebuilds its engines when prepared, which is only needed for a new rate or block size
+    if (sampleRateChanged || maxBlockSizeChanged || ! isPrepared)
+        cabinet.prepare (spec);
+
+    if (flightRecorderEnabled.load())
+        flightRecorder.prepare (spec.sampleRate, numChannels, static_cast<int> (spec.maximumBlockSize), flightRecorderHistory);
+    else
+        flightRecorder.release();
 
+    auto latency = core.getLatencyInSamples() + cabinet.getLatencyInSamples();
+
+    if (workerThreadMode.load())
+    {
+        if (workerThreadProcessor == nullptr)
+            workerThreadProcessor = std::make_unique<WorkerThreadProcessor> ([this] (const juce::dsp::AudioBlock<float>& b) { processChain (b); });
+
+        // Registers with a worker again. The worker processes all channels it is prepared for, so it follows the actual
+        // channel count. The sample rate limits how long the audio thread waits for the worker
+        workerThreadProcessor->prepare (spec.sampleRate, numChannels, static_cast<int> (spec.maximumBlockSize));
+
+        latency += workerThreadProcessor->getLatencyInSamples();
+    }
+    else
+    {
+        workerThreadProcessor.reset();
+    }
+
+    isPrepared = true;
+    setLatencySamples (latency);
+}
 
 bool OJDAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
@@ -85,12 +136,54 @@ bool OJDAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) cons
 
 void OJDAudioProcessor::processBlock (juce::dsp::AudioBlock<float>& block)
 {
-    juce::ScopedNoDenormals noDenormals;
-    juce::dsp::ProcessContextReplacing<float> context (block);
+    if (workerThreadProcessor != nullptr)
+        workerThreadProcessor->process (block);
+    else
+        processChain (block);
+}
+
+void OJDAudioProcessor::processChain (const juce::dsp::AudioBlock<float>& block)
+{
+    const auto morphTime = updateParameterMorphTarget();
+    const auto startTicks = juce::Time::getHighResolutionTicks();
 
-    updateParametersForProcessorChain();
+    if (flightRecorder.isPrepared())
+    {
+        FlightRecorder::Block recorded;
+        recorded.rawParameterValues = { rawValueDrive.load(), rawValueTone.load(), rawValueVolume.load(), rawValueHpLp.load() };
+        recorded.target             = core.getTargetChainParameters();
+        recorded.morphTimeInSeconds = static_cast<float> (morphTime);
+        recorded.oversamplingOrder  = core.getOversamplingOrder();
 
-    chain.process (context);
+        flightRecorder.record (block, recorded);
+    }
+
+    chainMeter.measureInput (block);
+
+    core.process (block);
+    cabinet.process (block);
+
+    chainMeter.measureOutput (block);
+    chainMeter.addWaveshaperActivity (core.getWaveshaperActivity());
+    core.resetWaveshaperActivity();
+
+    const auto processingSeconds = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+
+    if (flightRecorder.isPrepared())
+        flightRecorder.finishBlock (1000.0 * processingSeconds, core.getQualityLevel());
+
+    chainMeter.setQualityLevel (core.getQualityLevel());
+
+    // The level picked here is used from the next block on
+    if (loadSheddingEnabled.load())
+    {
+        core.setQualityLevel (loadShedder.update (processingSeconds, static_cast<int> (block.getNumSamples())));
+    }
+    else if (loadShedder.getLevel() != 0)
+    {
+        loadShedder.reset();
+        core.setQualityLevel (0);
+    }
 }
 
 
@@ -119,82 +212,194 @@ std::unique_ptr<jb::MessageOfTheDay::InfoAndUpdate> OJDAudioProcessor::getMessag
     return nullptr;
 }
 
-void OJDAudioProcessor::updateParametersForProcessorChain()
+void OJDAudioProcessor::setPresetMorphTime (double timeInSeconds)
+{
+    presetMorphTime.store (timeInSeconds);
+
+    auto& settingsManager = *jb::SettingsManager::getInstance();
+    settingsManager.writeSetting ("PresetMorphTimeMs", static_cast<int64_t> (timeInSeconds * 1000.0));
+}
+
+void OJDAudioProcessor::setCabinetImpulseResponse (const juce::File& file)
+{
+    parameters.state.setProperty (cabinetImpulseResponseId, file.getFullPathName(), nullptr);
+    updateCabinetFromState();
+}
+
+juce::File OJDAudioProcessor::getCabinetImpulseResponse() const
+{
+    const auto path = parameters.state.getProperty (cabinetImpulseResponseId).toString();
+    return juce::File::isAbsolutePath (path) ? juce::File (path) : juce::File();
+}
+
+void OJDAudioProcessor::updateCabinetFromState()
+{
+    const auto file = getCabinetImpulseResponse();
+
+    if (file == loadedCabinetImpulseResponse)
+        return;
+
+    loadedCabinetImpulseResponse = file;
+
+    // A missing file disables the stage, so that a session moved to another machine plays without a cabinet
+    if (file.existsAsFile())
+        cabinet.loadImpulseResponse (file);
+    else
+        cabinet.clearImpulseResponse();
+}
+
+void OJDAudioProcessor::setWorkerThreadMode (bool shouldUseWorkerThread)
 {
-    // Drive – coefficients are computed in the parameterChanged callback, therefore we need the lock
-    if (biquadParametersUpdated.load() && biquadParameterLock.tryEnter())
+    workerThreadMode.store (shouldUseWorkerThread);
+
+    auto& settingsManager = *jb::SettingsManager::getInstance();
+    settingsManager.writeSetting ("WorkerThreadMode", static_cast<int64_t> (shouldUseWorkerThread ? 1 : 0));
+}
+
+void OJDAudioProcessor::setFlightRecorderEnabled (bool shouldRecord)
+{
+    flightRecorderEnabled.store (shouldRecord);
+
+    if (shouldRecord)
+    {
+        startTimer (500);
+    }
+    else
     {
-        *chain.get<biquadPreDriveBoost>().state   = biquadPreDriveBoostCoeffs;
-        *chain.get<biquadPreDriveNotch>().state   = biquadPreDriveNotchCoeffs;
-        *chain.get<biquadPostDriveBoost1>().state = biquadPostDriveBoost1Coeffs;
-        *chain.get<biquadPostDriveBoost2>().state = biquadPostDriveBoost2Coeffs;
-        *chain.get<biquadPostDriveBoost3>().state = biquadPostDriveBoost3Coeffs;
-
-        biquadParametersUpdated.store (false);
-        biquadParameterLock.exit();
+        // The recorder is only released by the next prepare, a dump triggered until now is still written
+        stopTimer();
+        timerCallback();
     }
 
-    // Tone
-    chain.get<tone>().setHpLpMode (OJDParameters::Switches::HpLp::getModeFromRaw (rawValueHpLp));
-    chain.get<tone>().setTone     (OJDParameters::Sliders::normaliseRawValue (rawValueTone));
+    auto& settingsManager = *jb::SettingsManager::getInstance();
+    settingsManager.writeSetting ("FlightRecorder", static_cast<int64_t> (shouldRecord ? 1 : 0));
+}
+
+void OJDAudioProcessor::setLoadSheddingEnabled (bool shouldShedLoad)
+{
+    loadSheddingEnabled.store (shouldShedLoad);
 
-    // Volume
-    chain.get<volume>().setGainDecibels (OJDParameters::Sliders::Volume::dBValueFromRawValue (rawValueVolume));
+    auto& settingsManager = *jb::SettingsManager::getInstance();
+    settingsManager.writeSetting ("LoadShedding", static_cast<int64_t> (shouldShedLoad ? 1 : 0));
 }
 
-void OJDAudioProcessor::recalculateFilters()
+juce::File OJDAudioProcessor::getFlightRecordingDirectory()
 {
-    const auto sr = getSampleRate();
-    if (sr == 0.0)
+    return juce::File::getSpecialLocation (juce::File::userDocumentsDirectory).getChildFile ("OJD Flight Recordings");
+}
+
+void OJDAudioProcessor::timerCallback()
+{
+    if (! flightRecorder.isDumpPending())
         return;
 
-    const auto mode            = OJDParameters::Switches::HpLp::getModeFromRaw(rawValueHpLp);
-    const auto driveNormalised = OJDParameters::Sliders::normaliseRawValue (rawValueDrive);
-    const auto driveSquared = driveNormalised * driveNormalised;
+    auto directory = getFlightRecordingDirectory();
+    directory.createDirectory();
 
-    const auto biquadPreDriveBoostFreq = -1400.0f * driveSquared + 500.0f * driveNormalised + 1600.0f;
-    const auto biquadPreDriveBoostQ = -0.1f * driveNormalised + 0.15f;
-    const auto biquadPreDriveBoostGain = 32 * driveNormalised + 4;
+    const auto file = directory.getNonexistentChildFile ("OJD " + juce::Time::getCurrentTime().formatted ("%Y-%m-%d %H-%M-%S"), ".ojdrec", false);
 
-    const auto biquadPreDriveNotchFreq = 8e3f;
-    const auto biquadPreDriveNotchQ = 0.8f;
-    const auto biquadPreDriveNotchGain = -5.0f * driveSquared;
+    // Writing also ends the dump if the file can't be written, so that recording continues
+    juce::FileOutputStream stream (file);
+    flightRecorder.writeDump (stream);
+}
 
-    const auto biquadPostDriveBoost1Freq = mode == ToneStack::Mode::hp ? 2052.0f : 2781.0f;
-    const auto biquadPostDriveBoost1Q = 0.5f;
-    const auto biquadPostDriveBoost1Gain = mode == ToneStack::Mode::hp ? 4.6f : 4.38f;
+ChainParameters OJDAudioProcessor::getChainParametersFromRawValues() const
+{
+    return OJDParameters::toChainParameters (rawValueDrive, rawValueTone, rawValueVolume, rawValueHpLp);
+}
 
-    const auto biquadPostDriveBoost2Freq = 74.0f;
-    const auto biquadPostDriveBoost2Q = 0.2f;
-    const auto biquadPostDriveBoost2Gain = 7.38f * driveNormalised + 8.12f;
+void OJDAudioProcessor::publishSnapshot (const ChainParameters& snapshot, double morphTimeInSeconds)
+{
+    {
+        juce::SpinLock::ScopedLockType scopedLock (snapshotLock);
 
-    const auto biquadPostDriveBoost3Freq = 2935.0f;
-    const auto biquadPostDriveBoost3Q = 0.1f;
-    const auto biquadPostDriveBoost3Gain = mode == ToneStack::Mode::hp ? 10.0f : 16.9f;
+        pendingSnapshot = snapshot;
+        pendingSnapshotMorphTime = morphTimeInSeconds;
+    }
+
+    snapshotPending.store (true);
+}
 
-    // Entering the lock just before the allocating operation
+double OJDAudioProcessor::updateParameterMorphTarget()
+{
+    // A published snapshot always wins over the individual raw values, which might only be partly updated yet
+    if (snapshotPending.load() && snapshotLock.tryEnter())
     {
-        juce::SpinLock::ScopedLockType scopedLock(biquadParameterLock);
+        const auto snapshot  = pendingSnapshot;
+        const auto morphTime = pendingSnapshotMorphTime;
 
-        // to avoid extremely long lines below
-#define CREATE_BIQUAD_COEFFICIENTS(stage) stage##Coeffs = BiquadCoeffs::makePeakFilter (sr, stage##Freq, stage##Q, juce::Decibels::decibelsToGain (stage##Gain))
+        snapshotPending.store (false);
+        snapshotLock.exit();
 
-        CREATE_BIQUAD_COEFFICIENTS (biquadPreDriveBoost);
-        CREATE_BIQUAD_COEFFICIENTS (biquadPreDriveNotch);
-        CREATE_BIQUAD_COEFFICIENTS (biquadPostDriveBoost1);
-        CREATE_BIQUAD_COEFFICIENTS (biquadPostDriveBoost2);
-        CREATE_BIQUAD_COEFFICIENTS (biquadPostDriveBoost3);
+        core.setChainParameters (snapshot, morphTime);
+        isPresetMorphActive = core.isMorphing();
+        return morphTime;
     }
 
-    biquadParametersUpdated.store(true);
+    // Automation and GUI changes are ignored until a preset morph has finished. The target stays the same, so the
+    // morph time doesn't matter
+    if (isPresetMorphActive)
+    {
+        if (core.isMorphing())
+            return 0.0;
+
+        isPresetMorphActive = false;
+    }
+
+    core.setChainParameters (getChainParametersFromRawValues(), OJDCore::defaultSmoothingTime);
+    return OJDCore::defaultSmoothingTime;
 }
 
-void OJDAudioProcessor::parameterChanged (const juce::String& parameterID, float)
+void OJDAudioProcessor::valueTreeRedirected (juce::ValueTree& treeWhichHasBeenChanged)
 {
-    jassert (parameterID == OJDParameters::Sliders::Drive::id || parameterID == OJDParameters::Switches::HpLp::id);
-    juce::ignoreUnused (parameterID);
+    // The tree is read directly, as the parameters might not have been updated from the new tree yet
+    auto rawValueFromTree = [&] (const juce::String& id, const std::atomic<float>& currentValue)
+    {
+        auto child = treeWhichHasBeenChanged.getChildWithProperty ("id", id);
+        return child.isValid() ? static_cast<float> (child.getProperty ("value", currentValue.load())) : currentValue.load();
+    };
+
+    const auto snapshot = OJDParameters::toChainParameters (rawValueFromTree (OJDParameters::Sliders::Drive::id,   rawValueDrive),
+                                                            rawValueFromTree (OJDParameters::Sliders::Tone::id,    rawValueTone),
+                                                            rawValueFromTree (OJDParameters::Sliders::Volume::id,  rawValueVolume),
+                                                            rawValueFromTree (OJDParameters::Switches::HpLp::id,   rawValueHpLp));
+
+    // A restored session state is applied instantly, only recalled presets are morphed
+    publishSnapshot (snapshot, isRestoringState.load() ? 0.0 : presetMorphTime.load());
+
+    updateCabinetFromState();
+}
+
+void OJDAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
+{
+    OJDBinaryState::write (parameters, destData);
+}
+
+void OJDAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    isRestoringState.store (true);
+
+    if (OJDBinaryState::isBinaryState (data, sizeInBytes))
+    {
+        // A damaged or newer state is ignored as a whole, the plugin keeps its current settings
+        if (! OJDBinaryState::read (parameters, data, sizeInBytes))
+        {
+            DBG ("Ignoring a plugin state that is damaged or was saved by a newer version");
+            isRestoringState.store (false);
+            return;
+        }
+    }
+    else
+    {
+        jb::PluginAudioProcessorBase<OJDParameters>::setStateInformation (data, sizeInBytes);
+    }
+
+    isRestoringState.store (false);
+
+    // The binary format sets the parameters directly, the complete set is published once after all have been set
+    publishSnapshot (getChainParametersFromRawValues(), 0.0);
 
-    recalculateFilters();
+    updateCabinetFromState();
 }
 
 //==============================================================================
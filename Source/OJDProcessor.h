@@ -25,18 +25,25 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include <juce_dsp/juce_dsp.h>
 #include <jb_plugin_base/jb_plugin_base.h>
 #include "OJDParameters.h"
-#include "ToneStack.h"
-#include "Waveshaper.h"
+#include "OJDCore.h"
+#include "CabinetConvolution.h"
+#include "ChainMeter.h"
+#include "WorkerThreadProcessor.h"
+#include "FlightRecorder.h"
+#include "LoadShedder.h"
 
 class OJDAudioProcessor
   : public jb::PluginAudioProcessorBase<OJDParameters>,
-    public juce::AudioProcessorValueTreeState::Listener
+    private juce::ValueTree::Listener,
+    private juce::Timer
 {
 public:
 
     //==============================================================================
     OJDAudioProcessor();
 
+    ~OJDAudioProcessor() override;
+
     //==============================================================================
     void prepareResources (bool sampleRateChanged, bool maxBlockSizeChanged, bool numChannelsChanged) override;
 
@@ -44,7 +51,11 @@ public:
 
     void processBlock (juce::dsp::AudioBlock<float>& block) override;
 
-    void parameterChanged (const juce::String &parameterID, float newValue) override;
+    /** Stores the state in the compact binary format described in OJDBinaryState */
+    void getStateInformation (juce::MemoryBlock& destData) override;
+
+    /** Restores binary states as well as XML states written by older versions */
+    void setStateInformation (const void* data, int sizeInBytes) override;
 
     juce::AudioProcessorEditor* createEditor() override;
 
@@ -54,8 +65,73 @@ public:
      */
     std::unique_ptr<jb::MessageOfTheDay::InfoAndUpdate> getMessageOfTheDay (int timeoutMilliseconds);
 
+    /**
+     * Sets the time it takes to morph from the current parameters to those of a newly recalled preset. The value is
+     * stored as global setting and used by all instances created afterwards.
+     */
+    void setPresetMorphTime (double timeInSeconds);
+
+    double getPresetMorphTime() const { return presetMorphTime.load(); }
+
+    /**
+     * Returns the number of bytes of filter state memory the signal chain of this instance uses. Scratch buffers are
+     * not included, they are borrowed from the ScratchPool shared by all instances.
+     */
+    size_t getDSPMemoryFootprint() const { return core.getDSPMemoryFootprint(); }
+
+    /**
+     * Enables processing on a worker thread, see WorkerThreadProcessor, at the cost of one block of extra latency. The
+     * value is stored as global setting and takes effect the next time an instance is prepared by the host.
+     */
+    void setWorkerThreadMode (bool shouldUseWorkerThread);
+
+    bool isWorkerThreadModeEnabled() const { return workerThreadMode.load(); }
+
+    /**
+     * Loads a cabinet impulse response from an audio file in the background and stores its path in the plugin state.
+     * An empty file disables the cabinet stage. Must be called on the message thread.
+     */
+    void setCabinetImpulseResponse (const juce::File& file);
+
+    /** Returns the file of the cabinet impulse response stored in the state or an empty file if there is none */
+    juce::File getCabinetImpulseResponse() const;
+
+    /**
+     * Enables the FlightRecorder, which keeps the last flightRecorderHistory seconds of input and parameters and writes
+     * them to getFlightRecordingDirectory when requested or when a block misses its deadline. The value is stored as
+     * global setting and takes effect the next time an instance is prepared by the host.
+     */
+    void setFlightRecorderEnabled (bool shouldRecord);
+
+    bool isFlightRecorderEnabled() const { return flightRecorderEnabled.load(); }
+
+    /**
+     * Enables load shedding: When processing a block takes too long compared to its duration, the chain steps down its
+     * quality, see LoadShedder and OJDCore::setQualityLevel, and steps up again once the load allows it. The current
+     * level is shown by the ChainMeter and stored by the FlightRecorder. The value is stored as global setting and
+     * takes effect right away.
+     */
+    void setLoadSheddingEnabled (bool shouldShedLoad);
+
+    bool isLoadSheddingEnabled() const { return loadSheddingEnabled.load(); }
+
+    /** Writes the recorded history to a new file in getFlightRecordingDirectory within the next second */
+    void dumpFlightRecording() { flightRecorder.requestDump(); }
+
+    static juce::File getFlightRecordingDirectory();
+
+    /** The levels and waveshaper activity of the chain, read by the editor */
+    ChainMeter& getChainMeter() { return chainMeter; }
+
+    /** Returns the parameters the signal chain is using or moving to. Only safe to call from the audio thread */
+    const ChainParameters& getTargetChainParameters() const { return core.getTargetChainParameters(); }
+
 private:
+    // The supported layouts are mono and stereo, all stages are prepared for the maximum
+    static constexpr int maxNumChannels = 2;
+
     int numChannels = 1;
+    bool isPrepared = false;
 
     // References to all raw parameter values
     const std::atomic<float>& rawValueDrive;
@@ -63,45 +139,66 @@ private:
     const std::atomic<float>& rawValueVolume;
     const std::atomic<float>& rawValueHpLp;
 
-    // Signal path
-    enum SignalPath
-    {
-        hpf30,
-        biquadPreDriveBoost,   // dependent on Drive setting
-        biquadPreDriveNotch,   // dependent on Drive setting
-        preWaveshaperGain,
-        waveshaper,
-        biquadPostDriveBoost1, // dependent on HP/LP
-        biquadPostDriveBoost2, // dependent on Drive setting
-        biquadPostDriveBoost3, // dependent on HP/LP
-        lpf6_3k,
-        tone,
-        volume
-    };
-
-    using HPF    = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>>;
-    using LPF    = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>>;
-    using Biquad = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>>;
-    using Gain   = juce::dsp::Gain<float>;
-
-    juce::dsp::ProcessorChain<HPF, Biquad, Biquad, Gain, Waveshaper, Biquad, Biquad, Biquad, LPF, ToneStack, Gain> chain;
-
-    // This lock is held for a short time when the drive changes & biquad coefficients are exchanged
-    juce::SpinLock biquadParameterLock;
-    std::atomic<bool> biquadParametersUpdated { false };
-
-    std::array<float, 6> biquadPreDriveBoostCoeffs;
-    std::array<float, 6> biquadPreDriveNotchCoeffs;
-    std::array<float, 6> biquadPostDriveBoost1Coeffs;
-    std::array<float, 6> biquadPostDriveBoost2Coeffs;
-    std::array<float, 6> biquadPostDriveBoost3Coeffs;
+    // The signal chain itself, this class only connects it to the plugin parameters and state
+    OJDCore core;
+
+    // Follows the chain if an impulse response is loaded
+    CabinetConvolution cabinet;
+
+    // Measures the input of the chain and the output after the cabinet
+    ChainMeter chainMeter;
+    juce::File loadedCabinetImpulseResponse;
+
+    static const juce::Identifier cabinetImpulseResponseId;
+
+    // Runs the chain on a worker thread if the worker thread mode was enabled when the instance was prepared. Declared
+    // after the chain, so that it stops calling into it before the chain is destroyed
+    std::atomic<bool> workerThreadMode { false };
+    std::unique_ptr<WorkerThreadProcessor> workerThreadProcessor;
+
+    // Records on the thread that runs the chain, the timer writes pending dumps on the message thread
+    static constexpr double flightRecorderHistory = 10.0;
+    std::atomic<bool> flightRecorderEnabled { false };
+    FlightRecorder flightRecorder;
+
+    // Only used by the thread that runs the chain
+    std::atomic<bool> loadSheddingEnabled { false };
+    LoadShedder loadShedder;
+
+    bool isPresetMorphActive = false;
+
+    // A complete parameter set published by a preset recall or a state restore. The lock is only held for copying
+    // the snapshot, the audio thread just tries to enter it and picks it up in one of the next blocks if it fails
+    juce::SpinLock snapshotLock;
+    std::atomic<bool> snapshotPending { false };
+    ChainParameters pendingSnapshot;
+    double pendingSnapshotMorphTime = 0.0;
+
+    std::atomic<double> presetMorphTime { 0.1 };
+
+    // Set while a state is restored, a restored state is applied without morphing
+    std::atomic<bool> isRestoringState { false };
 
     jb::MessageOfTheDay messageOfTheDay { juce::URL ("https://schrammel.io/motd/ojd.json"), JucePlugin_VersionCode };
     std::future<jb::MessageOfTheDay::InfoAndUpdate> infoAndUpdateMessage;
 
     void checkForMessageOfTheDay();
-    void recalculateFilters();
-    void updateParametersForProcessorChain();
+
+    ChainParameters getChainParametersFromRawValues() const;
+    void publishSnapshot (const ChainParameters& snapshot, double morphTimeInSeconds);
+
+    /** Sets the target of the chain for the next block and returns the morph time it was set with */
+    double updateParameterMorphTarget();
+
+    /** Processes the block through the complete chain, either on the audio thread or on the worker thread */
+    void processChain (const juce::dsp::AudioBlock<float>& block);
+
+    /** Loads the impulse response stored in the state if it differs from the loaded one */
+    void updateCabinetFromState();
+
+    void valueTreeRedirected (juce::ValueTree& treeWhichHasBeenChanged) override;
+
+    void timerCallback() override;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OJDAudioProcessor)
 };
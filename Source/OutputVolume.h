@@ -0,0 +1,113 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+
+/**
+ * The linearly ramped output gain at the end of the chain. It doesn't process any audio itself, the last filter
+ * cascade applies the gain of each sample while writing its output, so the volume costs no extra pass over the block.
+ */
+class OutputVolume
+{
+public:
+    /** The gains for one block, calling it with a sample index returns the gain of that sample */
+    struct Ramp
+    {
+        float start;
+        float step;
+        float target;
+        size_t numRampSamples;
+
+        float operator() (size_t i) const { return i < numRampSamples ? start + step * static_cast<float> (i + 1) : target; }
+    };
+
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        sampleRate = spec.sampleRate;
+        reset();
+    }
+
+    /** Jumps to the target gain */
+    void reset()
+    {
+        current = target;
+        numStepsRemaining = 0;
+    }
+
+    void setRampDurationSeconds (double newRampDurationSeconds)
+    {
+        if (rampDurationSeconds != newRampDurationSeconds)
+        {
+            rampDurationSeconds = newRampDurationSeconds;
+            reset();
+        }
+    }
+
+    void setGainDecibels (float newGainDecibels)
+    {
+        const auto newTarget = juce::Decibels::decibelsToGain (newGainDecibels);
+
+        if (newTarget == target)
+            return;
+
+        target = newTarget;
+
+        const auto rampLength = static_cast<size_t> (juce::roundToInt (rampDurationSeconds * sampleRate));
+
+        if (rampLength == 0)
+        {
+            reset();
+            return;
+        }
+
+        step = (target - current) / static_cast<float> (rampLength);
+        numStepsRemaining = rampLength;
+    }
+
+    /** Returns the gains for the next numSamples samples and advances the ramp by that amount */
+    Ramp getNextRamp (size_t numSamples)
+    {
+        Ramp ramp { current, step, target, juce::jmin (numSamples, numStepsRemaining) };
+
+        if (numStepsRemaining > numSamples)
+        {
+            current += step * static_cast<float> (numSamples);
+            numStepsRemaining -= numSamples;
+        }
+        else
+        {
+            reset();
+        }
+
+        return ramp;
+    }
+
+private:
+    double sampleRate = 0.0;
+    double rampDurationSeconds = 0.0;
+
+    float current = 1.0f;
+    float target  = 1.0f;
+    float step    = 0.0f;
+    size_t numStepsRemaining = 0;
+};
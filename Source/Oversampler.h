@@ -0,0 +1,327 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include <complex>
+#include "DSPArena.h"
+#include "ScratchPool.h"
+#include "ChannelCount.h"
+
+/**
+ * A cascade of 2x polyphase IIR half band oversampling stages, designed and processed exactly like
+ * juce::dsp::Oversampling with filterHalfBandPolyphaseIIR at maximum quality. The difference is where the memory
+ * lives: The small allpass states are kept in the DSPArena of the instance, while the oversampled buffers are only
+ * borrowed from the ScratchPool for the duration of a process call.
+ */
+class Oversampler
+{
+public:
+    /** Designs the filters for the given number of 2x stages, e.g. 4 for 16x oversampling */
+    explicit Oversampler (size_t order)
+    {
+        jassert (order <= maxOrder);
+
+        for (size_t n = 0; n < order; ++n)
+        {
+            // Same design constraints as used by juce::dsp::Oversampling for maximum quality
+            const auto nf = static_cast<float> (n);
+
+            const auto transitionWidthUp   = 0.10f * (n == 0 ? 0.5f : 1.0f);
+            const auto transitionWidthDown = 0.12f * (n == 0 ? 0.5f : 1.0f);
+
+            stages.push_back ({ Path::design (transitionWidthUp,   -75.0f + 10.0f * nf),
+                                Path::design (transitionWidthDown, -70.0f + 10.0f * nf) });
+        }
+    }
+
+    /** Requests the filter state memory for all stages from the arena and the scratch memory from the ScratchPool */
+    void prepare (const juce::dsp::ProcessSpec& spec, DSPArena& arena)
+    {
+        numChannels = spec.numChannels;
+
+        scratchSize = 0;
+        auto numSamples = static_cast<size_t> (spec.maximumBlockSize);
+
+        for (auto& stage : stages)
+        {
+            stage.stateUp   = arena.allocate<float> (numChannels * stage.up.alpha.size());
+            stage.stateDown = arena.allocate<float> (numChannels * (stage.down.alpha.size() + 1));
+
+            numSamples *= 2;
+            scratchSize += ScratchPool::getAllocationSize<float> (numSamples);
+        }
+
+        // The channels are processed one after another, so one channel worth of buffers is enough
+        ScratchPool::reserve (scratchSize);
+    }
+
+    /** The number of bytes borrowed from the ScratchPool during process */
+    size_t getScratchSize() const { return scratchSize; }
+
+    void reset()
+    {
+        for (auto& stage : stages)
+        {
+            if (stage.stateUp != nullptr)
+                std::fill (stage.stateUp, stage.stateUp + numChannels * stage.up.alpha.size(), 0.0f);
+
+            if (stage.stateDown != nullptr)
+                std::fill (stage.stateDown, stage.stateDown + numChannels * (stage.down.alpha.size() + 1), 0.0f);
+        }
+    }
+
+    /** Copies the filter states of one channel to another one */
+    void copyChannelState (size_t source, size_t destination)
+    {
+        for (auto& stage : stages)
+        {
+            copyState (stage.stateUp,   stage.up.alpha.size(),       source, destination);
+            copyState (stage.stateDown, stage.down.alpha.size() + 1, source, destination);
+        }
+    }
+
+    /** Returns the largest absolute difference between the filter states of two channels */
+    float getChannelStateDifference (size_t a, size_t b) const
+    {
+        auto difference = 0.0f;
+
+        for (auto& stage : stages)
+        {
+            difference = juce::jmax (difference, stateDifference (stage.stateUp,   stage.up.alpha.size(),       a, b));
+            difference = juce::jmax (difference, stateDifference (stage.stateDown, stage.down.alpha.size() + 1, a, b));
+        }
+
+        return difference;
+    }
+
+    size_t getOversamplingFactor() const { return size_t (1) << stages.size(); }
+
+    /** The oversampled buffers passed to the process callback hold the samples of a single channel */
+    size_t getNumInterleavedChannels() const { return 1; }
+
+    /** Each channel is processed on its own */
+    size_t getNumActiveLanes (size_t) const { return 1; }
+
+    /** Returns the latency of up and downsampling in samples at the original rate */
+    float getLatencyInSamples() const
+    {
+        auto latency = 0.0f;
+        auto factor  = 1.0f;
+
+        for (auto& stage : stages)
+        {
+            factor *= 2.0f;
+            latency += (stage.up.latency + stage.down.latency) / factor;
+        }
+
+        return latency;
+    }
+
+    /**
+     * Upsamples each channel of the block, calls processOversampled with a pointer to the oversampled samples and
+     * their number and finally samples the result back down into the block.
+     */
+    template <size_t numBlockChannels = ChannelCount::dynamic, typename ProcessOversampledFn>
+    void process (const juce::dsp::AudioBlock<float>& block, ProcessOversampledFn&& processOversampled)
+    {
+        ScratchPool::Scope scratch;
+
+        const auto numSamples = block.getNumSamples();
+        std::array<float*, maxOrder> buffers;
+
+        auto stageNumSamples = numSamples;
+        for (size_t s = 0; s < stages.size(); ++s)
+        {
+            stageNumSamples *= 2;
+            buffers[s] = scratch.allocate<float> (stageNumSamples);
+        }
+
+        if (scratch.hasFailed())
+            return;
+
+        for (size_t ch = 0; ch < ChannelCount::of<numBlockChannels> (block); ++ch)
+        {
+            auto* channel = block.getChannelPointer (ch);
+
+            const float* input = channel;
+            stageNumSamples = numSamples;
+
+            for (size_t s = 0; s < stages.size(); ++s)
+            {
+                auto& stage = stages[s];
+                stage.up.upsample (input, buffers[s], stageNumSamples, stage.stateUp + ch * stage.up.alpha.size());
+
+                input = buffers[s];
+                stageNumSamples *= 2;
+            }
+
+            // Without any stages, the channel itself is processed
+            processOversampled (stages.empty() ? channel : buffers[stages.size() - 1], stageNumSamples);
+
+            for (auto s = stages.size(); s-- > 0;)
+            {
+                auto& stage = stages[s];
+                stageNumSamples /= 2;
+
+                auto* output = s > 0 ? buffers[s - 1] : channel;
+                stage.down.downsample (buffers[s], output, stageNumSamples, stage.stateDown + ch * (stage.down.alpha.size() + 1));
+            }
+        }
+    }
+
+    static constexpr size_t maxOrder = 8;
+
+    /**
+     * One polyphase half band filter, realised as a direct and a delayed path of cascaded first order allpasses. The
+     * design and latency computation are shared with the LaneOversampler.
+     */
+    struct Path
+    {
+        std::vector<float> alpha;
+        size_t numDirect = 0;
+        float latency = 0.0f;
+
+        static Path design (float normalisedTransitionWidth, float stopbandAmplitudedB)
+        {
+            auto structure = juce::dsp::FilterDesign<float>::designIIRLowpassHalfBandPolyphaseAllpassMethod (normalisedTransitionWidth, stopbandAmplitudedB);
+
+            Path path;
+
+            for (int i = 0; i < structure.directPath.size(); ++i)
+                path.alpha.push_back (structure.directPath.getObjectPointer (i)->coefficients[0]);
+
+            path.numDirect = path.alpha.size();
+
+            // The first element of the delayed path is the delay itself
+            for (int i = 1; i < structure.delayedPath.size(); ++i)
+                path.alpha.push_back (structure.delayedPath.getObjectPointer (i)->coefficients[0]);
+
+            path.latency = path.computeLatency();
+            return path;
+        }
+
+        /** Each polyphase allpass section, running at the lower rate */
+        static inline float allpass (float input, float a, float& state)
+        {
+            const auto output = a * input + state;
+            state = input - a * output;
+            return output;
+        }
+
+        void upsample (const float* input, float* output, size_t numSamples, float* state) const
+        {
+            const auto* a = alpha.data();
+            const auto numSections = alpha.size();
+
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                auto direct = input[i];
+                for (size_t n = 0; n < numDirect; ++n)
+                    direct = allpass (direct, a[n], state[n]);
+
+                auto delayed = input[i];
+                for (size_t n = numDirect; n < numSections; ++n)
+                    delayed = allpass (delayed, a[n], state[n]);
+
+                output[i << 1]       = direct;
+                output[(i << 1) + 1] = delayed;
+            }
+
+            for (size_t n = 0; n < numSections; ++n)
+                juce::dsp::util::snapToZero (state[n]);
+        }
+
+        void downsample (const float* input, float* output, size_t numSamples, float* state) const
+        {
+            const auto* a = alpha.data();
+            const auto numSections = alpha.size();
+
+            // The last state element holds the one sample delay of the delayed path
+            auto& delay = state[numSections];
+
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                auto direct = input[i << 1];
+                for (size_t n = 0; n < numDirect; ++n)
+                    direct = allpass (direct, a[n], state[n]);
+
+                auto delayed = input[(i << 1) + 1];
+                for (size_t n = numDirect; n < numSections; ++n)
+                    delayed = allpass (delayed, a[n], state[n]);
+
+                output[i] = (delay + direct) * 0.5f;
+                delay = delayed;
+            }
+
+            for (size_t n = 0; n <= numSections; ++n)
+                juce::dsp::util::snapToZero (state[n]);
+        }
+
+        /** The phase delay at a very low frequency, in samples at the higher rate */
+        float computeLatency() const
+        {
+            const auto w = 0.0001 * juce::MathConstants<double>::twoPi;
+            const auto zInv2 = std::polar (1.0, -2.0 * w);
+
+            std::complex<double> direct (1.0), delayed = std::polar (1.0, -w);
+
+            for (size_t n = 0; n < alpha.size(); ++n)
+            {
+                const auto a = static_cast<double> (alpha[n]);
+                (n < numDirect ? direct : delayed) *= (a + zInv2) / (1.0 + a * zInv2);
+            }
+
+            return static_cast<float> (-std::arg (direct + delayed) / w);
+        }
+    };
+
+private:
+    struct Stage
+    {
+        Path up, down;
+
+        float* stateUp   = nullptr;
+        float* stateDown = nullptr;
+    };
+
+    static void copyState (float* state, size_t numPerChannel, size_t source, size_t destination)
+    {
+        if (state != nullptr)
+            std::copy (state + source * numPerChannel, state + (source + 1) * numPerChannel, state + destination * numPerChannel);
+    }
+
+    static float stateDifference (const float* state, size_t numPerChannel, size_t a, size_t b)
+    {
+        auto difference = 0.0f;
+
+        if (state != nullptr)
+            for (size_t i = 0; i < numPerChannel; ++i)
+                difference = juce::jmax (difference, std::abs (state[a * numPerChannel + i] - state[b * numPerChannel + i]));
+
+        return difference;
+    }
+
+    std::vector<Stage> stages;
+    size_t numChannels = 0;
+    size_t scratchSize = 0;
+};
@@ -0,0 +1,115 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+/** The complete set of values the signal chain depends on, already mapped to the ranges the chain works with */
+struct ChainParameters
+{
+    /** Normalised 0 to 1 drive */
+    float drive = 0.0f;
+
+    /** Normalised 0 to 1 tone */
+    float tone = 0.0f;
+
+    /** Output volume in dB */
+    float volumeDb = 0.0f;
+
+    /** 0 in LP mode, 1 in HP mode. Values in between are only used while morphing between both modes */
+    float hpAmount = 0.0f;
+
+    bool operator== (const ChainParameters& other) const
+    {
+        return drive == other.drive && tone == other.tone && volumeDb == other.volumeDb && hpAmount == other.hpAmount;
+    }
+
+    bool operator!= (const ChainParameters& other) const { return ! (*this == other); }
+
+    /** Linear interpolation, alpha = 0 returns a, alpha = 1 returns b */
+    static ChainParameters interpolate (const ChainParameters& a, const ChainParameters& b, float alpha)
+    {
+        auto lerp = [alpha] (float x, float y) { return x + alpha * (y - x); };
+
+        return { lerp (a.drive, b.drive), lerp (a.tone, b.tone), lerp (a.volumeDb, b.volumeDb), lerp (a.hpAmount, b.hpAmount) };
+    }
+};
+
+/**
+ * Moves linearly from one set of chain parameters to another over a given time. Used on the audio thread, all
+ * functions are allocation and lock free.
+ */
+class ParameterMorph
+{
+public:
+    void prepare (double newSampleRate) { sampleRate = newSampleRate; }
+
+    /** Sets the parameters without morphing */
+    void jumpTo (const ChainParameters& newParameters)
+    {
+        start = current = target = newParameters;
+        numSamplesTotal = numSamplesRemaining = 0;
+    }
+
+    /** Starts morphing from the current parameters to the new target. A time of zero jumps to the target directly */
+    void morphTo (const ChainParameters& newTarget, double timeInSeconds)
+    {
+        const auto numSamples = juce::roundToInt (timeInSeconds * sampleRate);
+
+        if (numSamples <= 0)
+        {
+            jumpTo (newTarget);
+            return;
+        }
+
+        start  = current;
+        target = newTarget;
+        numSamplesTotal = numSamplesRemaining = numSamples;
+    }
+
+    bool isMorphing() const { return numSamplesRemaining > 0; }
+
+    const ChainParameters& getCurrent() const { return current; }
+    const ChainParameters& getTarget()  const { return target; }
+
+    /** Moves forward by the number of samples and returns the parameters reached at the end of that range */
+    const ChainParameters& advance (int numSamples)
+    {
+        if (! isMorphing())
+            return current;
+
+        numSamplesRemaining = juce::jmax (0, numSamplesRemaining - numSamples);
+
+        const auto alpha = 1.0f - static_cast<float> (numSamplesRemaining) / static_cast<float> (numSamplesTotal);
+        current = numSamplesRemaining == 0 ? target : ChainParameters::interpolate (start, target, alpha);
+
+        return current;
+    }
+
+private:
+    double sampleRate = 44100.0;
+
+    ChainParameters start, current, target;
+
+    int numSamplesTotal = 0;
+    int numSamplesRemaining = 0;
+};
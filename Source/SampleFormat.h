@@ -0,0 +1,134 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+
+/** The sample formats of interleaved buffers the core can read and write */
+enum class SampleFormat
+{
+    float32,
+
+    /** Signed 16 bit integers in native byte order */
+    int16,
+
+    /** Signed 24 bit integers packed into 3 bytes, little endian */
+    int24
+};
+
+/**
+ * Reading and writing single samples of an interleaved buffer in a given format. Integer formats are scaled to and
+ * from the -1 to 1 float range, written values are clipped to the range of the format.
+ */
+template <SampleFormat format>
+struct InterleavedSamples;
+
+template <>
+struct InterleavedSamples<SampleFormat::float32>
+{
+    static constexpr size_t numBytes = 4;
+    static constexpr float scale = 1.0f;
+
+    static inline float read (const char* data, size_t index)
+    {
+        return reinterpret_cast<const float*> (data)[index];
+    }
+
+    /** Takes a value that has already been scaled and clipped */
+    static inline void write (char* data, size_t index, float scaledValue)
+    {
+        reinterpret_cast<float*> (data)[index] = scaledValue;
+    }
+
+    static constexpr bool needsClipping = false;
+};
+
+template <>
+struct InterleavedSamples<SampleFormat::int16>
+{
+    static constexpr size_t numBytes = 2;
+    static constexpr float scale = 32767.0f;
+
+    static inline float read (const char* data, size_t index)
+    {
+        return static_cast<float> (reinterpret_cast<const int16_t*> (data)[index]) * (1.0f / 32768.0f);
+    }
+
+    static inline void write (char* data, size_t index, float scaledValue)
+    {
+        reinterpret_cast<int16_t*> (data)[index] = static_cast<int16_t> (juce::roundToInt (scaledValue));
+    }
+
+    static constexpr bool needsClipping = true;
+};
+
+template <>
+struct InterleavedSamples<SampleFormat::int24>
+{
+    static constexpr size_t numBytes = 3;
+    static constexpr float scale = 8388607.0f;
+
+    static inline float read (const char* data, size_t index)
+    {
+        return static_cast<float> (juce::ByteOrder::littleEndian24Bit (data + 3 * index)) * (1.0f / 8388608.0f);
+    }
+
+    static inline void write (char* data, size_t index, float scaledValue)
+    {
+        juce::ByteOrder::littleEndian24BitToChars (juce::roundToInt (scaledValue), data + 3 * index);
+    }
+
+    static constexpr bool needsClipping = true;
+};
+
+/** Scales a sample in the -1 to 1 range to the format, clips it if needed and writes it to the given index */
+template <typename Samples>
+inline void writeNormalisedSample (char* data, size_t index, float value)
+{
+    const auto scaled = value * Samples::scale;
+    Samples::write (data, index, Samples::needsClipping ? juce::jlimit (-Samples::scale, Samples::scale, scaled) : scaled);
+}
+
+/** Returns the number of bytes one sample of the format takes */
+inline size_t getNumBytesPerSample (SampleFormat format)
+{
+    switch (format)
+    {
+        case SampleFormat::int16: return InterleavedSamples<SampleFormat::int16>::numBytes;
+        case SampleFormat::int24: return InterleavedSamples<SampleFormat::int24>::numBytes;
+        case SampleFormat::float32:
+        default:                  return InterleavedSamples<SampleFormat::float32>::numBytes;
+    }
+}
+
+/** Calls fn with an InterleavedSamples instance matching the runtime format, to select a template specialisation */
+template <typename Fn>
+void withInterleavedSamples (SampleFormat format, Fn&& fn)
+{
+    switch (format)
+    {
+        case SampleFormat::int16:   fn (InterleavedSamples<SampleFormat::int16>());   break;
+        case SampleFormat::int24:   fn (InterleavedSamples<SampleFormat::int24>());   break;
+        case SampleFormat::float32:
+        default:                    fn (InterleavedSamples<SampleFormat::float32>()); break;
+    }
+}
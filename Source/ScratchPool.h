@@ -0,0 +1,238 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <mutex>
+#include <thread>
+
+/**
+ * Scratch memory shared by all instances. A thread only processes one instance at a time, so there is no need for
+ * every instance to own e.g. its own oversampled buffers. The overall scratch memory then scales with the number of
+ * CPUs instead of the number of instances.
+ *
+ * Instances announce the size they need while preparing via reserve, which allocates all pools right away, two per
+ * logical CPU. The outermost Scope on a thread claims a free pool without locking and hands it back when it ends,
+ * nested scopes use the same pool. Processing never allocates. If no pool is free or a scope would exceed the reserved
+ * size, the scope has failed, stages skip their processing and the entry points that opened it output silence for that
+ * block.
+ */
+class ScratchPool
+{
+    struct Pool;
+
+public:
+    static constexpr size_t alignment = 64;
+
+    /**
+     * Makes sure that every pool can hand out at least the given number of bytes within one Scope. Allocates, so it
+     * must not be called on the audio thread. Pools that are in use are grown once their scope has ended.
+     */
+    static void reserve (size_t numBytes)
+    {
+        auto& registry = getRegistry();
+        const std::lock_guard<std::mutex> lock (registry.mutex);
+
+        registry.requiredSize = juce::jmax (registry.requiredSize, numBytes);
+
+        const auto numPools = juce::jmin (maxNumPools, static_cast<size_t> (2 * juce::SystemStats::getNumCpus()));
+
+        for (size_t i = 0; i < numPools; ++i)
+        {
+            auto& pool = registry.pools[i];
+
+            // The pool of a scope that is open on this thread can't be waited for, scopes skip pools that are too small
+            if (&pool == currentPool())
+                continue;
+
+            while (pool.inUse.exchange (true, std::memory_order_acquire))
+                std::this_thread::yield();
+
+            pool.ensureSize (registry.requiredSize);
+            pool.inUse.store (false, std::memory_order_release);
+        }
+
+        registry.numPools.store (juce::jmax (numPools, registry.numPools.load()), std::memory_order_release);
+        registry.claimableSize.store (registry.requiredSize, std::memory_order_release);
+    }
+
+    /** Returns the number of bytes a Scope uses for an allocation of the given number of elements */
+    template <typename T>
+    static size_t getAllocationSize (size_t numElements) { return alignUp (numElements * sizeof (T)); }
+
+    /**
+     * Borrows memory from a pool. All memory allocated through a scope is handed back when it is destroyed. Scopes can
+     * be nested, the memory of an inner scope follows the memory of the outer scope.
+     */
+    class Scope
+    {
+    public:
+        Scope() : isOutermost (currentPool() == nullptr),
+                  pool (isOutermost ? claim() : currentPool()),
+                  startOffset (pool != nullptr ? pool->offset : 0)
+        {
+            if (isOutermost)
+            {
+                currentPool() = pool;
+
+                if (pool != nullptr)
+                    pool->failed = false;
+            }
+        }
+
+        ~Scope()
+        {
+            if (pool == nullptr)
+                return;
+
+            pool->offset = startOffset;
+
+            if (isOutermost)
+            {
+                currentPool() = nullptr;
+                pool->inUse.store (false, std::memory_order_release);
+            }
+        }
+
+        /** False if no pool was free */
+        bool isValid() const noexcept { return pool != nullptr; }
+
+        /** True if no pool was free or any allocation of the outermost scope on this thread, nested ones included, failed */
+        bool hasFailed() const noexcept { return pool == nullptr || pool->failed; }
+
+        /**
+         * Returns cache line aligned, uninitialised memory for the given number of elements. Returns nullptr and marks
+         * the scope as failed if no pool was free or more memory would be used than reserved.
+         */
+        template <typename T>
+        T* allocate (size_t numElements)
+        {
+            const auto size = getAllocationSize<T> (numElements);
+
+            if (pool == nullptr)
+                return nullptr;
+
+            if (pool->offset + size > pool->capacity)
+            {
+                // A stage uses more memory than it reserved
+                jassertfalse;
+                pool->failed = true;
+                return nullptr;
+            }
+
+            auto* ptr = reinterpret_cast<T*> (pool->alignedMemory + pool->offset);
+            pool->offset += size;
+            return ptr;
+        }
+
+    private:
+        const bool isOutermost;
+        Pool* const pool;
+        const size_t startOffset;
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+
+private:
+    static constexpr size_t maxNumPools = 64;
+
+    struct Pool
+    {
+        juce::HeapBlock<char> memory;
+        char* alignedMemory = nullptr;
+        size_t capacity = 0;
+        size_t offset = 0;
+        std::atomic<bool> inUse { false };
+
+        // Only accessed by the thread that claimed the pool
+        bool failed = false;
+
+        void ensureSize (size_t required)
+        {
+            if (capacity >= required)
+                return;
+
+            // Over allocating to be able to start at a cache line boundary
+            memory.allocate (required + alignment - 1, false);
+            capacity = required;
+
+            const auto address = reinterpret_cast<uintptr_t> (memory.get());
+            alignedMemory = memory.get() + (alignUp (address) - address);
+        }
+    };
+
+    struct Registry
+    {
+        std::array<Pool, maxNumPools> pools;
+        std::atomic<size_t> numPools { 0 };
+
+        // All pools up to numPools hold at least this many bytes, except for one a scope was open on while reserving
+        std::atomic<size_t> claimableSize { 0 };
+
+        // Only accessed by reserve
+        std::mutex mutex;
+        size_t requiredSize = 0;
+    };
+
+    static Registry& getRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    static Pool*& currentPool()
+    {
+        thread_local Pool* pool = nullptr;
+        return pool;
+    }
+
+    /** Claims a free pool that is large enough, preferring the one this thread used last as its memory is likely cached */
+    static Pool* claim()
+    {
+        thread_local size_t lastIndex = 0;
+
+        auto& registry = getRegistry();
+        const auto numPools = registry.numPools.load (std::memory_order_acquire);
+        const auto requiredSize = registry.claimableSize.load (std::memory_order_acquire);
+
+        for (size_t n = 0; n < numPools; ++n)
+        {
+            const auto index = (lastIndex + n) % numPools;
+            auto& pool = registry.pools[index];
+
+            if (pool.inUse.exchange (true, std::memory_order_acquire))
+                continue;
+
+            if (pool.capacity >= requiredSize)
+            {
+                lastIndex = index;
+                return &pool;
+            }
+
+            pool.inUse.store (false, std::memory_order_release);
+        }
+
+        return nullptr;
+    }
+
+    static size_t alignUp (size_t value) { return (value + alignment - 1) & ~(alignment - 1); }
+};
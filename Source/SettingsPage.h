@@ -24,12 +24,16 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include <jb_plugin_base/jb_plugin_base.h>
 #include <Resvg4JUCE/Resvg4JUCE.h>
 #include <BinaryData.h>
+#include "OJDProcessor.h"
+#include "ChainMeterComponent.h"
 
 class SettingsPage : public juce::Component
 {
 public:
-    SettingsPage()
-      : housingBackside (BinaryData::backside_svg, BinaryData::backside_svgSize)
+    explicit SettingsPage (OJDAudioProcessor& processorToControl)
+      : processor (processorToControl),
+        chainMeter (processor.getChainMeter()),
+        housingBackside (BinaryData::backside_svg, BinaryData::backside_svgSize)
     {
         addAndMakeVisible (housingBackside);
         auto versionInfo = "Version: " + juce::String (JucePlugin_VersionString);
@@ -48,6 +52,58 @@ public:
         addAndMakeVisible (commitInfoLabel);
         addAndMakeVisible (buildDateLabel);
 
+        loadCabinetButton.onClick  = [this] { chooseCabinetImpulseResponse(); };
+        clearCabinetButton.onClick = [this]
+        {
+            processor.setCabinetImpulseResponse (juce::File());
+            updateCabinetLabel();
+        };
+
+        for (auto* button : { &loadCabinetButton, &clearCabinetButton })
+        {
+            button->setColour (juce::TextButton::ColourIds::buttonColourId, juce::Colours::transparentBlack);
+            addAndMakeVisible (button);
+        }
+
+        workerThreadToggle.setToggleState (processor.isWorkerThreadModeEnabled(), juce::dontSendNotification);
+        workerThreadToggle.onClick = [this] { processor.setWorkerThreadMode (workerThreadToggle.getToggleState()); };
+        addAndMakeVisible (workerThreadToggle);
+
+        loadSheddingToggle.setToggleState (processor.isLoadSheddingEnabled(), juce::dontSendNotification);
+        loadSheddingToggle.onClick = [this] { processor.setLoadSheddingEnabled (loadSheddingToggle.getToggleState()); };
+        addAndMakeVisible (loadSheddingToggle);
+
+        flightRecorderToggle.setToggleState (processor.isFlightRecorderEnabled(), juce::dontSendNotification);
+        flightRecorderToggle.onClick = [this] { processor.setFlightRecorderEnabled (flightRecorderToggle.getToggleState()); };
+        addAndMakeVisible (flightRecorderToggle);
+
+        presetMorphTimeLabel.setMinimumHorizontalScale (1.0f);
+        addAndMakeVisible (presetMorphTimeLabel);
+
+        presetMorphTimeSlider.setSliderStyle (juce::Slider::LinearHorizontal);
+        presetMorphTimeSlider.setTextBoxStyle (juce::Slider::TextBoxRight, false, 60, 20);
+        presetMorphTimeSlider.setRange (0.0, 1000.0, 10.0);
+        presetMorphTimeSlider.setTextValueSuffix (" ms");
+        presetMorphTimeSlider.setValue (1000.0 * processor.getPresetMorphTime(), juce::dontSendNotification);
+        presetMorphTimeSlider.onDragEnd     = [this] { processor.setPresetMorphTime (presetMorphTimeSlider.getValue() / 1000.0); };
+        presetMorphTimeSlider.onValueChange = [this]
+        {
+            // Dragging only stores the value once it is released, typed values and clicks are stored right away
+            if (presetMorphTimeSlider.getThumbBeingDragged() < 0)
+                processor.setPresetMorphTime (presetMorphTimeSlider.getValue() / 1000.0);
+        };
+        addAndMakeVisible (presetMorphTimeSlider);
+
+        dumpFlightRecordingButton.onClick = [this] { processor.dumpFlightRecording(); };
+        dumpFlightRecordingButton.setTooltip ("Writes the recording to " + OJDAudioProcessor::getFlightRecordingDirectory().getFullPathName());
+        dumpFlightRecordingButton.setColour (juce::TextButton::ColourIds::buttonColourId, juce::Colours::transparentBlack);
+        addAndMakeVisible (dumpFlightRecordingButton);
+
+        cabinetLabel.setMinimumHorizontalScale (1.0f);
+        addAndMakeVisible (cabinetLabel);
+        updateCabinetLabel();
+
+        addAndMakeVisible (chainMeter);
     }
 
     void resized() override
@@ -62,21 +118,96 @@ public:
         versionInfoLabel.setFont (versionInfoLabel.getFont().withHeight (fontHeight));
         commitInfoLabel.setFont  (commitInfoLabel.getFont().withHeight (fontHeight));
         buildDateLabel.setFont   (buildDateLabel.getFont().withHeight (fontHeight));
+        cabinetLabel.setFont     (cabinetLabel.getFont().withHeight (fontHeight));
+        presetMorphTimeLabel.setFont (presetMorphTimeLabel.getFont().withHeight (fontHeight));
 
-        versionInfoLabel.setBoundsRelative (0.2f, 0.73f, 0.8f, 0.05f);
-        commitInfoLabel.setBoundsRelative  (0.2f, 0.78f, 0.8f, 0.05f);
-        buildDateLabel.setBoundsRelative   (0.2f, 0.83f, 0.8f, 0.05f);
+        chainMeter.setFontHeight (fontHeight);
+        chainMeter.setBoundsRelative (0.2f, 0.38f, 0.6f, 0.18f);
+
+        cabinetLabel.setBoundsRelative       (0.2f,  0.58f, 0.8f,  0.05f);
+        loadCabinetButton.setBoundsRelative  (0.2f,  0.63f, 0.35f, 0.05f);
+        clearCabinetButton.setBoundsRelative (0.57f, 0.63f, 0.23f, 0.05f);
+        workerThreadToggle.setBoundsRelative (0.2f,  0.68f, 0.6f,  0.05f);
+        loadSheddingToggle.setBoundsRelative (0.2f,  0.72f, 0.6f,  0.05f);
+
+        flightRecorderToggle.setBoundsRelative      (0.2f,  0.76f, 0.35f, 0.05f);
+        dumpFlightRecordingButton.setBoundsRelative (0.57f, 0.76f, 0.23f, 0.05f);
+
+        presetMorphTimeLabel.setBoundsRelative  (0.2f,  0.80f, 0.35f, 0.05f);
+        presetMorphTimeSlider.setBoundsRelative (0.57f, 0.80f, 0.23f, 0.05f);
+
+        versionInfoLabel.setBoundsRelative (0.2f, 0.85f, 0.8f, 0.03f);
+        commitInfoLabel.setBoundsRelative  (0.2f, 0.88f, 0.8f, 0.03f);
+        buildDateLabel.setBoundsRelative   (0.2f, 0.91f, 0.8f, 0.03f);
+    }
+
+    void visibilityChanged() override
+    {
+        // A recalled preset or session might have changed the impulse response while the page was hidden
+        if (isVisible())
+            updateCabinetLabel();
     }
 
 private:
+    OJDAudioProcessor& processor;
+
     float fontHeight = 1.0f;
 
     juce::Label versionInfoLabel;
     juce::Label commitInfoLabel;
     juce::Label buildDateLabel;
 
+    juce::Label cabinetLabel;
+    juce::TextButton loadCabinetButton  { "Load Cabinet IR..." };
+    juce::TextButton clearCabinetButton { "No Cabinet" };
+    std::unique_ptr<juce::FileChooser> cabinetChooser;
+
+    // Applies to all instances prepared afterwards, e.g. after restarting the audio engine
+    juce::ToggleButton workerThreadToggle { "Worker thread (+1 block latency)" };
+
+    // Takes effect right away, the quality is shown by the chain meter
+    juce::ToggleButton loadSheddingToggle { "Reduce quality under CPU load" };
+
+    // Like the worker thread mode, enabling the recorder applies to instances prepared afterwards
+    juce::ToggleButton flightRecorderToggle { "Flight recorder" };
+    juce::TextButton dumpFlightRecordingButton { "Dump" };
+
+    // Used by all instances created afterwards, this one applies it to the next recalled preset already
+    juce::Label presetMorphTimeLabel { {}, "Preset morph time" };
+    juce::Slider presetMorphTimeSlider;
+
+    ChainMeterComponent chainMeter;
+
     jb::SVGComponent housingBackside;
 
+    void chooseCabinetImpulseResponse()
+    {
+        const auto current = processor.getCabinetImpulseResponse();
+
+        cabinetChooser = std::make_unique<juce::FileChooser> ("Choose a cabinet impulse response",
+                                                              current.existsAsFile() ? current.getParentDirectory() : juce::File(),
+                                                              "*.wav;*.aif;*.aiff");
+
+        const auto flags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles;
+
+        cabinetChooser->launchAsync (flags, [this] (const juce::FileChooser& chooser)
+        {
+            const auto file = chooser.getResult();
+
+            if (file.existsAsFile())
+            {
+                processor.setCabinetImpulseResponse (file);
+                updateCabinetLabel();
+            }
+        });
+    }
+
+    void updateCabinetLabel()
+    {
+        const auto file = processor.getCabinetImpulseResponse();
+        cabinetLabel.setText ("Cabinet: " + (file.existsAsFile() ? file.getFileName() : juce::String ("None")), juce::dontSendNotification);
+    }
+
     static juce::String getBranchName()
     {
         if (ProjectInfo::Git::branch.empty())
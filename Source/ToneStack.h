@@ -23,7 +23,12 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 
 #include <juce_dsp/juce_dsp.h>
 
-class ToneStack : public juce::dsp::ProcessorBase
+/**
+ * The tone stack sums a first order highpass, scaled by the tone setting, and a first order lowpass at the same
+ * frequency. As both share the same denominator, the sum is a single first order section, which is what this class
+ * computes. The filtering itself is part of the cascade after the waveshaper.
+ */
+class ToneStack
 {
 public:
     enum Mode
@@ -32,75 +37,100 @@ public:
         lp
     };
 
-    ToneStack() = default;
-
-    void prepare (const juce::dsp::ProcessSpec& spec) override
+    /** The filters used in pure HP and LP mode, which only depend on the sample rate */
+    struct ModeCoefficients
     {
-        hpfTempBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
-        hpfTempBlock = std::make_unique<juce::dsp::AudioBlock<float>> (hpfTempBuffer);
-
-        constexpr auto hpModeFreq = 358.0f;
-        constexpr auto lpModeFreq = 160.0f;
+        std::array<float, 4> hpfHPMode, hpfLPMode;
+        std::array<float, 4> lpfHPMode, lpfLPMode;
 
-        hpfCoeffsHPMode = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderHighPass (spec.sampleRate, hpModeFreq);
-        hpfCoeffsLPMode = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderHighPass (spec.sampleRate, lpModeFreq);
-
-        lpfCoeffsHPMode = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderLowPass (spec.sampleRate, hpModeFreq);
-        lpfCoeffsLPMode = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderLowPass (spec.sampleRate, lpModeFreq);
+        static ModeCoefficients compute (double sampleRate)
+        {
+            using Coeffs = juce::dsp::IIR::ArrayCoefficients<float>;
 
-        *hpf.state = currentMode == hp ? hpfCoeffsHPMode : hpfCoeffsLPMode;
-        *lpf.state = currentMode == hp ? lpfCoeffsHPMode : lpfCoeffsLPMode;
+            return { Coeffs::makeFirstOrderHighPass (sampleRate, hpModeFreq), Coeffs::makeFirstOrderHighPass (sampleRate, lpModeFreq),
+                     Coeffs::makeFirstOrderLowPass  (sampleRate, hpModeFreq), Coeffs::makeFirstOrderLowPass  (sampleRate, lpModeFreq) };
+        }
+    };
 
-        hpf.prepare (spec);
-        lpf.prepare (spec);
-    }
+    ToneStack() = default;
 
-    void process (const juce::dsp::ProcessContextReplacing<float>& context) override
+    void prepare (double newSampleRate)
     {
-        // Update the gain value depending on the current mode
-        hpfGain.setGainLinear (currentMode == hp ? 0.7f * tone : 0.2f * tone);
-
-        // First process the highpass filter and store its result to a second block
-        hpf.process (juce::dsp::ProcessContextNonReplacing<float> (context.getInputBlock(), *hpfTempBlock));
-        // Now process the lowpass filter in place
-        lpf.process (context);
-
-        // Now process the hpf Gain and add the result to the original context, already containing the lpf result
-        hpfGain.process (juce::dsp::ProcessContextReplacing<float> (*hpfTempBlock));
-        context.getOutputBlock().add (*hpfTempBlock);
+        prepare (newSampleRate, ModeCoefficients::compute (newSampleRate));
     }
 
-    void reset() override
+    /** Prepares with mode coefficients computed in advance for the sample rate */
+    void prepare (double newSampleRate, const ModeCoefficients& newModeCoefficients)
     {
-        hpf.reset();
-        lpf.reset();
+        sampleRate = newSampleRate;
+        modeCoefficients = newModeCoefficients;
+
+        updateCoefficients();
     }
 
-    void setHpLpMode (Mode newMode)
+    /**
+     * Takes 0 for LP mode and 1 for HP mode. Values in between morph between the two modes by interpolating the
+     * filter frequencies and the highpass gain. Recalculating coefficients for them does not allocate.
+     */
+    void setHpAmount (float newHpAmount)
     {
-        if (currentMode != newMode)
+        if (hpAmount != newHpAmount)
         {
-            currentMode = newMode;
-
-            *hpf.state = newMode == hp ? hpfCoeffsHPMode : hpfCoeffsLPMode;
-            *lpf.state = newMode == hp ? lpfCoeffsHPMode : lpfCoeffsLPMode;
+            hpAmount = newHpAmount;
+            updateCoefficients();
         }
     }
 
     /** Takes the normalised 0-1 Tone value */
     void setTone (float newTone)    { tone = newTone; }
 
+    /** Returns the combined first order section in the b0, b1, a0, a1 order used by ArrayCoefficients */
+    std::array<float, 4> getCoefficients() const
+    {
+        const auto hpfGain = hpfGainFactor * tone;
+
+        // Both filters are made by the bilinear transform at the same frequency, so a0 and a1 are the same
+        return { hpfGain * hpfCoeffs[0] + lpfCoeffs[0],
+                 hpfGain * hpfCoeffs[1] + lpfCoeffs[1],
+                 lpfCoeffs[2],
+                 lpfCoeffs[3] };
+    }
+
 private:
-    Mode currentMode = lp;
+    static constexpr float hpModeFreq = 358.0f;
+    static constexpr float lpModeFreq = 160.0f;
 
-    juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>> hpf, lpf;
+    static constexpr float hpModeHpfGain = 0.7f;
+    static constexpr float lpModeHpfGain = 0.2f;
 
-    std::array<float, 4> hpfCoeffsHPMode, hpfCoeffsLPMode;
-    std::array<float, 4> lpfCoeffsHPMode, lpfCoeffsLPMode;
+    double sampleRate = 0.0;
+    float hpAmount = 0.0f;
+    float hpfGainFactor = lpModeHpfGain;
+
+    std::array<float, 4> hpfCoeffs { 1.0f, 0.0f, 1.0f, 0.0f };
+    std::array<float, 4> lpfCoeffs { 1.0f, 0.0f, 1.0f, 0.0f };
+
+    ModeCoefficients modeCoefficients;
 
-    juce::dsp::Gain<float> hpfGain;
     float tone = 1.0f;
 
-    juce::AudioBuffer<float> hpfTempBuffer;
-    std::unique_ptr<juce::dsp::AudioBlock<float>> hpfTempBlock;
+    void updateCoefficients()
+    {
+        hpfGainFactor = lpModeHpfGain + hpAmount * (hpModeHpfGain - lpModeHpfGain);
+
+        if (sampleRate == 0.0)
+            return;
+
+        if (hpAmount == 0.0f || hpAmount == 1.0f)
+        {
+            hpfCoeffs = hpAmount == 1.0f ? modeCoefficients.hpfHPMode : modeCoefficients.hpfLPMode;
+            lpfCoeffs = hpAmount == 1.0f ? modeCoefficients.lpfHPMode : modeCoefficients.lpfLPMode;
+            return;
+        }
+
+        const auto freq = lpModeFreq + hpAmount * (hpModeFreq - lpModeFreq);
+
+        hpfCoeffs = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderHighPass (sampleRate, freq);
+        lpfCoeffs = juce::dsp::IIR::ArrayCoefficients<float>::makeFirstOrderLowPass  (sampleRate, freq);
+    }
 };
\ No newline at end of file
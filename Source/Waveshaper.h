@@ -22,64 +22,491 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #pragma once
 
 #include <juce_dsp/juce_dsp.h>
+#include "LaneOversampler.h"
+#include "DSPKernels.h"
+#include "ChannelCount.h"
 
-class Waveshaper : public juce::dsp::ProcessorBase
+/**
+ * The oversampled waveshaper. Its transfer curve is exactly the identity for inputs between -0.3 and 0.9, so as long as
+ * the oversampled signal stays in that range, the whole up-shape-down path is a linear filter. Blocks for which this
+ * is guaranteed are processed by an FIR filter with the measured impulse response of the oversampling path instead,
+ * which has the same magnitude and phase response. By default, this is only done for the oversampling orders where the
+ * FIR filter is clearly cheaper, see LinearPathBenchmark.
+ *
+ * A block is only processed linearly if all of its samples and enough samples before it stayed below a peak that
+ * provably keeps the oversampled signal in the linear region. When switching back, the oversampler state is rebuilt
+ * from the recent input history, so both paths line up without clicks.
+ */
+class Waveshaper
 {
 public:
-    Waveshaper ()
+    Waveshaper() = default;
+
+    void prepare (const juce::dsp::ProcessSpec& spec, DSPArena& arena)
+    {
+        kernels = &DSPKernels::getActive();
+        oversampler.prepare (spec, arena);
+
+        numChannels  = spec.numChannels;
+        maxBlockSize = spec.maximumBlockSize;
+
+        const auto& linearPath = getLinearPath (oversamplingOrder);
+        historyLength = linearPath.reversedImpulseResponse.size() - 1;
+        history = arena.allocate<float> (numChannels * historyLength);
+
+        updateLinearPathAvailability();
+
+        // The linear path needs the history followed by the block of one channel, the warm up a copy of the history
+        const auto linearPathSize = ScratchPool::getAllocationSize<float> (historyLength + maxBlockSize);
+        const auto warmUpSize     = ScratchPool::getAllocationSize<float*> (numChannels) +
+                                    numChannels * ScratchPool::getAllocationSize<float> (juce::jmin (historyLength, maxBlockSize));
+
+        scratchSize = juce::jmax (linearPathSize, warmUpSize + oversampler.getScratchSize());
+        ScratchPool::reserve (scratchSize);
+
+        resetLinearPathTracking();
+    }
+
+    template <size_t numBlockChannels = ChannelCount::dynamic>
+    void process (const juce::dsp::ProcessContextReplacing<float>& context)
+    {
+        if (context.usesSeparateInputAndOutputBlocks())
+            context.getOutputBlock().copyFrom (context.getInputBlock());
+
+        processBlock<numBlockChannels> (context.getOutputBlock());
+    }
+
+    void reset()
+    {
+        oversampler.reset();
+
+        if (history != nullptr)
+            std::fill (history, history + numChannels * historyLength, 0.0f);
+
+        resetLinearPathTracking();
+    }
+
+    /** Copies the oversampler state and the input history of one channel to another one */
+    void copyChannelState (size_t source, size_t destination)
+    {
+        oversampler.copyChannelState (source, destination);
+
+        if (history != nullptr)
+            std::copy (history + source * historyLength, history + (source + 1) * historyLength, history + destination * historyLength);
+    }
+
+    /**
+     * Returns the number of samples a reset waveshaper has to process until its output doesn't depend on the input it
+     * missed anymore. Anything older has decayed below the truncation threshold of the linear path.
+     */
+    size_t getWarmUpLength() const { return historyLength; }
+
+    /** Returns the largest absolute difference between the states of two channels */
+    float getChannelStateDifference (size_t a, size_t b) const
+    {
+        auto difference = oversampler.getChannelStateDifference (a, b);
+
+        if (history != nullptr)
+            for (size_t i = 0; i < historyLength; ++i)
+                difference = juce::jmax (difference, std::abs (history[a * historyLength + i] - history[b * historyLength + i]));
+
+        return difference;
+    }
+
+    /**
+     * Sets the number of 2x oversampling stages, 0 disables the oversampling. This redesigns the filters and is not
+     * real time safe, prepare has to be called afterwards.
+     */
+    void setOversamplingOrder (size_t newOrder)
+    {
+        jassert (newOrder <= maxOversamplingOrder);
+
+        oversamplingOrder = juce::jmin (newOrder, maxOversamplingOrder);
+        oversampler = OversamplerType (oversamplingOrder);
+
+        updateLinearPathAvailability();
+    }
+
+    size_t getOversamplingOrder() const { return oversamplingOrder; }
+
+    static constexpr size_t defaultOversamplingOrder = 4;
+    static constexpr size_t maxOversamplingOrder     = 5;
+
+    /** Returns true if the last block was processed by the linear path */
+    bool isLinearPathActive() const { return linearPathActive; }
+
+    enum class LinearPathMode
+    {
+        /** Uses the linear path where it is clearly faster than the oversampled path, which is the default */
+        automatic,
+
+        /** Uses the linear path for every oversampling order, e.g. to compare both paths */
+        always,
+
+        /** Always processes the oversampled path */
+        never
+    };
+
+    /** Can be called at any time, switching to the linear path waits until enough safe samples have been processed */
+    void setLinearPathMode (LinearPathMode newMode) { linearPathMode = newMode; }
+
+    /**
+     * Returns true if blocks with the given number of channels are processed by the linear path while they are in the
+     * linear region. The FIR filter processes each channel on its own while the oversampler processes several channels
+     * in its SIMD lanes at once, so the automatic mode depends on the number of channels.
+     */
+    bool isLinearPathEnabled (size_t numBlockChannels) const
+    {
+        if (! linearPathAvailable || linearPathMode == LinearPathMode::never)
+            return false;
+
+        if (linearPathMode == LinearPathMode::always)
+            return true;
+
+        const auto numLanes = oversampler.getNumInterleavedChannels();
+        auto oversampledCost = 0.0;
+
+        for (size_t firstChannel = 0; firstChannel < numBlockChannels; firstChannel += numLanes)
+        {
+            const auto numActiveLanes = oversampler.getNumActiveLanes (juce::jmin (numLanes, numBlockChannels - firstChannel));
+            oversampledCost += (oversampledCostPerFrame + oversampledCostPerLane * static_cast<double> (numActiveLanes)) * static_cast<double> (oversampler.getOversamplingFactor());
+        }
+
+        const auto linearCost = static_cast<double> (linearPathLength * numBlockChannels);
+
+        return linearCost < 0.75 * oversampledCost;
+    }
+
+    /** Counts of oversampled samples, see getActivity */
+    struct Activity
+    {
+        size_t numSamples = 0;
+        size_t numInKnee  = 0;
+        size_t numClipped = 0;
+    };
+
+    /**
+     * Returns how many oversampled samples of the processed channels went through the curve since the last call to
+     * resetActivity and how many of them hit one of its knees or clipped. Blocks processed by the linear path only
+     * contain samples in the linear region. The counting is part of the shape loop and costs almost nothing.
+     */
+    const Activity& getActivity() const { return activity; }
+
+    void resetActivity() { activity = {}; }
+
+    /** The number of bytes borrowed from the ScratchPool during process */
+    size_t getScratchSize() const { return scratchSize; }
+
+    float getLatencyInSamples() const
+    {
+        return oversampler.getLatencyInSamples();
+    }
+
+private:
+    // The LaneOversampler shares its interface with the Oversampler, which matches juce::dsp::Oversampling
+    using OversamplerType = LaneOversampler;
+
+    /** The smallest magnitude the shape function does not pass through unchanged, the linear region is [-0.3, 0.9] */
+    static constexpr float linearRegionLimit = 0.3f;
+
+    /**
+     * The impulse response is cut where the sum of the remaining absolute values falls below this. Longer responses
+     * than maxLinearPathLength are not used as linear path
+     */
+    static constexpr double truncationThreshold = 1e-5;
+    static constexpr size_t maxLinearPathLength = 256;
+
+    /**
+     * The cost of resampling and shaping one oversampled frame, in multiply-adds of the FIR filter, is about
+     * oversampledCostPerFrame plus oversampledCostPerLane for each active lane. The LinearPathBenchmark measured about
+     * 30 for a mono and 45 for a stereo frame with the AVX2 kernels at all orders. The linear path is used automatically
+     * if it costs less than three quarters of the oversampled path, which rules out order 1, where both paths are about
+     * equally fast.
+     */
+    static constexpr double oversampledCostPerFrame = 15.0;
+    static constexpr double oversampledCostPerLane  = 15.0;
+
+    struct LinearPath
+    {
+        /** The impulse response of up and down sampling, reversed to compute the convolution as dot product */
+        std::vector<float> reversedImpulseResponse;
+
+        /** Inputs with a magnitude below this value are guaranteed to keep the oversampled signal linear */
+        float maxSafeInputPeak = 0.0f;
+
+        /** False if the impulse response had to be cut before falling below the truncation threshold */
+        bool isExact = false;
+    };
+
+    size_t oversamplingOrder = defaultOversamplingOrder;
+    OversamplerType oversampler { oversamplingOrder };
+
+    // The shape curve and the linear path are computed by the kernels of the instruction set picked in prepare
+    const DSPKernels* kernels = &DSPKernels::getActive();
+
+    size_t numChannels = 0;
+    size_t maxBlockSize = 0;
+    size_t scratchSize = 0;
+
+    // The last historyLength input samples of each channel, stored in the arena
+    size_t historyLength = 0;
+    float* history = nullptr;
+
+    LinearPathMode linearPathMode = LinearPathMode::automatic;
+    bool linearPathAvailable = false;
+    size_t linearPathLength = 0;
+
+    size_t numConsecutiveSafeSamples = 0;
+    bool linearPathActive = false;
+
+    Activity activity;
+
+    template <size_t numBlockChannels>
+    void processBlock (const juce::dsp::AudioBlock<float>& block)
     {
-        // This is where the magic happens :D
-        waveshaper.functionToUse = [] (float in)
+        const auto nc = ChannelCount::of<numBlockChannels> (block);
+
+        activity.numSamples += block.getNumSamples() * nc * oversampler.getOversamplingFactor();
+
+        // The safe samples are counted even without the linear path, so that it can be enabled at any time
+        const auto numSafeSamplesBefore = numConsecutiveSafeSamples;
+        const auto blockIsSafe = updateSafeSampleCount<numBlockChannels> (block);
+
+        // The linear path only matches the oversampled path if the whole FIR length has been in the safe region too
+        if (blockIsSafe && numSafeSamplesBefore >= historyLength && isLinearPathEnabled (nc))
+        {
+            processLinear<numBlockChannels> (block);
+            linearPathActive = true;
+            return;
+        }
+
+        if (linearPathActive)
         {
-            float out = in;
+            warmUpOversampler (nc);
+            linearPathActive = false;
+        }
 
-            if (in <= -1.7f)
-                out = -1.0f;
-            else if ((in > -1.7f) && (in < -0.3f))
+        pushToHistory<numBlockChannels> (block);
+
+        // Sample up, shape and sample back down, the oversampled buffers are borrowed from the thread's scratch pool
+        oversampler.process<numBlockChannels> (block, [this] (float* samples, size_t n) { kernels->shapeAndCount (samples, n, &activity.numInKnee, &activity.numClipped); });
+    }
+
+    /** Tracks how many samples in a row stayed below the safe peak across all channels. Returns true if all did */
+    template <size_t numBlockChannels>
+    bool updateSafeSampleCount (const juce::dsp::AudioBlock<float>& block)
+    {
+        const auto numSamples = block.getNumSamples();
+        const auto safePeak = getLinearPath (oversamplingOrder).maxSafeInputPeak;
+
+        // Index of the last unsafe sample plus one, zero if all samples are safe
+        size_t unsafeEnd = 0;
+
+        for (size_t ch = 0; ch < ChannelCount::of<numBlockChannels> (block); ++ch)
+        {
+            const auto* samples = block.getChannelPointer (ch);
+            const auto range = juce::FloatVectorOperations::findMinAndMax (samples, static_cast<int> (numSamples));
+
+            if (range.getStart() >= -safePeak && range.getEnd() <= safePeak)
+                continue;
+
+            for (auto i = numSamples; i > unsafeEnd; --i)
             {
-                in += 0.3f;
-                out = in + (in * in) / (4 * (1 - 0.3f)) - 0.3f;
+                if (std::abs (samples[i - 1]) > safePeak)
+                {
+                    unsafeEnd = i;
+                    break;
+                }
             }
-            else if ((in > 0.9f) && (in < 1.1f))
+        }
+
+        if (unsafeEnd == 0)
+        {
+            numConsecutiveSafeSamples = juce::jmin (numConsecutiveSafeSamples + numSamples, historyLength + maxBlockSize);
+            return true;
+        }
+
+        numConsecutiveSafeSamples = numSamples - unsafeEnd;
+        return false;
+    }
+
+    /** Convolves the block with the impulse response of the oversampling path */
+    template <size_t numBlockChannels>
+    void processLinear (const juce::dsp::AudioBlock<float>& block)
+    {
+        const auto numSamples = block.getNumSamples();
+        const auto* impulseResponse = getLinearPath (oversamplingOrder).reversedImpulseResponse.data();
+        const auto impulseResponseLength = historyLength + 1;
+
+        ScratchPool::Scope scratch;
+        auto* buffer = scratch.allocate<float> (historyLength + numSamples);
+
+        if (buffer == nullptr)
+            return;
+
+        for (size_t ch = 0; ch < ChannelCount::of<numBlockChannels> (block); ++ch)
+        {
+            auto* samples = block.getChannelPointer (ch);
+            auto* channelHistory = history + ch * historyLength;
+
+            std::copy (channelHistory, channelHistory + historyLength, buffer);
+            std::copy (samples, samples + numSamples, buffer + historyLength);
+
+            kernels->convolve (impulseResponse, impulseResponseLength, buffer, samples, numSamples);
+
+            std::copy (buffer + numSamples, buffer + numSamples + historyLength, channelHistory);
+        }
+    }
+
+    /** Appends the block to the input history, which always holds the most recent historyLength samples */
+    template <size_t numBlockChannels>
+    void pushToHistory (const juce::dsp::AudioBlock<float>& block)
+    {
+        const auto numSamples = block.getNumSamples();
+
+        for (size_t ch = 0; ch < ChannelCount::of<numBlockChannels> (block); ++ch)
+        {
+            const auto* samples = block.getChannelPointer (ch);
+            auto* channelHistory = history + ch * historyLength;
+
+            if (numSamples >= historyLength)
             {
-                in -= 0.9f;
-                out = in - (in * in) / (4 * (1 - 0.9f)) + 0.9f;
+                std::copy (samples + numSamples - historyLength, samples + numSamples, channelHistory);
             }
-            else if (in > 1.1f)
-                out = 1.0f;
-
-            return out;
-        };
+            else
+            {
+                std::copy (channelHistory + numSamples, channelHistory + historyLength, channelHistory);
+                std::copy (samples, samples + numSamples, channelHistory + historyLength - numSamples);
+            }
+        }
     }
 
-    void prepare (const juce::dsp::ProcessSpec& spec) override
+    /**
+     * Rebuilds the oversampler state after the linear path has been used by running the input history through it. The
+     * history has been in the linear region, anything older has decayed below the truncation threshold.
+     */
+    void warmUpOversampler (size_t numChannelsToWarmUp)
     {
-        constexpr size_t oversamplingOrder = 4;
-        constexpr auto filterType = juce::dsp::Oversampling<float>::filterHalfBandPolyphaseIIR;
+        oversampler.reset();
+
+        ScratchPool::Scope scratch;
+        const auto chunkSize = juce::jmin (historyLength, maxBlockSize);
+
+        auto** channels = scratch.allocate<float*> (numChannelsToWarmUp);
+
+        if (channels == nullptr)
+            return;
+
+        for (size_t ch = 0; ch < numChannelsToWarmUp; ++ch)
+            channels[ch] = scratch.allocate<float> (chunkSize);
+
+        if (scratch.hasFailed())
+            return;
+
+        for (size_t start = 0; start < historyLength; start += chunkSize)
+        {
+            const auto numSamples = juce::jmin (chunkSize, historyLength - start);
 
-        oversampler = std::make_unique<juce::dsp::Oversampling<float>> (spec.numChannels, oversamplingOrder, filterType);
-        oversampler->initProcessing (spec.maximumBlockSize);
+            for (size_t ch = 0; ch < numChannelsToWarmUp; ++ch)
+                std::copy (history + ch * historyLength + start, history + ch * historyLength + start + numSamples, channels[ch]);
+
+            oversampler.process (juce::dsp::AudioBlock<float> (channels, numChannelsToWarmUp, numSamples), [] (float*, size_t) {});
+        }
     }
 
-    void process (const juce::dsp::ProcessContextReplacing<float>& context) override
+    void updateLinearPathAvailability()
     {
-        // First sample up...
-        auto oversampledBlock = oversampler->processSamplesUp (context.getInputBlock());
-        // Then process with the waveshaper...
-        waveshaper.process (juce::dsp::ProcessContextReplacing<float> (oversampledBlock));
-        // Finally sample back down
-        oversampler->processSamplesDown (context.getOutputBlock());
+        const auto& linearPath = getLinearPath (oversamplingOrder);
+
+        linearPathAvailable = linearPath.isExact;
+        linearPathLength    = linearPath.reversedImpulseResponse.size();
     }
 
-    void reset() override { oversampler->reset(); }
+    /** The zeroed history matches a reset oversampler, so the linear path can be used right away */
+    void resetLinearPathTracking()
+    {
+        numConsecutiveSafeSamples = historyLength;
+        linearPathActive = false;
+    }
 
-    float getLatencyInSamples()
+    /**
+     * The linear path only depends on the filter design, so it is measured once for all instances. All orders are
+     * measured on first use, which happens in prepare, so no instance ever measures while processing.
+     */
+    static const LinearPath& getLinearPath (size_t order)
     {
-        return oversampler == nullptr ? 0.0f : oversampler->getLatencyInSamples();
+        static const auto linearPaths = []
+        {
+            std::array<LinearPath, maxOversamplingOrder + 1> paths;
+
+            for (size_t o = 0; o < paths.size(); ++o)
+                paths[o] = measureLinearPath (o);
+
+            return paths;
+        }();
+
+        return linearPaths[order];
     }
 
-private:
+    static LinearPath measureLinearPath (size_t order)
+    {
+        constexpr size_t numSamples = 1024;
+
+        // The filters are designed for normalised frequencies, so the sample rate doesn't matter here. The buffers of
+        // all stages are owned by this function, so measuring doesn't raise the scratch memory of all instances
+        OversamplerType measuredOversampler (order);
+        DSPArena arena;
+
+        const juce::dsp::ProcessSpec spec { 48000.0, static_cast<juce::uint32> (numSamples), 1 };
+        arena.beginMeasuring();
+        measuredOversampler.prepareWithoutScratch (spec, arena);
+        arena.allocateMeasuredSize();
+        measuredOversampler.prepareWithoutScratch (spec, arena);
+
+        const auto factor = measuredOversampler.getOversamplingFactor();
+
+        std::vector<std::vector<float>> stageBuffers;
+        std::vector<float*> buffers;
+
+        for (size_t stageFactor = 2; stageFactor <= factor; stageFactor *= 2)
+        {
+            stageBuffers.emplace_back (numSamples * stageFactor);
+            buffers.push_back (stageBuffers.back().data());
+        }
+
+        std::vector<float> response (numSamples, 0.0f);
+        response[0] = 1.0f;
+
+        // The oversampled signal at each phase is a weighted sum of the inputs. The sum of the absolute weights bounds
+        // the oversampled peak in relation to the input peak. A single channel is processed in a single lane
+        std::vector<double> phaseSums (factor, 0.0);
 
-    std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
-    juce::dsp::WaveShaper<float> waveshaper;
+        measuredOversampler.processWithBuffers (response.data(), numSamples, 0, 1, buffers.data(), [&] (float* samples, size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                phaseSums[i % factor] += std::abs (samples[i]);
+        });
+
+        auto length = numSamples;
+        for (auto tail = 0.0; length > 1; --length)
+        {
+            tail += std::abs (response[length - 1]);
+
+            if (tail > truncationThreshold)
+                break;
+        }
+
+        LinearPath linearPath;
+        linearPath.isExact = length <= maxLinearPathLength;
+
+        // A longer response would break the truncation threshold. It is still cut to bound the input history, which
+        // is also used to warm up the oversampler, but it is never used as linear path
+        jassert (linearPath.isExact);
+        length = juce::jmin (length, maxLinearPathLength);
+
+        linearPath.reversedImpulseResponse.assign (response.rbegin() + static_cast<std::ptrdiff_t> (numSamples - length), response.rend());
+        linearPath.maxSafeInputPeak = static_cast<float> (0.99 * linearRegionLimit / *std::max_element (phaseSums.begin(), phaseSums.end()));
+
+        return linearPath;
+    }
 };
\ No newline at end of file
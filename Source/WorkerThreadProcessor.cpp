@@ -0,0 +1,326 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "WorkerThreadProcessor.h"
+
+#if JUCE_LINUX || JUCE_BSD
+ #include <pthread.h>
+ #include <sched.h>
+#endif
+
+//==============================================================================
+class WorkerThreadPool::Worker : public juce::Thread
+{
+public:
+    explicit Worker (int index) : juce::Thread ("OJD Worker " + juce::String (index)) {}
+
+    ~Worker() override
+    {
+        signalThreadShouldExit();
+        wakeUp.signal();
+        stopThread (1000);
+    }
+
+    void run() override
+    {
+        enableRealtimeScheduling();
+
+        while (! threadShouldExit())
+        {
+            // The timeout only matters for exiting, processors signal the event whenever they pushed new input
+            wakeUp.wait (100);
+
+            const juce::ScopedLock scopedLock (lock);
+
+            for (auto* processor : processors)
+                processor->processPending();
+        }
+    }
+
+    juce::CriticalSection lock;
+    juce::Array<WorkerThreadProcessor*> processors;
+    juce::WaitableEvent wakeUp;
+
+    // The size of processors, which can be read without the lock that the worker holds while processing
+    std::atomic<int> numProcessors { 0 };
+
+private:
+    static void enableRealtimeScheduling()
+    {
+       #if JUCE_LINUX || JUCE_BSD
+        // This needs an rtprio limit or CAP_SYS_NICE, without them the thread keeps the priority it was started with.
+        // The priority stays below the usual priorities of host audio threads, e.g. 70 for JACK. A worker starved by them
+        // only makes process wait until its deadline, see WorkerThreadProcessor::processChunk
+        sched_param param {};
+        param.sched_priority = juce::jlimit (sched_get_priority_min (SCHED_FIFO), sched_get_priority_max (SCHED_FIFO), 60);
+
+        pthread_setschedparam (pthread_self(), SCHED_FIFO, &param);
+       #endif
+    }
+};
+
+//==============================================================================
+WorkerThreadPool::WorkerThreadPool()
+{
+    // The host audio thread keeps one core busy
+    const auto numWorkers = juce::jmax (1, juce::SystemStats::getNumCpus() - 1);
+
+    for (int i = 0; i < numWorkers; ++i)
+        workers.add (new Worker (i))->startThread (9);
+}
+
+WorkerThreadPool::~WorkerThreadPool() = default;
+
+void WorkerThreadPool::add (WorkerThreadProcessor& processor)
+{
+    auto* worker = workers.getFirst();
+
+    for (auto* w : workers)
+        if (w->numProcessors.load() < worker->numProcessors.load())
+            worker = w;
+
+    const juce::ScopedLock scopedLock (worker->lock);
+    worker->processors.add (&processor);
+    worker->numProcessors = worker->processors.size();
+    processor.wakeUpWorker = &worker->wakeUp;
+}
+
+void WorkerThreadPool::remove (WorkerThreadProcessor& processor)
+{
+    for (auto* worker : workers)
+    {
+        const juce::ScopedLock scopedLock (worker->lock);
+
+        if (worker->processors.contains (&processor))
+        {
+            worker->processors.removeFirstMatchingValue (&processor);
+            worker->numProcessors = worker->processors.size();
+            processor.wakeUpWorker = nullptr;
+        }
+    }
+}
+
+//==============================================================================
+WorkerThreadProcessor::WorkerThreadProcessor (ProcessFn processFnToUse)
+    : processFn (std::move (processFnToUse))
+{
+}
+
+WorkerThreadProcessor::~WorkerThreadProcessor()
+{
+    release();
+}
+
+void WorkerThreadProcessor::release()
+{
+    pool->remove (*this);
+}
+
+void WorkerThreadProcessor::prepare (double newSampleRate, int newNumChannels, int newMaximumBlockSize)
+{
+    pool->remove (*this);
+
+    sampleRate = newSampleRate;
+    numChannels = newNumChannels;
+    maximumBlockSize = newMaximumBlockSize;
+    numOutputSamplesToSkip = 0;
+    numInputSamplesOwed = 0;
+    numUnderruns = 0;
+
+    // Usually, the input holds at most the block the worker is still processing and the new one, the output at most one
+    // block more than the silence it starts with. The rest is headroom for a worker that falls behind
+    const auto fifoSize = 4 * maximumBlockSize;
+
+    inputFifo .setTotalSize (fifoSize);
+    outputFifo.setTotalSize (fifoSize);
+    inputFifo .reset();
+    outputFifo.reset();
+
+    inputBuffer .setSize (numChannels, fifoSize);
+    outputBuffer.setSize (numChannels, fifoSize);
+    workBuffer  .setSize (numChannels, maximumBlockSize);
+    outputBuffer.clear();
+
+    int start1, size1, start2, size2;
+    outputFifo.prepareToWrite (maximumBlockSize, start1, size1, start2, size2);
+    outputFifo.finishedWrite (size1 + size2);
+    numSamplesInFlight = size1 + size2;
+
+    pool->add (*this);
+}
+
+void WorkerThreadProcessor::process (const juce::dsp::AudioBlock<float>& block)
+{
+    jassert (wakeUpWorker != nullptr && static_cast<int> (block.getNumChannels()) <= numChannels);
+
+    // Blocks larger than announced are exchanged in chunks, each of them adds one round trip to the worker
+    for (size_t start = 0; start < block.getNumSamples(); start += static_cast<size_t> (maximumBlockSize))
+        processChunk (block.getSubBlock (start, juce::jmin (static_cast<size_t> (maximumBlockSize), block.getNumSamples() - start)));
+}
+
+void WorkerThreadProcessor::processChunk (const juce::dsp::AudioBlock<float>& block)
+{
+    const auto numSamples = static_cast<int> (block.getNumSamples());
+
+    // Everything in flight may end up in the output FIFO at once, so no more input is pushed than it can hold. Input
+    // that doesn't fit is replaced by silence, which is pushed as soon as there is space to keep the samples aligned
+    const auto capacity = outputFifo.getTotalSize() - 1;
+
+    // Owed silence whose output has already been replaced by silence doesn't have to travel through the worker
+    const auto numOwedAndLate = juce::jmin (numInputSamplesOwed, numOutputSamplesToSkip - numSamplesInFlight);
+
+    if (numOwedAndLate > 0)
+    {
+        numInputSamplesOwed -= numOwedAndLate;
+        numOutputSamplesToSkip -= numOwedAndLate;
+    }
+
+    if (numInputSamplesOwed > 0)
+        writeSilence (juce::jmin (numInputSamplesOwed, capacity - numSamplesInFlight));
+
+    if (numInputSamplesOwed == 0 && numSamplesInFlight + numSamples <= capacity)
+        writeInput (block);
+    else
+        numInputSamplesOwed += numSamples;
+
+    wakeUpWorker->signal();
+
+    // Output that was replaced by silence before is dropped now, if it has arrived
+    if (numOutputSamplesToSkip > 0)
+    {
+        const auto numLate = juce::jmin (numOutputSamplesToSkip, outputFifo.getNumReady());
+        outputFifo.finishedRead (numLate);
+        numOutputSamplesToSkip -= numLate;
+        numSamplesInFlight -= numLate;
+    }
+
+    // Usually, the output of the previous block has been ready long before. Otherwise the worker is busy with exactly
+    // the samples needed. The worker may be starved by threads of higher priority though, so the wait is limited to half
+    // the duration of the block
+    const auto deadline = juce::Time::getHighResolutionTicks()
+                        + static_cast<juce::int64> (0.5 * numSamples / sampleRate * static_cast<double> (juce::Time::getHighResolutionTicksPerSecond()));
+
+    for (int numTries = 0; numOutputSamplesToSkip == 0 && outputFifo.getNumReady() < numSamples; ++numTries)
+    {
+        if (numTries > 100)
+        {
+            if (juce::Time::getHighResolutionTicks() > deadline)
+                break;
+
+            juce::Thread::yield();
+        }
+    }
+
+    // While late output is still to be dropped, the output FIFO doesn't contain anything for this block yet
+    const auto numRead = numOutputSamplesToSkip > 0 ? 0 : readOutput (block, numSamples);
+    const auto numMissing = numSamples - numRead;
+
+    if (numMissing > 0)
+    {
+        block.getSubBlock (static_cast<size_t> (numRead)).clear();
+        numOutputSamplesToSkip += numMissing;
+        ++numUnderruns;
+    }
+}
+
+void WorkerThreadProcessor::writeInput (const juce::dsp::AudioBlock<float>& block)
+{
+    const auto numSamples = static_cast<int> (block.getNumSamples());
+
+    int start1, size1, start2, size2;
+    inputFifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+    jassert (size1 + size2 == numSamples);
+
+    for (int ch = 0; ch < static_cast<int> (block.getNumChannels()); ++ch)
+    {
+        const auto* source = block.getChannelPointer (static_cast<size_t> (ch));
+        inputBuffer.copyFrom (ch, start1, source, size1);
+        inputBuffer.copyFrom (ch, start2, source + size1, size2);
+    }
+
+    inputFifo.finishedWrite (size1 + size2);
+    numSamplesInFlight += size1 + size2;
+}
+
+void WorkerThreadProcessor::writeSilence (int numSamples)
+{
+    int start1, size1, start2, size2;
+    inputFifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        inputBuffer.clear (ch, start1, size1);
+        inputBuffer.clear (ch, start2, size2);
+    }
+
+    inputFifo.finishedWrite (size1 + size2);
+    numSamplesInFlight += size1 + size2;
+    numInputSamplesOwed -= size1 + size2;
+}
+
+int WorkerThreadProcessor::readOutput (const juce::dsp::AudioBlock<float>& block, int numSamples)
+{
+    int start1, size1, start2, size2;
+    outputFifo.prepareToRead (numSamples, start1, size1, start2, size2);
+
+    for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+    {
+        auto* destination = block.getChannelPointer (ch);
+        juce::FloatVectorOperations::copy (destination,         outputBuffer.getReadPointer (static_cast<int> (ch), start1), size1);
+        juce::FloatVectorOperations::copy (destination + size1, outputBuffer.getReadPointer (static_cast<int> (ch), start2), size2);
+    }
+
+    outputFifo.finishedRead (size1 + size2);
+    numSamplesInFlight -= size1 + size2;
+    return size1 + size2;
+}
+
+void WorkerThreadProcessor::processPending()
+{
+    for (auto numReady = inputFifo.getNumReady(); numReady > 0; numReady = inputFifo.getNumReady())
+    {
+        const auto numSamples = juce::jmin (numReady, maximumBlockSize);
+
+        int start1, size1, start2, size2;
+        inputFifo.prepareToRead (numSamples, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            workBuffer.copyFrom (ch, 0,     inputBuffer, ch, start1, size1);
+            workBuffer.copyFrom (ch, size1, inputBuffer, ch, start2, size2);
+        }
+
+        inputFifo.finishedRead (size1 + size2);
+
+        processFn (juce::dsp::AudioBlock<float> (workBuffer).getSubBlock (0, static_cast<size_t> (numSamples)));
+
+        outputFifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+        jassert (size1 + size2 == numSamples);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            outputBuffer.copyFrom (ch, start1, workBuffer, ch, 0,     size1);
+            outputBuffer.copyFrom (ch, start2, workBuffer, ch, size1, size2);
+        }
+
+        outputFifo.finishedWrite (size1 + size2);
+    }
+}
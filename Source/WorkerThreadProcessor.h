@@ -0,0 +1,133 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_dsp/juce_dsp.h>
+
+class WorkerThreadPool;
+
+/**
+ * Moves the processing of an instance from the host audio thread to a real time worker thread, for hosts that run all
+ * plugins on one saturated audio thread while other cores idle.
+ *
+ * process only exchanges samples with the worker through lock-free FIFOs: It pushes the new input, wakes the worker and
+ * pops output the worker has processed in the meantime. The output FIFO starts with one maximum sized block of silence,
+ * so the worker always has one block period to process a block, which adds maximumBlockSize samples of latency. If the
+ * worker is late, process waits for it, but at most half the duration of the block. After that, the missing output is
+ * replaced by silence and counted as underrun. The late output is dropped once it arrives, so the latency stays the
+ * same. If the worker falls so far behind that the FIFOs are full, new input is replaced by silence. The worker can't
+ * be replaced by processing on the calling thread, as it may still be busy with the same signal chain.
+ *
+ * All instances share one pool of workers, one per spare CPU core. Each instance is assigned to the worker with the
+ * fewest instances, so many instances spread across all cores.
+ */
+class WorkerThreadProcessor
+{
+public:
+    /** Called on the worker thread with blocks of up to maximumBlockSize samples */
+    using ProcessFn = std::function<void (const juce::dsp::AudioBlock<float>&)>;
+
+    explicit WorkerThreadProcessor (ProcessFn processFn);
+    ~WorkerThreadProcessor();
+
+    /** Allocates the FIFOs and registers with a worker. Must not be called while process runs */
+    void prepare (double sampleRate, int numChannels, int maximumBlockSize);
+
+    /**
+     * Unregisters from the worker, waiting for it to finish the block it may still be processing. Afterwards processFn
+     * isn't called anymore and the signal chain can be changed, until prepare registers again
+     */
+    void release();
+
+    /** Exchanges the block with the worker, the output is delayed by getLatencyInSamples */
+    void process (const juce::dsp::AudioBlock<float>& block);
+
+    int getLatencyInSamples() const { return maximumBlockSize; }
+
+    /** Returns the number of blocks since prepare whose output was replaced by silence because the worker was late */
+    int getNumUnderruns() const { return numUnderruns.load(); }
+
+private:
+    friend class WorkerThreadPool;
+
+    ProcessFn processFn;
+    juce::SharedResourcePointer<WorkerThreadPool> pool;
+
+    int numChannels = 0;
+    int maximumBlockSize = 0;
+    double sampleRate = 0.0;
+
+    // The input is written by the audio thread and read by the worker, the output the other way round
+    juce::AbstractFifo inputFifo  { 1 };
+    juce::AbstractFifo outputFifo { 1 };
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+
+    // The block the worker processes, only used by the worker
+    juce::AudioBuffer<float> workBuffer;
+
+    // Only used by the thread calling process. The samples pushed to the input FIFO that weren't read from the output
+    // FIFO yet, the late output samples still to be dropped and the silence still to be pushed instead of dropped input
+    int numSamplesInFlight = 0;
+    int numOutputSamplesToSkip = 0;
+    int numInputSamplesOwed = 0;
+    std::atomic<int> numUnderruns { 0 };
+
+    // Set while registered with a worker
+    juce::WaitableEvent* wakeUpWorker = nullptr;
+
+    void processChunk (const juce::dsp::AudioBlock<float>& block);
+
+    /** Pushes the block to the input FIFO, which must have space for it */
+    void writeInput (const juce::dsp::AudioBlock<float>& block);
+
+    /** Pushes as much of the given number of samples of silence as fits into the input FIFO */
+    void writeSilence (int numSamples);
+
+    /** Reads up to the given number of samples from the output FIFO into the block, returns the number read */
+    int readOutput (const juce::dsp::AudioBlock<float>& block, int numSamples);
+
+    /** Called by the worker, processes all input that is ready */
+    void processPending();
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerThreadProcessor)
+};
+
+/** The worker threads shared by all WorkerThreadProcessor instances, held by a SharedResourcePointer */
+class WorkerThreadPool
+{
+public:
+    WorkerThreadPool();
+    ~WorkerThreadPool();
+
+    /** Assigns the processor to the worker with the fewest processors */
+    void add (WorkerThreadProcessor& processor);
+
+    /** Removes the processor, after returning its worker doesn't call it anymore */
+    void remove (WorkerThreadProcessor& processor);
+
+private:
+    class Worker;
+    juce::OwnedArray<Worker> workers;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerThreadPool)
+};
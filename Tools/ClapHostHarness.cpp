@@ -0,0 +1,458 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include <juce_core/juce_core.h>
+#include <clap/clap.h>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+/**
+ * A minimal CLAP host that loads the OJD CLAP plugin and tests it headless. It checks that
+ *
+ * - the plugin exposes its parameters, audio ports, state and latency
+ * - the output is finite and not silent
+ * - parameter events are applied at their exact sample offset, e.g. the output does not change before an event and
+ *   the same automation rendered with different host block sizes gives bit identical results
+ * - processing the channels as tasks on the thread pool of the host gives the same result as processing them serially
+ * - a saved state restores all parameter values
+ *
+ * The result of each check is printed, the harness exits with an error if any of them failed.
+ *
+ * Usage: OJD-ClapHostHarness <path to the plugin binary>
+ */
+
+static constexpr double sampleRate = 48000.0;
+static constexpr uint32_t maxBlockSize = 512;
+static constexpr size_t numChannels = 2;
+static constexpr size_t numRenderSamples = 48000;
+
+/** A parameter change at an absolute sample position of a render */
+struct Automation
+{
+    size_t sample;
+    clap_id parameter;
+    double value;
+};
+
+/** The host side of a plugin instance. The thread pool extension is only offered if enabled */
+class Host
+{
+public:
+    explicit Host (bool provideThreadPool) : threadPoolEnabled (provideThreadPool)
+    {
+        host.clap_version     = CLAP_VERSION_INIT;
+        host.host_data        = this;
+        host.name             = "OJD-ClapHostHarness";
+        host.vendor           = "Schrammel";
+        host.url              = "";
+        host.version          = "1.0";
+        host.get_extension    = [] (const clap_host_t* h, const char* id) -> const void*
+        {
+            auto& self = *static_cast<Host*> (h->host_data);
+            return self.threadPoolEnabled && std::strcmp (id, CLAP_EXT_THREAD_POOL) == 0 ? &self.threadPool : nullptr;
+        };
+        host.request_restart  = [] (const clap_host_t*) {};
+        host.request_process  = [] (const clap_host_t*) {};
+        host.request_callback = [] (const clap_host_t*) {};
+
+        threadPool.request_exec = [] (const clap_host_t* h, uint32_t numTasks) { return static_cast<Host*> (h->host_data)->exec (numTasks); };
+    }
+
+    const clap_host_t* get() const { return &host; }
+
+    /** Set once the plugin is created, the tasks are executed through it */
+    const clap_plugin_t* plugin = nullptr;
+    const clap_plugin_thread_pool_t* pluginThreadPool = nullptr;
+
+    size_t numExecutedTasks = 0;
+
+private:
+    clap_host_t host {};
+    clap_host_thread_pool_t threadPool {};
+    const bool threadPoolEnabled;
+
+    /** Runs the first task on the calling thread and all others on threads of their own, like a host pool would */
+    bool exec (uint32_t numTasks)
+    {
+        if (pluginThreadPool == nullptr)
+            return false;
+
+        std::vector<std::thread> threads;
+
+        for (uint32_t task = 1; task < numTasks; ++task)
+            threads.emplace_back ([this, task] { pluginThreadPool->exec (plugin, task); });
+
+        pluginThreadPool->exec (plugin, 0);
+
+        for (auto& thread : threads)
+            thread.join();
+
+        numExecutedTasks += numTasks;
+        return true;
+    }
+};
+
+/** An input event list backed by a vector of parameter value events */
+class EventList
+{
+public:
+    EventList()
+    {
+        list.ctx  = this;
+        list.size = [] (const clap_input_events_t* l) { return static_cast<uint32_t> (static_cast<EventList*> (l->ctx)->events.size()); };
+        list.get  = [] (const clap_input_events_t* l, uint32_t index) -> const clap_event_header_t*
+        {
+            return &static_cast<EventList*> (l->ctx)->events[index].header;
+        };
+    }
+
+    void add (uint32_t time, clap_id parameter, double value)
+    {
+        clap_event_param_value_t event {};
+        event.header.size     = sizeof (clap_event_param_value_t);
+        event.header.time     = time;
+        event.header.space_id = CLAP_CORE_EVENT_SPACE_ID;
+        event.header.type     = CLAP_EVENT_PARAM_VALUE;
+        event.param_id        = parameter;
+        event.note_id         = -1;
+        event.port_index      = -1;
+        event.channel         = -1;
+        event.key             = -1;
+        event.value           = value;
+        events.push_back (event);
+    }
+
+    void clear() { events.clear(); }
+
+    const clap_input_events_t* get() const { return &list; }
+
+private:
+    clap_input_events_t list {};
+    std::vector<clap_event_param_value_t> events;
+};
+
+/** Creates and initialises a plugin instance through the factory and destroys it again */
+class PluginInstance
+{
+public:
+    PluginInstance (const clap_plugin_factory_t& factory, bool provideThreadPool) : host (provideThreadPool)
+    {
+        plugin = factory.create_plugin (&factory, host.get(), factory.get_plugin_descriptor (&factory, 0)->id);
+
+        if (plugin == nullptr || ! plugin->init (plugin))
+            return;
+
+        params     = static_cast<const clap_plugin_params_t*>      (plugin->get_extension (plugin, CLAP_EXT_PARAMS));
+        audioPorts = static_cast<const clap_plugin_audio_ports_t*> (plugin->get_extension (plugin, CLAP_EXT_AUDIO_PORTS));
+        state      = static_cast<const clap_plugin_state_t*>       (plugin->get_extension (plugin, CLAP_EXT_STATE));
+        latency    = static_cast<const clap_plugin_latency_t*>     (plugin->get_extension (plugin, CLAP_EXT_LATENCY));
+
+        host.plugin = plugin;
+        host.pluginThreadPool = static_cast<const clap_plugin_thread_pool_t*> (plugin->get_extension (plugin, CLAP_EXT_THREAD_POOL));
+
+        valid = params != nullptr && audioPorts != nullptr && state != nullptr && latency != nullptr;
+    }
+
+    ~PluginInstance()
+    {
+        if (plugin == nullptr)
+            return;
+
+        if (active)
+            plugin->deactivate (plugin);
+
+        plugin->destroy (plugin);
+    }
+
+    bool isValid() const { return valid; }
+
+    bool activate()
+    {
+        active = plugin->activate (plugin, sampleRate, 1, maxBlockSize);
+        return active && plugin->start_processing (plugin);
+    }
+
+    /**
+     * Processes the stereo input in blocks of the given size and returns the output. The automation has to be sorted
+     * by sample position, each change is sent as event at its offset in the block that contains it.
+     */
+    std::vector<std::vector<float>> render (const std::vector<float>& input, uint32_t blockSize, const std::vector<Automation>& automation)
+    {
+        std::vector<std::vector<float>> output (numChannels, std::vector<float> (input.size()));
+        std::vector<std::vector<float>> inputChannels (numChannels, input);
+
+        auto nextAutomation = automation.begin();
+        EventList events;
+
+        clap_output_events_t outEvents {};
+        outEvents.try_push = [] (const clap_output_events_t*, const clap_event_header_t*) { return true; };
+
+        for (size_t position = 0; position < input.size(); position += blockSize)
+        {
+            const auto numFrames = static_cast<uint32_t> (std::min (size_t (blockSize), input.size() - position));
+
+            events.clear();
+            for (; nextAutomation != automation.end() && nextAutomation->sample < position + numFrames; ++nextAutomation)
+                events.add (static_cast<uint32_t> (nextAutomation->sample - position), nextAutomation->parameter, nextAutomation->value);
+
+            float* in[numChannels];
+            float* out[numChannels];
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+            {
+                in[ch]  = inputChannels[ch].data() + position;
+                out[ch] = output[ch].data() + position;
+            }
+
+            clap_audio_buffer_t inputBuffer  { in,  nullptr, numChannels, 0, 0 };
+            clap_audio_buffer_t outputBuffer { out, nullptr, numChannels, 0, 0 };
+
+            clap_process_t process {};
+            process.steady_time         = static_cast<int64_t> (position);
+            process.frames_count        = numFrames;
+            process.audio_inputs        = &inputBuffer;
+            process.audio_outputs       = &outputBuffer;
+            process.audio_inputs_count  = 1;
+            process.audio_outputs_count = 1;
+            process.in_events           = events.get();
+            process.out_events          = &outEvents;
+
+            if (plugin->process (plugin, &process) != CLAP_PROCESS_CONTINUE)
+                return {};
+        }
+
+        return output;
+    }
+
+    Host host;
+    const clap_plugin_t* plugin = nullptr;
+    const clap_plugin_params_t* params = nullptr;
+    const clap_plugin_audio_ports_t* audioPorts = nullptr;
+    const clap_plugin_state_t* state = nullptr;
+    const clap_plugin_latency_t* latency = nullptr;
+
+private:
+    bool valid = false;
+    bool active = false;
+};
+
+//======================================================================================================================
+static std::vector<float> createInput()
+{
+    // A decaying pluck-like tone, so that the chain is driven at several levels
+    std::vector<float> input (numRenderSamples);
+
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        const auto t = static_cast<double> (i) / sampleRate;
+        input[i] = static_cast<float> (0.5 * std::exp (-3.0 * t) * (std::sin (juce::MathConstants<double>::twoPi * 110.0 * t) + 0.3 * std::sin (juce::MathConstants<double>::twoPi * 330.0 * t)));
+    }
+
+    return input;
+}
+
+/** Returns the index of the first sample where both renders differ or the render length if they are identical */
+static size_t findFirstDifference (const std::vector<std::vector<float>>& a, const std::vector<std::vector<float>>& b)
+{
+    auto first = numRenderSamples;
+
+    for (size_t ch = 0; ch < numChannels; ++ch)
+        for (size_t i = 0; i < first; ++i)
+            if (a[ch][i] != b[ch][i])
+                first = i;
+
+    return first;
+}
+
+static bool isValidOutput (const std::vector<std::vector<float>>& output)
+{
+    if (output.size() != numChannels)
+        return false;
+
+    auto peak = 0.0f;
+
+    for (auto& channel : output)
+        for (auto sample : channel)
+        {
+            if (! std::isfinite (sample))
+                return false;
+
+            peak = std::max (peak, std::abs (sample));
+        }
+
+    return peak > 1e-4f;
+}
+
+/** Byte streams for the state extension */
+struct MemoryStream
+{
+    std::vector<char> data;
+    size_t readPosition = 0;
+
+    clap_ostream_t getOutputStream()
+    {
+        clap_ostream_t stream { this, nullptr };
+        stream.write = [] (const clap_ostream_t* s, const void* buffer, uint64_t size) -> int64_t
+        {
+            auto& self = *static_cast<MemoryStream*> (s->ctx);
+            self.data.insert (self.data.end(), static_cast<const char*> (buffer), static_cast<const char*> (buffer) + size);
+            return static_cast<int64_t> (size);
+        };
+        return stream;
+    }
+
+    clap_istream_t getInputStream()
+    {
+        clap_istream_t stream { this, nullptr };
+        stream.read = [] (const clap_istream_t* s, void* buffer, uint64_t size) -> int64_t
+        {
+            auto& self = *static_cast<MemoryStream*> (s->ctx);
+            const auto n = std::min (static_cast<size_t> (size), self.data.size() - self.readPosition);
+            std::memcpy (buffer, self.data.data() + self.readPosition, n);
+            self.readPosition += n;
+            return static_cast<int64_t> (n);
+        };
+        return stream;
+    }
+};
+
+int main (int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <path to the plugin binary>" << std::endl;
+        return 1;
+    }
+
+    juce::DynamicLibrary library;
+
+    if (! library.open (argv[1]))
+    {
+        std::cerr << "Could not load " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const auto* entry = static_cast<const clap_plugin_entry_t*> (library.getFunction ("clap_entry"));
+
+    if (entry == nullptr || ! entry->init (argv[1]))
+    {
+        std::cerr << "No valid clap_entry found in " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const auto* factory = static_cast<const clap_plugin_factory_t*> (entry->get_factory (CLAP_PLUGIN_FACTORY_ID));
+
+    int numFailures = 0;
+
+    auto check = [&numFailures] (bool passed, const std::string& name, const std::string& details = {})
+    {
+        std::cout << (passed ? "[PASS] " : "[FAIL] ") << name << (details.empty() ? "" : " (" + details + ")") << std::endl;
+
+        if (! passed)
+            ++numFailures;
+
+        return passed;
+    };
+
+    if (! check (factory != nullptr && factory->get_plugin_count (factory) == 1, "Factory provides one plugin"))
+        return 1;
+
+    {
+        PluginInstance instance (*factory, false);
+
+        if (! check (instance.isValid(), "Plugin provides the params, audio-ports, state and latency extensions"))
+            return 1;
+
+        check (instance.params->count (instance.plugin) == 4, "Plugin has four parameters");
+        check (instance.audioPorts->count (instance.plugin, true) == 1 && instance.audioPorts->count (instance.plugin, false) == 1, "Plugin has one input and one output port");
+        check (instance.activate(), "Plugin activates");
+    }
+
+    const auto input = createInput();
+
+    // The drive is raised half way through a block of the reference block size
+    const size_t eventSample = 12345;
+    const std::vector<Automation> automation { { eventSample, 0, 9.0 }, { eventSample + 1000, 1, 2.0 }, { eventSample + 1001, 3, 1.0 } };
+
+    auto renderWith = [&] (bool provideThreadPool, uint32_t blockSize, const std::vector<Automation>& changes, size_t* numExecutedTasks = nullptr)
+    {
+        PluginInstance instance (*factory, provideThreadPool);
+        instance.activate();
+        auto output = instance.render (input, blockSize, changes);
+
+        if (numExecutedTasks != nullptr)
+            *numExecutedTasks = instance.host.numExecutedTasks;
+
+        return output;
+    };
+
+    const auto unchanged  = renderWith (false, 256, {});
+    const auto reference  = renderWith (false, 256, automation);
+
+    check (isValidOutput (unchanged) && isValidOutput (reference), "Output is finite and not silent");
+
+    const auto firstDifference = findFirstDifference (unchanged, reference);
+    check (firstDifference >= eventSample && firstDifference < numRenderSamples,
+           "Output changes at the event and not before it",
+           "event at " + std::to_string (eventSample) + ", first change at " + std::to_string (firstDifference));
+
+    for (uint32_t blockSize : { 61u, 100u, 333u, 512u })
+    {
+        const auto output = renderWith (false, blockSize, automation);
+        check (! output.empty() && findFirstDifference (output, reference) == numRenderSamples,
+               "Block size " + std::to_string (blockSize) + " matches block size 256 bit exactly");
+    }
+
+    size_t numExecutedTasks = 0;
+    const auto threaded = renderWith (true, 256, automation, &numExecutedTasks);
+    check (numExecutedTasks > 0, "Host thread pool was used", std::to_string (numExecutedTasks) + " tasks");
+    check (! threaded.empty() && findFirstDifference (threaded, reference) == numRenderSamples, "Thread pool processing matches serial processing bit exactly");
+
+    {
+        PluginInstance source (*factory, false);
+        source.activate();
+        source.render (input, 256, automation);
+
+        MemoryStream stream;
+        const auto outputStream = stream.getOutputStream();
+        const auto inputStream  = stream.getInputStream();
+
+        PluginInstance destination (*factory, false);
+        auto restored = source.state->save (source.plugin, &outputStream) && destination.state->load (destination.plugin, &inputStream);
+
+        for (clap_id id = 0; id < 4; ++id)
+        {
+            double a = 0.0, b = 0.0;
+            restored = restored && source.params->get_value (source.plugin, id, &a) && destination.params->get_value (destination.plugin, id, &b) && a == b;
+        }
+
+        double drive = 0.0;
+        check (restored && destination.params->get_value (destination.plugin, 0, &drive) && drive == 9.0, "Saved state restores all parameters");
+    }
+
+    entry->deinit();
+
+    std::cout << (numFailures == 0 ? "All checks passed" : std::to_string (numFailures) + " check(s) failed") << std::endl;
+    return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDCore.h"
+#include "FlightRecorder.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Replays a dump written by the FlightRecorder of the plugin through the OJD core, block by block with the recorded
+ * block sizes, parameter targets, morph times, oversampling orders and quality levels. The replay is repeated and the
+ * processing time of each block is reported next to the time it took in the plugin, so that a profiler attached to this
+ * tool sees the same work the plugin did when the dump was written. The cabinet stage of the plugin is not part of the
+ * replay.
+ *
+ * Each core starts with the target of the first block, the filter states the plugin had before the recorded history
+ * are not part of the dump. All repetitions have to produce bit identical output, the tool fails otherwise.
+ *
+ * Usage: OJD-FlightRecorderReplay <dump file> [--iterations=<n>] [--blocks] [--output=<file>]
+ *
+ * --iterations number of replays, defaults to 10
+ * --blocks     prints the recorded and replayed times of each block instead of a summary only
+ * --output     writes the output of the first replay to an audio file
+ */
+
+static juce::AudioBuffer<float> replay (const FlightRecorder::Recording& recording, std::vector<double>& processingTimesMs)
+{
+    const auto& blocks = recording.blocks;
+    const auto numChannels = recording.audio.getNumChannels();
+
+    int maxBlockSize = 1;
+    for (auto& block : blocks)
+        maxBlockSize = juce::jmax (maxBlockSize, block.numSamples);
+
+    OJDCore core;
+    core.setChainParameters (blocks.front().target, 0.0);
+    core.setOversamplingOrder (blocks.front().oversamplingOrder);
+    core.prepare (recording.sampleRate, maxBlockSize, numChannels);
+
+    auto output = recording.audio;
+    processingTimesMs.resize (blocks.size());
+
+    int position = 0;
+
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        const auto& block = blocks[b];
+
+        // Changing the order is not real time safe in the plugin either, it only happens when it is prepared again
+        if (block.oversamplingOrder != core.getOversamplingOrder())
+        {
+            core.setOversamplingOrder (block.oversamplingOrder);
+            core.prepare (recording.sampleRate, maxBlockSize, numChannels);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        core.setChainParameters (block.target, static_cast<double> (block.morphTimeInSeconds));
+        // The recorded level is the one the block was processed with. The core warms a requested level up before
+        // switching to it, so with blocks shorter than the warm up the replay reaches it a few blocks later
+        core.setQualityLevel (block.qualityLevel);
+        core.process (juce::dsp::AudioBlock<float> (output).getSubBlock (static_cast<size_t> (position), static_cast<size_t> (block.numSamples)));
+
+        processingTimesMs[b] = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - start).count();
+        position += block.numSamples;
+    }
+
+    return output;
+}
+
+static double percentile (std::vector<double> values, double p)
+{
+    std::sort (values.begin(), values.end());
+    const auto index = static_cast<size_t> (std::ceil (p * static_cast<double> (values.size()))) - 1;
+    return values[juce::jlimit<size_t> (0, values.size() - 1, index)];
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+
+    juce::StringArray files;
+    for (auto& arg : args.arguments)
+        if (! arg.isOption())
+            files.add (arg.text);
+
+    if (files.size() != 1)
+    {
+        std::cerr << "Usage: " << args.executableName << " <dump file> [options], see the source for all options" << std::endl;
+        return 1;
+    }
+
+    const auto dumpFile = juce::File::getCurrentWorkingDirectory().getChildFile (files[0]);
+
+    FlightRecorder::Recording recording;
+    juce::FileInputStream stream (dumpFile);
+
+    if (! stream.openedOk() || ! FlightRecorder::readDump (stream, recording) || recording.blocks.empty())
+    {
+        std::cerr << "Could not read a flight recording from " << dumpFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    const auto& blocks = recording.blocks;
+    const auto numIterations = args.containsOption ("--iterations") ? juce::jmax (1, args.getValueForOption ("--iterations").getIntValue()) : 10;
+
+    std::cout << blocks.size() << " blocks, " << recording.audio.getNumChannels() << " channels, "
+              << recording.audio.getNumSamples() / recording.sampleRate << " s at " << recording.sampleRate << " Hz, "
+              << (recording.trigger == FlightRecorder::Trigger::missedDeadline ? "dumped after a missed deadline" : "dumped on request") << std::endl;
+
+    // The replayed time of a block is the fastest of all iterations, which leaves out interruptions of this process
+    std::vector<double> fastestTimesMs (blocks.size(), std::numeric_limits<double>::max());
+    std::vector<double> timesMs;
+    juce::AudioBuffer<float> firstOutput;
+    auto isDeterministic = true;
+
+    for (int iteration = 0; iteration < numIterations; ++iteration)
+    {
+        auto output = replay (recording, timesMs);
+
+        for (size_t b = 0; b < blocks.size(); ++b)
+            fastestTimesMs[b] = juce::jmin (fastestTimesMs[b], timesMs[b]);
+
+        if (iteration == 0)
+        {
+            firstOutput = std::move (output);
+            continue;
+        }
+
+        for (int ch = 0; ch < output.getNumChannels(); ++ch)
+            if (std::memcmp (output.getReadPointer (ch), firstOutput.getReadPointer (ch), sizeof (float) * static_cast<size_t> (output.getNumSamples())) != 0)
+                isDeterministic = false;
+    }
+
+    std::vector<double> recordedTimesMs;
+    size_t slowestBlock = 0;
+    int numMissedDeadlines = 0;
+
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        const auto& block = blocks[b];
+        const auto deadlineMs = 1000.0 * block.numSamples / recording.sampleRate;
+
+        recordedTimesMs.push_back (block.processingTimeMs);
+
+        if (block.processingTimeMs > deadlineMs)
+            ++numMissedDeadlines;
+
+        if (block.processingTimeMs > blocks[slowestBlock].processingTimeMs)
+            slowestBlock = b;
+
+        if (args.containsOption ("--blocks"))
+            std::cout << "block " << b << ": " << block.numSamples << " samples, order " << block.oversamplingOrder
+                      << ", quality level " << block.qualityLevel
+                      << ", drive " << block.rawParameterValues[0] << ", tone " << block.rawParameterValues[1]
+                      << ", volume " << block.rawParameterValues[2] << ", hp/lp " << block.rawParameterValues[3]
+                      << ", recorded " << block.processingTimeMs << " ms, replayed " << fastestTimesMs[b] << " ms" << std::endl;
+    }
+
+    std::cout << "Recorded: median " << percentile (recordedTimesMs, 0.5) << " ms, p95 " << percentile (recordedTimesMs, 0.95)
+              << " ms, max " << recordedTimesMs[slowestBlock] << " ms in block " << slowestBlock << ", "
+              << numMissedDeadlines << " missed deadlines" << std::endl;
+
+    std::cout << "Replayed: median " << percentile (fastestTimesMs, 0.5) << " ms, p95 " << percentile (fastestTimesMs, 0.95)
+              << " ms, block " << slowestBlock << " took " << fastestTimesMs[slowestBlock] << " ms" << std::endl;
+
+    if (args.containsOption ("--output"))
+    {
+        const auto outputFile = juce::File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--output"));
+
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        auto* format = formatManager.findFormatForFileExtension (outputFile.getFileExtension());
+
+        if (format == nullptr)
+        {
+            std::cerr << "Unsupported output format " << outputFile.getFileExtension() << std::endl;
+            return 1;
+        }
+
+        outputFile.deleteFile();
+        auto outputStream = outputFile.createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer (format->createWriterFor (outputStream.get(),
+                                                                                  recording.sampleRate,
+                                                                                  static_cast<unsigned int> (firstOutput.getNumChannels()),
+                                                                                  24,
+                                                                                  {},
+                                                                                  0));
+
+        // The writer owns the stream once it has been created successfully
+        if (writer != nullptr)
+            outputStream.release();
+
+        if (writer == nullptr || ! writer->writeFromAudioSampleBuffer (firstOutput, 0, firstOutput.getNumSamples()))
+        {
+            std::cerr << "Could not write " << outputFile.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+
+    if (! isDeterministic)
+    {
+        std::cerr << "The replays produced different output" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
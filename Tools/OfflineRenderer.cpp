@@ -0,0 +1,302 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDCore.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Renders an audio file through the OJD core. The file is split into segments which are rendered concurrently on
+ * separate core instances. Each segment starts processing some pre-roll samples before its actual start, so that the
+ * state of all filters has converged by the time the first sample of the segment is written. The chain has no long
+ * memory, so the stitched result matches a serial render up to tiny deviations if the pre-roll is long enough.
+ *
+ * The latency of the oversampling is compensated, the output is aligned with the input.
+ *
+ * Usage: OJD-OfflineRenderer <input file> <output file>
+ *                            [--drive=<0..10>] [--tone=<0..10>] [--volume=<0..10>] [--hplp=<0|1>]
+ *                            [--threads=<n>] [--segments=<n>] [--preroll=<seconds>] [--block-size=<n>] [--verify]
+ *
+ * --threads    number of worker threads, defaults to the number of CPU cores
+ * --segments   number of segments the file is split into, defaults to the number of threads
+ * --preroll    length of the pre-roll in seconds, defaults to 0.5
+ * --verify     additionally renders the file serially and reports the maximum deviation of the segmented render
+ */
+
+struct RenderSettings
+{
+    double sampleRate = 48000.0;
+    int numChannels   = 2;
+    int blockSize     = 512;
+
+    OJDCore::Parameters parameters;
+};
+
+static std::unique_ptr<OJDCore> createCore (const RenderSettings& settings)
+{
+    auto core = std::make_unique<OJDCore>();
+
+    // Parameters are set before preparing, so that the core starts with them instead of morphing towards them
+    core->setParameters (settings.parameters, 0.0);
+    core->prepare (settings.sampleRate, settings.blockSize, settings.numChannels);
+
+    return core;
+}
+
+/**
+ * Renders numOutputSamples samples starting at outputStart in the input file to the output channels. Processing
+ * starts preRollSamples before outputStart or at the file start and continues for the latency of the core after
+ * the last output sample, reading zeros beyond the end of the file.
+ */
+static void renderRange (OJDCore& core,
+                         juce::AudioFormatReader& reader,
+                         float* const* outputChannels,
+                         juce::int64 outputStart,
+                         juce::int64 numOutputSamples,
+                         juce::int64 preRollSamples,
+                         const RenderSettings& settings)
+{
+    const auto latency    = static_cast<juce::int64> (core.getLatencyInSamples());
+    const auto outputEnd  = outputStart + numOutputSamples;
+    const auto processEnd = outputEnd + latency;
+
+    juce::AudioBuffer<float> buffer (settings.numChannels, settings.blockSize);
+
+    for (auto position = juce::jmax (juce::int64 (0), outputStart - preRollSamples); position < processEnd;)
+    {
+        const auto numSamples = static_cast<int> (juce::jmin (juce::int64 (settings.blockSize), processEnd - position));
+
+        // Referring to the preallocated channels, a smaller last block must not reallocate the buffer
+        juce::AudioBuffer<float> block (buffer.getArrayOfWritePointers(), settings.numChannels, numSamples);
+        reader.read (&block, 0, numSamples, position, true, true);
+
+        core.process (block.getArrayOfWritePointers(), settings.numChannels, numSamples);
+
+        // The sample processed at position + i belongs to the input sample at position + i - latency
+        const auto first = juce::jmax (position - latency, outputStart);
+        const auto last  = juce::jmin (position - latency + numSamples, outputEnd);
+
+        for (auto t = first; t < last; ++t)
+            for (int ch = 0; ch < settings.numChannels; ++ch)
+                outputChannels[ch][t - outputStart] = block.getSample (ch, static_cast<int> (t - position + latency));
+
+        position += numSamples;
+    }
+}
+
+static juce::AudioBuffer<float> renderSerial (juce::AudioFormatManager& formatManager, const juce::File& input, juce::int64 numSamples, const RenderSettings& settings)
+{
+    juce::AudioBuffer<float> output (settings.numChannels, static_cast<int> (numSamples));
+
+    std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (input));
+    auto core = createCore (settings);
+
+    renderRange (*core, *reader, output.getArrayOfWritePointers(), 0, numSamples, 0, settings);
+    return output;
+}
+
+static juce::AudioBuffer<float> renderSegmented (juce::AudioFormatManager& formatManager,
+                                                 const juce::File& input,
+                                                 juce::int64 numSamples,
+                                                 int numThreads,
+                                                 int numSegments,
+                                                 juce::int64 preRollSamples,
+                                                 const RenderSettings& settings)
+{
+    juce::AudioBuffer<float> output (settings.numChannels, static_cast<int> (numSamples));
+
+    const auto segmentLength = (numSamples + numSegments - 1) / numSegments;
+
+    // Cores and readers are created up front, the worker threads only render
+    std::vector<std::unique_ptr<OJDCore>> cores;
+    std::vector<std::unique_ptr<juce::AudioFormatReader>> readers;
+
+    for (int i = 0; i < numSegments; ++i)
+    {
+        cores.push_back (createCore (settings));
+        readers.emplace_back (formatManager.createReaderFor (input));
+    }
+
+    // Fetched once here, the worker threads must not touch the buffer object itself
+    auto* const* outputChannels = output.getArrayOfWritePointers();
+
+    juce::ThreadPool threadPool (numThreads);
+    juce::WaitableEvent allSegmentsDone;
+    std::atomic<int> numSegmentsLeft { numSegments };
+
+    for (int i = 0; i < numSegments; ++i)
+    {
+        threadPool.addJob ([&, i]
+        {
+            const auto start  = i * segmentLength;
+            const auto length = juce::jmin (segmentLength, numSamples - start);
+
+            if (length > 0)
+            {
+                // Each segment writes to its own region of the output buffer
+                std::vector<float*> channels;
+                for (int ch = 0; ch < settings.numChannels; ++ch)
+                    channels.push_back (outputChannels[ch] + start);
+
+                renderRange (*cores[static_cast<size_t> (i)], *readers[static_cast<size_t> (i)], channels.data(), start, length, preRollSamples, settings);
+            }
+
+            if (--numSegmentsLeft == 0)
+                allSegmentsDone.signal();
+        });
+    }
+
+    allSegmentsDone.wait();
+    return output;
+}
+
+static double secondsSince (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+
+    juce::StringArray files;
+    for (auto& arg : args.arguments)
+        if (! arg.isOption())
+            files.add (arg.text);
+
+    if (files.size() != 2)
+    {
+        std::cerr << "Usage: " << args.executableName << " <input file> <output file> [options], see the source for all options" << std::endl;
+        return 1;
+    }
+
+    auto input  = juce::File::getCurrentWorkingDirectory().getChildFile (files[0]);
+    auto output = juce::File::getCurrentWorkingDirectory().getChildFile (files[1]);
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (input));
+
+    if (reader == nullptr)
+    {
+        std::cerr << "Could not read " << input.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    // The plugin supports mono and stereo layouts only, so does the renderer
+    if (reader->numChannels < 1 || reader->numChannels > 2)
+    {
+        std::cerr << "Only mono and stereo files are supported" << std::endl;
+        return 1;
+    }
+
+    auto intOption = [&] (const juce::String& option, int defaultValue)
+    {
+        return args.containsOption (option) ? juce::jmax (1, args.getValueForOption (option).getIntValue()) : defaultValue;
+    };
+
+    RenderSettings settings;
+    settings.sampleRate  = reader->sampleRate;
+    settings.numChannels = static_cast<int> (reader->numChannels);
+    settings.blockSize   = intOption ("--block-size", 512);
+
+    auto knobOption = [&] (const juce::String& option, float& value)
+    {
+        if (args.containsOption (option))
+            value = juce::jlimit (OJDCore::minKnobValue, OJDCore::maxKnobValue, args.getValueForOption (option).getFloatValue());
+    };
+
+    knobOption ("--drive",  settings.parameters.drive);
+    knobOption ("--tone",   settings.parameters.tone);
+    knobOption ("--volume", settings.parameters.volume);
+
+    if (args.containsOption ("--hplp"))
+        settings.parameters.hpMode = args.getValueForOption ("--hplp").getIntValue() != 0;
+
+    const auto numThreads  = intOption ("--threads", juce::SystemStats::getNumCpus());
+    const auto numSegments = intOption ("--segments", numThreads);
+
+    const auto preRollSeconds = args.containsOption ("--preroll") ? args.getValueForOption ("--preroll").getDoubleValue() : 0.5;
+    const auto preRollSamples = static_cast<juce::int64> (preRollSeconds * settings.sampleRate);
+
+    const auto numSamples = reader->lengthInSamples;
+
+    if (numSamples > std::numeric_limits<int>::max())
+    {
+        std::cerr << "The file is too long to be rendered in one go" << std::endl;
+        return 1;
+    }
+
+    const auto segmentedStart = std::chrono::steady_clock::now();
+    auto rendered = renderSegmented (formatManager, input, numSamples, numThreads, numSegments, preRollSamples, settings);
+    const auto segmentedSeconds = secondsSince (segmentedStart);
+
+    std::cout << "Rendered " << numSamples << " samples in " << numSegments << " segments on " << numThreads
+              << " threads in " << segmentedSeconds << " s" << std::endl;
+
+    if (args.containsOption ("--verify"))
+    {
+        const auto serialStart = std::chrono::steady_clock::now();
+        auto serial = renderSerial (formatManager, input, numSamples, settings);
+        const auto serialSeconds = secondsSince (serialStart);
+
+        float maxDeviation = 0.0f;
+        for (int ch = 0; ch < settings.numChannels; ++ch)
+            for (int i = 0; i < serial.getNumSamples(); ++i)
+                maxDeviation = juce::jmax (maxDeviation, std::abs (serial.getSample (ch, i) - rendered.getSample (ch, i)));
+
+        std::cout << "Serial render took " << serialSeconds << " s, speedup " << serialSeconds / segmentedSeconds << std::endl;
+        std::cout << "Maximum deviation from serial render: " << maxDeviation
+                  << " (" << juce::Decibels::gainToDecibels (maxDeviation) << " dBFS)" << std::endl;
+    }
+
+    auto* format = formatManager.findFormatForFileExtension (output.getFileExtension());
+
+    if (format == nullptr)
+    {
+        std::cerr << "Unsupported output format " << output.getFileExtension() << std::endl;
+        return 1;
+    }
+
+    const auto bitDepth = format->getPossibleBitDepths().contains (static_cast<int> (reader->bitsPerSample)) ? static_cast<int> (reader->bitsPerSample) : 24;
+
+    output.deleteFile();
+    auto stream = output.createOutputStream();
+    std::unique_ptr<juce::AudioFormatWriter> writer (format->createWriterFor (stream.get(),
+                                                                              settings.sampleRate,
+                                                                              static_cast<unsigned int> (settings.numChannels),
+                                                                              bitDepth,
+                                                                              {},
+                                                                              0));
+
+    // The writer owns the stream once it has been created successfully
+    if (writer != nullptr)
+        stream.release();
+
+    if (writer == nullptr || ! writer->writeFromAudioSampleBuffer (rendered, 0, rendered.getNumSamples()))
+    {
+        std::cerr << "Could not write " << output.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,450 @@
+/*
+
+This file is part of the Schrammel OJD audio plugin.
+Copyright (C) 2020  Janos Buttgereit
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+
+ */
+
+#include "OJDCore.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Measures the aliasing and distortion of the OJD core for different oversampling orders, so that any change to the
+ * oversampling or the filters can be judged by its cost and its quality at once.
+ *
+ * Every configuration of sample rate, oversampling order, Drive and HP / LP mode is driven with a stepped sine sweep and
+ * a multitone signal. All test frequencies are snapped to FFT bins, so that harmonics and their aliases fall onto exact
+ * bins too. For each sine, the output spectrum is split into the fundamental, the harmonics below Nyquist, the aliases
+ * of the harmonics above Nyquist and everything else, which gives
+ *
+ * - the aliasing to signal ratio (ASR), the power of all aliased harmonics relative to the fundamental
+ * - THD+N, the power of everything but the fundamental relative to the fundamental
+ * - the noise floor, the power of everything that is neither the fundamental, a harmonic nor an alias, relative to the
+ *   fundamental
+ *
+ * For the multitone signal, everything but the tones is reported as TD+N. The CPU cost of each configuration is the
+ * time spent processing relative to the duration of the processed audio. The per configuration summary puts both next
+ * to each other, e.g. to plot CPU cost against the worst case ASR for each oversampling order.
+ *
+ * Usage: OJD-QualityAnalyser [--sample-rates=<list>] [--orders=<list>] [--drives=<list of 0..10>] [--hplp=<list of 0|1>]
+ *                            [--steps=<n>] [--level=<peak>] [--block-size=<n>] [--output=<json file>] [--csv=<prefix>]
+ *
+ * Lists are comma separated, e.g. --orders=2,3,4. The defaults are --sample-rates=44100,48000,96000,
+ * --orders=0,1,2,3,4,5, --drives=0,5,10, --hplp=0,1, --steps=16 sweep frequencies from 100 Hz to 16 kHz and
+ * --level=0.5. The results are printed as JSON unless --output is given, --csv additionally writes
+ * <prefix>-measurements.csv and <prefix>-configurations.csv.
+ */
+
+struct Configuration
+{
+    double sampleRate = 48000.0;
+    int oversamplingOrder = 4;
+    float drive = 5.0f;
+    bool hpMode = false;
+};
+
+struct Measurement
+{
+    juce::String signal;
+    double frequency = 0.0;
+    double asrDb     = 0.0;
+    double thdnDb    = 0.0;
+    double noiseDb   = 0.0;
+};
+
+struct ConfigurationSummary
+{
+    Configuration configuration;
+    double cpuPercent     = 0.0;
+    double worstAsrDb     = -1000.0;
+    double meanThdnDb     = 0.0;
+    double multitoneTdnDb = 0.0;
+};
+
+static constexpr int fftOrder = 14;
+static constexpr size_t fftSize = size_t (1) << fftOrder;
+
+// Half the main lobe width of the Blackman-Harris window in bins, all components are measured over this many bins
+// around their centre
+static constexpr size_t lobeHalfWidth = 4;
+
+static constexpr double settleSeconds = 0.5;
+
+static double toDb (double powerRatio)
+{
+    return 10.0 * std::log10 (juce::jmax (powerRatio, 1e-30));
+}
+
+/**
+ * Renders the signal through a mono core of the given configuration. The first settleSeconds are processed but
+ * discarded, then fftSize samples are returned. The time spent processing is added to processingSeconds.
+ */
+template <typename SignalFn>
+static std::vector<float> render (const Configuration& config, int blockSize, SignalFn&& signal, double& processingSeconds)
+{
+    OJDCore core;
+
+    OJDCore::Parameters parameters;
+    parameters.drive  = config.drive;
+    parameters.volume = OJDCore::maxKnobValue;
+    parameters.hpMode = config.hpMode;
+
+    core.setOversamplingOrder (config.oversamplingOrder);
+    core.setParameters (parameters, 0.0);
+    core.prepare (config.sampleRate, blockSize, 1);
+
+    const auto numSettleSamples = static_cast<size_t> (settleSeconds * config.sampleRate);
+    const auto numSamples = numSettleSamples + fftSize;
+
+    std::vector<float> samples (numSamples);
+
+    for (size_t i = 0; i < numSamples; ++i)
+        samples[i] = signal (i);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t pos = 0; pos < numSamples; pos += static_cast<size_t> (blockSize))
+    {
+        float* channels[] = { samples.data() + pos };
+        core.process (channels, 1, static_cast<int> (juce::jmin (static_cast<size_t> (blockSize), numSamples - pos)));
+    }
+
+    processingSeconds += std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+
+    return std::vector<float> (samples.begin() + static_cast<std::ptrdiff_t> (numSettleSamples), samples.end());
+}
+
+/** Returns the power of bins 0 to fftSize / 2 of the windowed samples */
+static std::vector<double> computePowerSpectrum (const std::vector<float>& samples)
+{
+    static juce::dsp::FFT fft (fftOrder);
+    static juce::dsp::WindowingFunction<float> window (fftSize, juce::dsp::WindowingFunction<float>::blackmanHarris, false);
+
+    std::vector<float> data (2 * fftSize, 0.0f);
+    std::copy (samples.begin(), samples.end(), data.begin());
+
+    window.multiplyWithWindowingTable (data.data(), fftSize);
+    fft.performFrequencyOnlyForwardTransform (data.data());
+
+    std::vector<double> power (fftSize / 2 + 1);
+
+    for (size_t i = 0; i < power.size(); ++i)
+        power[i] = static_cast<double> (data[i]) * static_cast<double> (data[i]);
+
+    return power;
+}
+
+/** Sorts every bin of a spectrum into one of these classes. Bins keep the first class they are assigned */
+class BinClassification
+{
+public:
+    enum Class { unclassified, dc, tone, harmonic, alias };
+
+    BinClassification() : classes (fftSize / 2 + 1, unclassified)
+    {
+        mark (0, dc);
+    }
+
+    void mark (size_t centreBin, Class binClass)
+    {
+        const auto first = centreBin > lobeHalfWidth ? centreBin - lobeHalfWidth : 0;
+        const auto last  = juce::jmin (centreBin + lobeHalfWidth, classes.size() - 1);
+
+        for (auto bin = first; bin <= last; ++bin)
+            if (classes[bin] == unclassified)
+                classes[bin] = binClass;
+    }
+
+    /** Returns the summed power of all bins of the class */
+    double sum (const std::vector<double>& power, Class binClass) const
+    {
+        auto result = 0.0;
+
+        for (size_t bin = 0; bin < classes.size(); ++bin)
+            if (classes[bin] == binClass)
+                result += power[bin];
+
+        return result;
+    }
+
+private:
+    std::vector<Class> classes;
+};
+
+/** Returns the bin closest to the given frequency, keeping a few bins distance to DC and Nyquist */
+static size_t frequencyToBin (double frequency, double sampleRate)
+{
+    const auto bin = static_cast<size_t> (std::round (frequency * static_cast<double> (fftSize) / sampleRate));
+    return juce::jlimit (2 * lobeHalfWidth + 1, fftSize / 2 - 2 * lobeHalfWidth, bin);
+}
+
+static double binToFrequency (size_t bin, double sampleRate)
+{
+    return static_cast<double> (bin) * sampleRate / static_cast<double> (fftSize);
+}
+
+static Measurement measureSine (const Configuration& config, double frequency, float level, int blockSize, double& processingSeconds)
+{
+    const auto bin = frequencyToBin (frequency, config.sampleRate);
+    const auto omega = juce::MathConstants<double>::twoPi * static_cast<double> (bin) / static_cast<double> (fftSize);
+
+    const auto output = render (config, blockSize, [&] (size_t i) { return level * static_cast<float> (std::sin (omega * static_cast<double> (i))); }, processingSeconds);
+    const auto power = computePowerSpectrum (output);
+
+    BinClassification classification;
+    classification.mark (bin, BinClassification::tone);
+
+    // Harmonics above Nyquist fold back into the spectrum, those up to 32 times the sample rate are considered
+    const auto nyquistBin = fftSize / 2;
+    const auto numHarmonics = juce::jmin (size_t (1000), 32 * fftSize / bin);
+
+    for (size_t h = 2; h <= numHarmonics; ++h)
+    {
+        const auto harmonicBin = h * bin;
+
+        if (harmonicBin <= nyquistBin)
+        {
+            classification.mark (harmonicBin, BinClassification::harmonic);
+            continue;
+        }
+
+        auto foldedBin = harmonicBin % fftSize;
+        if (foldedBin > nyquistBin)
+            foldedBin = fftSize - foldedBin;
+
+        classification.mark (foldedBin, BinClassification::alias);
+    }
+
+    const auto tonePower     = classification.sum (power, BinClassification::tone);
+    const auto harmonicPower = classification.sum (power, BinClassification::harmonic);
+    const auto aliasPower    = classification.sum (power, BinClassification::alias);
+    const auto noisePower    = classification.sum (power, BinClassification::unclassified);
+
+    Measurement measurement;
+    measurement.signal    = "sine";
+    measurement.frequency = binToFrequency (bin, config.sampleRate);
+    measurement.asrDb     = toDb (aliasPower / tonePower);
+    measurement.thdnDb    = toDb ((harmonicPower + aliasPower + noisePower) / tonePower);
+    measurement.noiseDb   = toDb (noisePower / tonePower);
+
+    return measurement;
+}
+
+static Measurement measureMultitone (const Configuration& config, float level, int blockSize, double& processingSeconds)
+{
+    // Inharmonically spaced tones across the audio band, so that their products don't coincide with the tones
+    constexpr std::array<double, 6> frequencies { { 97.0, 331.0, 1013.0, 2767.0, 6143.0, 11953.0 } };
+
+    std::array<double, frequencies.size()> omegas;
+    BinClassification classification;
+
+    for (size_t t = 0; t < frequencies.size(); ++t)
+    {
+        const auto bin = frequencyToBin (frequencies[t], config.sampleRate);
+        omegas[t] = juce::MathConstants<double>::twoPi * static_cast<double> (bin) / static_cast<double> (fftSize);
+        classification.mark (bin, BinClassification::tone);
+    }
+
+    const auto toneLevel = static_cast<double> (level) / static_cast<double> (frequencies.size());
+
+    const auto output = render (config, blockSize, [&] (size_t i)
+    {
+        auto sum = 0.0;
+
+        for (auto omega : omegas)
+            sum += std::sin (omega * static_cast<double> (i));
+
+        return static_cast<float> (toneLevel * sum);
+    }, processingSeconds);
+
+    const auto power = computePowerSpectrum (output);
+
+    Measurement measurement;
+    measurement.signal  = "multitone";
+    measurement.thdnDb  = toDb (classification.sum (power, BinClassification::unclassified) / classification.sum (power, BinClassification::tone));
+    measurement.asrDb   = std::numeric_limits<double>::quiet_NaN();
+    measurement.noiseDb = std::numeric_limits<double>::quiet_NaN();
+
+    return measurement;
+}
+
+static juce::var toVar (const Configuration& config)
+{
+    auto* object = new juce::DynamicObject;
+    object->setProperty ("sampleRate",        config.sampleRate);
+    object->setProperty ("oversamplingOrder", config.oversamplingOrder);
+    object->setProperty ("drive",             config.drive);
+    object->setProperty ("hpMode",            config.hpMode);
+    return object;
+}
+
+static juce::String configurationColumns (const Configuration& config)
+{
+    return juce::String (config.sampleRate) + "," + juce::String (config.oversamplingOrder) + ","
+         + juce::String (config.drive) + "," + (config.hpMode ? "1" : "0");
+}
+
+/** NaN values are written as empty cells or null */
+static juce::String csvValue (double value)       { return std::isnan (value) ? juce::String() : juce::String (value, 2); }
+static juce::var    jsonValue (double value)      { return std::isnan (value) ? juce::var() : juce::var (value); }
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+
+    auto listOption = [&] (const juce::String& option, const juce::String& defaultValue)
+    {
+        return juce::StringArray::fromTokens (args.containsOption (option) ? args.getValueForOption (option) : defaultValue, ",", "");
+    };
+
+    const auto sampleRates = listOption ("--sample-rates", "44100,48000,96000");
+    const auto orders      = listOption ("--orders",       "0,1,2,3,4,5");
+    const auto drives      = listOption ("--drives",       "0,5,10");
+    const auto hpModes     = listOption ("--hplp",         "0,1");
+
+    const auto numSteps  = args.containsOption ("--steps")      ? juce::jmax (1, args.getValueForOption ("--steps").getIntValue()) : 16;
+    const auto level     = args.containsOption ("--level")      ? args.getValueForOption ("--level").getFloatValue() : 0.5f;
+    const auto blockSize = args.containsOption ("--block-size") ? juce::jmax (1, args.getValueForOption ("--block-size").getIntValue()) : 512;
+
+    // A stepped sweep with logarithmically spaced frequencies
+    std::vector<double> sweepFrequencies;
+    for (int step = 0; step < numSteps; ++step)
+        sweepFrequencies.push_back (100.0 * std::pow (160.0, numSteps > 1 ? static_cast<double> (step) / (numSteps - 1) : 0.0));
+
+    juce::Array<juce::var> measurementsJSON, configurationsJSON;
+    juce::StringArray measurementsCSV   { "sampleRate,oversamplingOrder,drive,hpMode,signal,frequency,asrDb,thdnDb,noiseDb" };
+    juce::StringArray configurationsCSV { "sampleRate,oversamplingOrder,drive,hpMode,cpuPercent,worstAsrDb,meanThdnDb,multitoneTdnDb" };
+
+    for (auto& sampleRate : sampleRates)
+    {
+        for (auto& order : orders)
+        {
+            for (auto& drive : drives)
+            {
+                for (auto& hpMode : hpModes)
+                {
+                    ConfigurationSummary summary;
+                    auto& config = summary.configuration;
+
+                    config.sampleRate        = sampleRate.getDoubleValue();
+                    config.oversamplingOrder = juce::jlimit (0, static_cast<int> (Waveshaper::maxOversamplingOrder), order.getIntValue());
+                    config.drive             = juce::jlimit (OJDCore::minKnobValue, OJDCore::maxKnobValue, drive.getFloatValue());
+                    config.hpMode            = hpMode.getIntValue() != 0;
+
+                    std::cerr << "Measuring " << configurationColumns (config) << std::endl;
+
+                    std::vector<Measurement> measurements;
+                    auto processingSeconds = 0.0;
+
+                    for (auto frequency : sweepFrequencies)
+                        if (frequency < 0.45 * config.sampleRate)
+                            measurements.push_back (measureSine (config, frequency, level, blockSize, processingSeconds));
+
+                    measurements.push_back (measureMultitone (config, level, blockSize, processingSeconds));
+
+                    const auto processedSeconds = static_cast<double> (measurements.size()) * (settleSeconds + static_cast<double> (fftSize) / config.sampleRate);
+                    summary.cpuPercent = 100.0 * processingSeconds / processedSeconds;
+
+                    auto thdnSum = 0.0;
+                    auto numSines = 0;
+
+                    for (auto& m : measurements)
+                    {
+                        if (m.signal == "multitone")
+                        {
+                            summary.multitoneTdnDb = m.thdnDb;
+                        }
+                        else
+                        {
+                            summary.worstAsrDb = juce::jmax (summary.worstAsrDb, m.asrDb);
+                            thdnSum += m.thdnDb;
+                            ++numSines;
+                        }
+
+                        auto* object = new juce::DynamicObject;
+                        object->setProperty ("configuration", toVar (config));
+                        object->setProperty ("signal",        m.signal);
+                        object->setProperty ("frequency",     jsonValue (m.signal == "multitone" ? std::numeric_limits<double>::quiet_NaN() : m.frequency));
+                        object->setProperty ("asrDb",         jsonValue (m.asrDb));
+                        object->setProperty ("thdnDb",        jsonValue (m.thdnDb));
+                        object->setProperty ("noiseDb",       jsonValue (m.noiseDb));
+                        measurementsJSON.add (object);
+
+                        measurementsCSV.add (configurationColumns (config) + "," + m.signal + "," + (m.signal == "multitone" ? juce::String() : juce::String (m.frequency, 1)) + ","
+                                             + csvValue (m.asrDb) + "," + csvValue (m.thdnDb) + "," + csvValue (m.noiseDb));
+                    }
+
+                    summary.meanThdnDb = numSines > 0 ? thdnSum / numSines : std::numeric_limits<double>::quiet_NaN();
+
+                    auto* object = new juce::DynamicObject;
+                    object->setProperty ("configuration",  toVar (config));
+                    object->setProperty ("cpuPercent",     summary.cpuPercent);
+                    object->setProperty ("worstAsrDb",     jsonValue (numSines > 0 ? summary.worstAsrDb : std::numeric_limits<double>::quiet_NaN()));
+                    object->setProperty ("meanThdnDb",     jsonValue (summary.meanThdnDb));
+                    object->setProperty ("multitoneTdnDb", jsonValue (summary.multitoneTdnDb));
+                    configurationsJSON.add (object);
+
+                    configurationsCSV.add (configurationColumns (config) + "," + juce::String (summary.cpuPercent, 3) + ","
+                                           + csvValue (numSines > 0 ? summary.worstAsrDb : std::numeric_limits<double>::quiet_NaN()) + ","
+                                           + csvValue (summary.meanThdnDb) + "," + csvValue (summary.multitoneTdnDb));
+                }
+            }
+        }
+    }
+
+    auto* root = new juce::DynamicObject;
+    root->setProperty ("fftSize",        static_cast<int> (fftSize));
+    root->setProperty ("level",          level);
+    root->setProperty ("configurations", configurationsJSON);
+    root->setProperty ("measurements",   measurementsJSON);
+
+    const auto json = juce::JSON::toString (juce::var (root));
+
+    if (args.containsOption ("--output"))
+    {
+        auto file = juce::File::getCurrentWorkingDirectory().getChildFile (args.getValueForOption ("--output"));
+
+        if (! file.replaceWithText (json))
+        {
+            std::cerr << "Could not write " << file.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << json << std::endl;
+    }
+
+    if (args.containsOption ("--csv"))
+    {
+        const auto prefix = args.getValueForOption ("--csv");
+        const auto directory = juce::File::getCurrentWorkingDirectory();
+
+        auto measurementsFile   = directory.getChildFile (prefix + "-measurements.csv");
+        auto configurationsFile = directory.getChildFile (prefix + "-configurations.csv");
+
+        if (! measurementsFile.replaceWithText (measurementsCSV.joinIntoString ("\n") + "\n")
+            || ! configurationsFile.replaceWithText (configurationsCSV.joinIntoString ("\n") + "\n"))
+        {
+            std::cerr << "Could not write the CSV files" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}